@@ -0,0 +1,43 @@
+#include "buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_CAPACITY_MIN ((size_t)256)
+
+static bool buffer_reserve(struct me_buffer *self, size_t size) {
+  if (self->capacity - self->size >= size) {
+    return true;
+  }
+
+  size_t capacity = self->capacity ? self->capacity : BUFFER_CAPACITY_MIN;
+  while (capacity - self->size < size) {
+    capacity *= 2;
+  }
+  char *bytes = realloc(self->bytes, capacity);
+  if (bytes == NULL) {
+    return false;
+  }
+  self->bytes = bytes;
+  self->capacity = capacity;
+  return true;
+}
+
+bool me_buffer_append(struct me_buffer *self, const void *bytes, size_t size) {
+  if (!buffer_reserve(self, size)) {
+    return false;
+  }
+  memcpy(self->bytes + self->size, bytes, size);
+  self->size += size;
+  return true;
+}
+
+void me_buffer_destroy(struct me_buffer *self) {
+  free(self->bytes);
+  *self = (struct me_buffer){ .bytes = NULL };
+}
+
+void me_buffer_trim(struct me_buffer *self, size_t capacity_max) {
+  if (self->capacity > capacity_max) {
+    me_buffer_destroy(self);
+  }
+}
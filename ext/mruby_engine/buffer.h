@@ -0,0 +1,22 @@
+#ifndef MRUBY_ENGINE_BUFFER_H
+#define MRUBY_ENGINE_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A growable byte buffer for serialized output. It is allocated with the
+// system allocator, never the host's, so it can grow without the GVL.
+struct me_buffer {
+  char *bytes;
+  size_t size;
+  size_t capacity;
+};
+
+// Returns false, leaving the buffer untouched, if it cannot grow.
+bool me_buffer_append(struct me_buffer *self, const void *bytes, size_t size);
+void me_buffer_destroy(struct me_buffer *self);
+// Releases the buffer if it grew beyond `capacity_max`, so that one large
+// output is not kept around for the buffer's lifetime.
+void me_buffer_trim(struct me_buffer *self, size_t capacity_max);
+
+#endif
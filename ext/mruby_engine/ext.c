@@ -3,6 +3,9 @@
 #include "memory_pool.h"
 #include "mruby_engine.h"
 #include "platform.h"
+#include "result_buffer.h"
+#include "schema.h"
+#include "shared_segment.h"
 #include <ruby.h>
 #include <ruby/encoding.h>
 #include <inttypes.h>
@@ -21,9 +24,61 @@ ID me_ext_id_ctx_switch_iv;
 ID me_ext_id_cpu_time;
 ID me_ext_id_mul;
 ID me_ext_id_type_eq;
+ID me_ext_id_allocator;
+ID me_ext_id_dlmalloc;
+ID me_ext_id_arena;
+ID me_ext_id_tlsf;
+ID me_ext_id_gc_disabled;
+ID me_ext_id_gc_watermark;
+ID me_ext_id_gc_mode;
+ID me_ext_id_gc_interval_ratio;
+ID me_ext_id_gc_step_ratio;
+ID me_ext_id_max_depth;
+ID me_ext_id_incremental;
+ID me_ext_id_generational;
+ID me_ext_id_gc_runs;
+ID me_ext_id_gc_time;
+ID me_ext_id_gc_live;
+ID me_ext_id_gc_heap_pages;
+ID me_ext_id_capacity;
+ID me_ext_id_shared_segments;
+ID me_ext_id_float_precision;
+ID me_ext_id_decimal;
+ID me_ext_id_string;
+ID me_ext_id_number;
+ID me_ext_id_schema;
+ID me_ext_id_track;
+ID me_ext_id_dedup;
+ID me_ext_id_zero_copy;
+ID me_ext_id_borrowed_strings;
+ID me_ext_id_freeze;
+ID me_ext_id_digest;
+ID me_ext_id_frozen_digests;
+ID me_ext_id_compare_by_identity;
+ID me_ext_id_schema_keys;
+ID me_ext_id_any;
+ID me_ext_id_boolean;
+ID me_ext_id_integer;
+ID me_ext_id_symbol;
+ID me_ext_id_big_decimal;
+ID me_ext_id_n_significant_digits;
+ID me_ext_id_to_s;
+ID me_ext_id_utc_p;
+ID me_ext_id_nil;
+ID me_ext_id_float;
+ID me_ext_id_array;
+ID me_ext_id_hash;
+ID me_ext_id_time;
+ID me_ext_id_set;
+ID me_ext_id_insert;
+ID me_ext_id_delete;
 VALUE me_ext_m_json;
+VALUE me_ext_e_json_parser_error;
 VALUE me_ext_c_mruby_engine;
 VALUE me_ext_c_iseq;
+VALUE me_ext_c_shared_segment;
+VALUE me_ext_c_schema;
+VALUE me_ext_c_result_buffer;
 VALUE me_ext_e_engine_error;
 VALUE me_ext_e_engine_runtime_error;
 VALUE me_ext_e_engine_type_error;
@@ -61,6 +116,30 @@ static void ext_iseq_free(struct me_iseq *iseq) {
   me_iseq_destroy(iseq);
 }
 
+static void ext_shared_segment_free(struct me_shared_segment *segment) {
+  if (!segment) {
+    return;
+  }
+
+  me_shared_segment_destroy(segment);
+}
+
+static void ext_result_buffer_free(struct me_result_buffer *buffer) {
+  if (!buffer) {
+    return;
+  }
+
+  me_result_buffer_destroy(buffer);
+}
+
+static void ext_schema_free(struct me_schema *schema) {
+  if (!schema) {
+    return;
+  }
+
+  me_schema_destroy(schema);
+}
+
 static VALUE ext_mruby_engine_alloc(VALUE class) {
   return Data_Wrap_Struct(class, NULL, ext_mruby_engine_free, NULL);
 }
@@ -69,6 +148,18 @@ static VALUE ext_iseq_alloc(VALUE class) {
   return Data_Wrap_Struct(class, NULL, ext_iseq_free, NULL);
 }
 
+static VALUE ext_shared_segment_alloc(VALUE class) {
+  return Data_Wrap_Struct(class, NULL, ext_shared_segment_free, NULL);
+}
+
+static VALUE ext_result_buffer_alloc(VALUE class) {
+  return Data_Wrap_Struct(class, NULL, ext_result_buffer_free, me_result_buffer_new());
+}
+
+static VALUE ext_schema_alloc(VALUE class) {
+  return Data_Wrap_Struct(class, NULL, ext_schema_free, NULL);
+}
+
 static void check_quota_error_raised(struct me_mruby_engine  *self) {
 
   if (me_mruby_engine_get_quota_exception_raised(self)) {
@@ -125,13 +216,103 @@ static void check_iseq_dump_err(struct me_iseq_err *err) {
   }
 }
 
+static enum me_memory_pool_type ext_memory_pool_type(VALUE rallocator) {
+  if (rallocator == Qundef) {
+    return ME_MEMORY_POOL_DLMALLOC;
+  }
+
+  Check_Type(rallocator, T_SYMBOL);
+  ID allocator = SYM2ID(rallocator);
+  if (allocator == me_ext_id_dlmalloc) {
+    return ME_MEMORY_POOL_DLMALLOC;
+  }
+  if (allocator == me_ext_id_arena) {
+    return ME_MEMORY_POOL_ARENA;
+  }
+  if (allocator == me_ext_id_tlsf) {
+    return ME_MEMORY_POOL_TLSF;
+  }
+
+  rb_raise(rb_eArgError, "unknown allocator %"PRIsVALUE, rallocator);
+}
+
+// Returns -1 when the mode is left to mruby's default.
+static int ext_gc_mode_generational(VALUE rmode) {
+  if (rmode == Qundef || NIL_P(rmode)) {
+    return -1;
+  }
+
+  Check_Type(rmode, T_SYMBOL);
+  ID mode = SYM2ID(rmode);
+  if (mode == me_ext_id_incremental) {
+    return 0;
+  }
+  if (mode == me_ext_id_generational) {
+    return 1;
+  }
+
+  rb_raise(rb_eArgError, "unknown gc mode %"PRIsVALUE, rmode);
+}
+
+// Returns 0 when the ratio is left to mruby's default.
+static int ext_gc_ratio(VALUE rratio, const char *name) {
+  if (rratio == Qundef || NIL_P(rratio)) {
+    return 0;
+  }
+
+  int ratio = NUM2INT(rratio);
+  if (ratio <= 0) {
+    rb_raise(rb_eArgError, "%s must be positive", name);
+  }
+  return ratio;
+}
+
+static void ext_mruby_engine_check_value_err(struct me_value_err *err);
+
 static VALUE ext_mruby_engine_initialize(int argc, VALUE *argv, VALUE rself) {
   ext_mruby_engine_free(DATA_PTR(rself));
 
   VALUE rcapacity;
   VALUE r_instruction_quota;
   VALUE r_time_quota_s;
-  rb_scan_args(argc, argv, "3", &rcapacity, &r_instruction_quota, &r_time_quota_s);
+  VALUE roptions;
+  rb_scan_args(argc, argv, "3:", &rcapacity, &r_instruction_quota, &r_time_quota_s, &roptions);
+
+  ID option_ids[] = {
+    me_ext_id_allocator,
+    me_ext_id_gc_disabled,
+    me_ext_id_gc_watermark,
+    me_ext_id_gc_mode,
+    me_ext_id_gc_interval_ratio,
+    me_ext_id_gc_step_ratio,
+    me_ext_id_max_depth,
+  };
+  VALUE roption_values[] = { Qundef, Qundef, Qundef, Qundef, Qundef, Qundef, Qundef };
+  if (!NIL_P(roptions)) {
+    rb_get_kwargs(roptions, option_ids, 0, 7, roption_values);
+  }
+  enum me_memory_pool_type pool_type = ext_memory_pool_type(roption_values[0]);
+  bool gc_disabled = roption_values[1] != Qundef && RTEST(roption_values[1]);
+
+  double gc_watermark = 0.0;
+  if (roption_values[2] != Qundef && !NIL_P(roption_values[2])) {
+    gc_watermark = NUM2DBL(roption_values[2]);
+    if (!(0.0 < gc_watermark && gc_watermark <= 1.0)) {
+      rb_raise(rb_eArgError, "gc watermark must be within (0, 1]");
+    }
+  }
+
+  int gc_generational = ext_gc_mode_generational(roption_values[3]);
+  int gc_interval_ratio = ext_gc_ratio(roption_values[4], "gc interval ratio");
+  int gc_step_ratio = ext_gc_ratio(roption_values[5], "gc step ratio");
+
+  int max_depth = ME_HOST_DATA_DEPTH_MAX;
+  if (roption_values[6] != Qundef && !NIL_P(roption_values[6])) {
+    max_depth = NUM2INT(roption_values[6]);
+    if (max_depth <= 0 || max_depth > ME_HOST_DATA_DEPTH_LIMIT) {
+      rb_raise(rb_eArgError, "max depth must be within 1..%d", ME_HOST_DATA_DEPTH_LIMIT);
+    }
+  }
 
   long capacity = NUM2LONG(rcapacity);
   if (capacity <= 0) {
@@ -150,7 +331,7 @@ static VALUE ext_mruby_engine_initialize(int argc, VALUE *argv, VALUE rself) {
   }
 
   struct me_memory_pool_err err = { 0 };
-  struct me_memory_pool *allocator = me_memory_pool_new(capacity, &err);
+  struct me_memory_pool *allocator = me_memory_pool_new(capacity, pool_type, &err);
   check_memory_pool_err(&err);
 
   struct timespec time_quota = (struct timespec){
@@ -167,8 +348,23 @@ static VALUE ext_mruby_engine_initialize(int argc, VALUE *argv, VALUE rself) {
     me_host_exception_t exception = me_host_internal_error_new("failed to initialize mruby");
     me_host_raise(exception);
   }
+  // mruby refuses to switch GC modes while the GC is disabled.
+  struct me_value_err value_err = { .type = ME_VALUE_NO_ERR };
+  if (gc_generational >= 0) {
+    me_mruby_engine_set_gc_generational(engine, gc_generational, &value_err);
+  }
+  me_mruby_engine_set_gc_disabled(engine, gc_disabled);
+  me_mruby_engine_set_gc_watermark(engine, gc_watermark);
+  if (gc_interval_ratio > 0) {
+    me_mruby_engine_set_gc_interval_ratio(engine, gc_interval_ratio);
+  }
+  if (gc_step_ratio > 0) {
+    me_mruby_engine_set_gc_step_ratio(engine, gc_step_ratio);
+  }
+  me_mruby_engine_set_data_depth_max(engine, max_depth);
 
   DATA_PTR(rself) = engine;
+  ext_mruby_engine_check_value_err(&value_err);
   return Qnil;
 }
 
@@ -178,6 +374,24 @@ static inline struct me_mruby_engine *ext_mruby_engine_unwrap(VALUE rengine) {
   return engine;
 }
 
+static inline struct me_shared_segment *ext_shared_segment_unwrap(VALUE rsegment) {
+  struct me_shared_segment *segment;
+  Data_Get_Struct(rsegment, struct me_shared_segment, segment);
+  return segment;
+}
+
+static inline struct me_result_buffer *ext_result_buffer_unwrap(VALUE rbuffer) {
+  struct me_result_buffer *buffer;
+  Data_Get_Struct(rbuffer, struct me_result_buffer, buffer);
+  return buffer;
+}
+
+static inline struct me_schema *ext_schema_unwrap(VALUE rschema) {
+  struct me_schema *schema;
+  Data_Get_Struct(rschema, struct me_schema, schema);
+  return schema;
+}
+
 static inline struct me_iseq *ext_iseq_unwrap(VALUE riseq) {
   struct me_iseq *iseq;
   Data_Get_Struct(riseq, struct me_iseq, iseq);
@@ -228,7 +442,7 @@ static void ext_mruby_engine_check_value_err(struct me_value_err *err) {
   case ME_VALUE_UNSUPPORTED:
     rb_raise(
       me_ext_e_engine_type_error,
-      "can only extract strings, fixnums, symbols, arrays or hashes");
+      "can only extract strings, fixnums, floats, decimals, times, symbols, arrays or hashes");
   case ME_VALUE_OUT_OF_RANGE:
     rb_raise(
       me_ext_e_engine_type_error,
@@ -239,23 +453,363 @@ static void ext_mruby_engine_check_value_err(struct me_value_err *err) {
       "structure nested too deeply");
   case ME_VALUE_GUEST_ERR:
     rb_exc_raise(err->guest_err.err);
+  case ME_VALUE_SEGMENT_FULL:
+    rb_raise(
+      rb_eArgError,
+      "value does not fit in the shared segment");
+  case ME_VALUE_PARSE_ERR:
+    rb_raise(
+      me_ext_e_json_parser_error,
+      "unexpected token at offset %zu",
+      err->parse_err.offset);
+  case ME_VALUE_NO_MEMORY:
+    rb_memerror();
+  case ME_VALUE_PACK_ERR:
+    rb_raise(
+      rb_eArgError,
+      "malformed packed data at offset %zu",
+      err->parse_err.offset);
+  case ME_VALUE_NOT_TRACKED:
+    rb_raise(
+      rb_eArgError,
+      "value was not injected with tracking");
+  case ME_VALUE_BAD_PATCH:
+    rb_raise(
+      rb_eArgError,
+      "patch operation %zu does not apply to the value",
+      err->patch_err.op);
+  case ME_VALUE_HOST_ERR:
+    rb_jump_tag(err->host_err.state);
   default:
     rb_raise(me_ext_e_engine_internal_error, "unknown");
   }
 }
 
-static VALUE ext_mruby_engine_inject(VALUE rself, VALUE r_ivar_name, VALUE rvalue) {
+// Guest strings injected from a shared segment point into its memory, so the
+// engine keeps every segment it was given alive in a hidden instance variable.
+// They are never released: strings, and symbols interned from them, can
+// outlive the instance variable they were injected into.
+static void ext_mruby_engine_pin_shared_segment(VALUE rself, VALUE rsegment) {
+  VALUE rsegments = rb_ivar_get(rself, me_ext_id_shared_segments);
+  if (NIL_P(rsegments)) {
+    rsegments = rb_hash_new();
+    rb_funcall(rsegments, me_ext_id_compare_by_identity, 0);
+    rb_ivar_set(rself, me_ext_id_shared_segments, rsegments);
+  }
+  rb_hash_aset(rsegments, rsegment, Qtrue);
+}
+
+// Writes `rvalue` into a new, sealed segment of `capacity` bytes held by
+// `rsegment`.
+static void ext_shared_segment_build(VALUE rsegment, VALUE rvalue, size_t capacity) {
+  struct me_memory_pool_err pool_err;
+  struct me_shared_segment *segment = me_shared_segment_new(capacity, &pool_err);
+  check_memory_pool_err(&pool_err);
+  DATA_PTR(rsegment) = segment;
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  struct me_shared_node *root = me_shared_segment_nodes_new(segment, 1);
+  if (root == NULL) {
+    err.type = ME_VALUE_SEGMENT_FULL;
+  } else {
+    me_value_to_shared(segment, rvalue, root, &err);
+  }
+  ext_mruby_engine_check_value_err(&err);
+
+  int err_no = me_shared_segment_seal(segment, root);
+  if (err_no) {
+    me_host_raise(me_host_internal_error_new_from_err_no("mprotect", err_no));
+  }
+}
+
+// Likewise for the frozen host strings whose bytes guest strings point at.
+static VALUE ext_mruby_engine_borrowed_strings(VALUE rself) {
+  VALUE rstrings = rb_ivar_get(rself, me_ext_id_borrowed_strings);
+  if (NIL_P(rstrings)) {
+    rstrings = rb_hash_new();
+    rb_funcall(rstrings, me_ext_id_compare_by_identity, 0);
+    rb_ivar_set(rself, me_ext_id_borrowed_strings, rstrings);
+  }
+  return rstrings;
+}
+
+// The digests given to frozen injections, by ivar name. Which of them are
+// still current is up to the engine.
+static VALUE ext_mruby_engine_frozen_digests(VALUE rself) {
+  VALUE rdigests = rb_ivar_get(rself, me_ext_id_frozen_digests);
+  if (NIL_P(rdigests)) {
+    rdigests = rb_hash_new();
+    rb_ivar_set(rself, me_ext_id_frozen_digests, rdigests);
+  }
+  return rdigests;
+}
+
+static VALUE ext_mruby_engine_inject(int argc, VALUE *argv, VALUE rself) {
   struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
   ext_mruby_engine_check_initialized(self, "inject");
   check_quota_error_raised(self);
 
+  VALUE r_ivar_name;
+  VALUE rvalue;
+  VALUE roptions;
+  rb_scan_args(argc, argv, "2:", &r_ivar_name, &rvalue, &roptions);
+
+  ID option_ids[] = {
+    me_ext_id_schema,
+    me_ext_id_track,
+    me_ext_id_dedup,
+    me_ext_id_zero_copy,
+    me_ext_id_freeze,
+    me_ext_id_digest,
+  };
+  VALUE roption_values[] = { Qundef, Qundef, Qundef, Qundef, Qundef, Qundef };
+  if (!NIL_P(roptions)) {
+    rb_get_kwargs(roptions, option_ids, 0, 6, roption_values);
+  }
+
+  struct me_inject_options options = (struct me_inject_options){
+    .schema = NULL,
+    .track = roption_values[1] != Qundef && RTEST(roption_values[1]),
+    .dedup = roption_values[2] != Qundef && RTEST(roption_values[2]),
+    .borrowed_strings = ME_HOST_NIL,
+    .freeze = roption_values[4] != Qundef && RTEST(roption_values[4]),
+  };
+  VALUE rdigest = roption_values[5] == Qundef ? Qnil : roption_values[5];
+  if (!NIL_P(rdigest) && !options.freeze) {
+    rb_raise(rb_eArgError, "a digest can only be given with freeze");
+  }
+  if (roption_values[3] != Qundef && RTEST(roption_values[3])) {
+    options.borrowed_strings = ext_mruby_engine_borrowed_strings(rself);
+  }
+  if (roption_values[0] != Qundef && !NIL_P(roption_values[0])) {
+    if (!rb_obj_is_kind_of(roption_values[0], me_ext_c_schema)) {
+      rb_raise(rb_eTypeError, "schema must be a MRubyEngine::Schema");
+    }
+    options.schema = ext_schema_unwrap(roption_values[0]);
+    if (!options.schema) {
+      rb_raise(rb_eArgError, "schema was not fully built");
+    }
+  }
+
   struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
-  me_mruby_engine_inject(self, StringValueCStr(r_ivar_name), rvalue, &err);
+  if (rb_obj_is_kind_of(rvalue, me_ext_c_shared_segment)) {
+    if (options.schema || options.track || options.dedup ||
+        options.borrowed_strings != ME_HOST_NIL || options.freeze) {
+      rb_raise(rb_eArgError, "a shared segment cannot be injected with a schema, tracking, dedup, zero copy or freeze");
+    }
+    struct me_shared_segment *segment = ext_shared_segment_unwrap(rvalue);
+    if (!segment || !me_shared_segment_sealed_p(segment)) {
+      rb_raise(rb_eArgError, "shared segment was not fully built");
+    }
+    ext_mruby_engine_pin_shared_segment(rself, rvalue);
+    me_mruby_engine_inject_shared(
+      self,
+      StringValueCStr(r_ivar_name),
+      me_shared_segment_get_root(segment),
+      &err);
+  } else {
+    me_mruby_engine_inject(self, StringValueCStr(r_ivar_name), &options, rvalue, &err);
+  }
+  ext_mruby_engine_check_value_err(&err);
+  RB_GC_GUARD(roption_values[0]);
+
+  if (options.freeze) {
+    rb_hash_aset(ext_mruby_engine_frozen_digests(rself), r_ivar_name, rdigest);
+  }
+
+  return rself;
+}
+
+// True when `ivar_name` still holds the value injected into it with freeze,
+// along with this digest, so that there is no need to inject it again.
+static VALUE ext_mruby_engine_injected_p(VALUE rself, VALUE r_ivar_name, VALUE rdigest) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "injected?");
+
+  const char *ivar_name = StringValueCStr(r_ivar_name);
+  if (!me_mruby_engine_injected_p(self, ivar_name)) {
+    return Qfalse;
+  }
+
+  VALUE rdigests = ext_mruby_engine_frozen_digests(rself);
+  VALUE rinjected_digest = rb_hash_lookup2(rdigests, r_ivar_name, Qundef);
+  return rinjected_digest != Qundef && rb_equal(rinjected_digest, rdigest) ? Qtrue : Qfalse;
+}
+
+// Collects the names as strings, so that the C strings handed to the engine
+// stay alive as long as `rnames`.
+static const char **ext_ivar_names(VALUE rnames, VALUE *rbuffer) {
+  long count = RARRAY_LEN(rnames);
+  const char **ivar_names = ALLOCV_N(const char *, *rbuffer, count);
+  for (long i = 0; i < count; ++i) {
+    VALUE rname = RARRAY_AREF(rnames, i);
+    ivar_names[i] = StringValueCStr(rname);
+  }
+  return ivar_names;
+}
+
+struct ext_inject_all_args {
+  VALUE rnames;
+  VALUE rvalues;
+};
+
+static int ext_inject_all_collect(VALUE rname, VALUE rvalue, VALUE data) {
+  struct ext_inject_all_args *args = (struct ext_inject_all_args *)data;
+  StringValue(rname);
+  if (rb_obj_is_kind_of(rvalue, me_ext_c_shared_segment)) {
+    rb_raise(rb_eArgError, "shared segments must be injected one at a time");
+  }
+  rb_ary_push(args->rnames, rname);
+  rb_ary_push(args->rvalues, rvalue);
+  return ST_CONTINUE;
+}
+
+static VALUE ext_mruby_engine_inject_all(int argc, VALUE *argv, VALUE rself) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "inject_all");
+  check_quota_error_raised(self);
+
+  VALUE rvalues_by_name;
+  VALUE roptions;
+  rb_scan_args(argc, argv, "1:", &rvalues_by_name, &roptions);
+  Check_Type(rvalues_by_name, T_HASH);
+
+  ID option_ids[] = { me_ext_id_track, me_ext_id_dedup, me_ext_id_zero_copy };
+  VALUE roption_values[] = { Qundef, Qundef, Qundef };
+  if (!NIL_P(roptions)) {
+    rb_get_kwargs(roptions, option_ids, 0, 3, roption_values);
+  }
+  struct me_inject_options options = (struct me_inject_options){
+    .schema = NULL,
+    .track = roption_values[0] != Qundef && RTEST(roption_values[0]),
+    .dedup = roption_values[1] != Qundef && RTEST(roption_values[1]),
+    .borrowed_strings = ME_HOST_NIL,
+  };
+  if (roption_values[2] != Qundef && RTEST(roption_values[2])) {
+    options.borrowed_strings = ext_mruby_engine_borrowed_strings(rself);
+  }
+
+  struct ext_inject_all_args args = (struct ext_inject_all_args){
+    .rnames = rb_ary_new_capa(RHASH_SIZE(rvalues_by_name)),
+    .rvalues = rb_ary_new_capa(RHASH_SIZE(rvalues_by_name)),
+  };
+  rb_hash_foreach(rvalues_by_name, ext_inject_all_collect, (VALUE)&args);
+
+  VALUE rnames_buffer;
+  const char **ivar_names = ext_ivar_names(args.rnames, &rnames_buffer);
+
+  // The values are only ever read from here on, so the array's storage can
+  // be handed over as is.
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  me_mruby_engine_inject_all(
+    self,
+    ivar_names,
+    (const me_host_value_t *)RARRAY_CONST_PTR(args.rvalues),
+    RARRAY_LEN(args.rvalues),
+    &options,
+    &err);
+  ALLOCV_END(rnames_buffer);
+  RB_GC_GUARD(args.rnames);
+  RB_GC_GUARD(args.rvalues);
+  ext_mruby_engine_check_value_err(&err);
+
+  return rself;
+}
+
+// Lazy values are proxies over a shared segment, which the guest can read
+// from any thread. The segment is pinned for the engine's lifetime, since
+// strings and symbols read from it point into its memory, so it has to be
+// built by the caller as a SharedSegment and can then be injected repeatedly.
+static VALUE ext_mruby_engine_inject_lazy(VALUE rself, VALUE r_ivar_name, VALUE rsegment) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "inject_lazy");
+  check_quota_error_raised(self);
+
+  const char *ivar_name = StringValueCStr(r_ivar_name);
+  if (!rb_obj_is_kind_of(rsegment, me_ext_c_shared_segment)) {
+    rb_raise(rb_eTypeError, "lazy values must be injected from a shared segment");
+  }
+  struct me_shared_segment *segment = ext_shared_segment_unwrap(rsegment);
+  if (!segment || !me_shared_segment_sealed_p(segment)) {
+    rb_raise(rb_eArgError, "shared segment was not fully built");
+  }
+  ext_mruby_engine_pin_shared_segment(rself, rsegment);
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  me_mruby_engine_inject_lazy(self, ivar_name, me_shared_segment_get_root(segment), &err);
+  ext_mruby_engine_check_value_err(&err);
+  RB_GC_GUARD(r_ivar_name);
+
+  return rself;
+}
+
+typedef void (*ext_inject_serialized_t)(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err);
+
+struct ext_mruby_engine_inject_serialized_args {
+  struct me_mruby_engine *self;
+  ext_inject_serialized_t inject;
+  const char *ivar_name;
+  const char *bytes;
+  size_t size;
+  struct me_value_err *err;
+};
+
+static void *ext_mruby_engine_inject_serialized_without_gvl(void *data) {
+  struct ext_mruby_engine_inject_serialized_args *args = data;
+  args->inject(args->self, args->ivar_name, args->bytes, args->size, args->err);
+  return NULL;
+}
+
+// Parsing builds guest objects only, so it runs without the GVL; the string
+// is locked so that it cannot change underneath the parser in the meantime.
+static VALUE ext_mruby_engine_inject_serialized(
+  VALUE rself,
+  VALUE r_ivar_name,
+  VALUE rbytes,
+  const char *caller,
+  ext_inject_serialized_t inject)
+{
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, caller);
+  check_quota_error_raised(self);
+
+  StringValue(rbytes);
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  struct ext_mruby_engine_inject_serialized_args args = (struct ext_mruby_engine_inject_serialized_args){
+    .self = self,
+    .inject = inject,
+    .ivar_name = StringValueCStr(r_ivar_name),
+    .bytes = RSTRING_PTR(rbytes),
+    .size = RSTRING_LEN(rbytes),
+    .err = &err,
+  };
+
+  rb_str_locktmp(rbytes);
+  me_host_invoke_unblocking(ext_mruby_engine_inject_serialized_without_gvl, &args);
+  rb_str_unlocktmp(rbytes);
+  RB_GC_GUARD(rbytes);
+
+  me_value_guest_take_exception(self, &err);
   ext_mruby_engine_check_value_err(&err);
 
   return rself;
 }
 
+static VALUE ext_mruby_engine_inject_json(VALUE rself, VALUE r_ivar_name, VALUE rjson) {
+  return ext_mruby_engine_inject_serialized(
+    rself, r_ivar_name, rjson, "inject_json", me_mruby_engine_inject_json);
+}
+
+static VALUE ext_mruby_engine_inject_packed(VALUE rself, VALUE r_ivar_name, VALUE rpacked) {
+  return ext_mruby_engine_inject_serialized(
+    rself, r_ivar_name, rpacked, "inject_packed", me_mruby_engine_inject_packed);
+}
+
 static VALUE ext_mruby_engine_extract(VALUE rself, VALUE r_ivar_name) {
   struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
   ext_mruby_engine_check_initialized(self, "extract");
@@ -268,6 +822,337 @@ static VALUE ext_mruby_engine_extract(VALUE rself, VALUE r_ivar_name) {
   return result;
 }
 
+static VALUE ext_mruby_engine_extract_all(VALUE rself, VALUE r_ivar_names) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "extract_all");
+  check_quota_error_raised(self);
+
+  Check_Type(r_ivar_names, T_ARRAY);
+  VALUE rnames = rb_ary_new_capa(RARRAY_LEN(r_ivar_names));
+  for (long i = 0; i < RARRAY_LEN(r_ivar_names); ++i) {
+    VALUE rname = RARRAY_AREF(r_ivar_names, i);
+    StringValue(rname);
+    rb_ary_push(rnames, rname);
+  }
+
+  VALUE rnames_buffer;
+  const char **ivar_names = ext_ivar_names(rnames, &rnames_buffer);
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  VALUE rvalues = me_mruby_engine_extract_all(self, ivar_names, RARRAY_LEN(rnames), &err);
+  ALLOCV_END(rnames_buffer);
+  ext_mruby_engine_check_value_err(&err);
+
+  VALUE result = rb_hash_new();
+  for (long i = 0; i < RARRAY_LEN(rnames); ++i) {
+    rb_hash_aset(result, RARRAY_AREF(rnames, i), RARRAY_AREF(rvalues, i));
+  }
+  return result;
+}
+
+static VALUE ext_mruby_engine_extract_changes(VALUE rself, VALUE r_ivar_name) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "extract_changes");
+  check_quota_error_raised(self);
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  VALUE result = me_mruby_engine_extract_changes(self, StringValueCStr(r_ivar_name), &err);
+  ext_mruby_engine_check_value_err(&err);
+
+  return result;
+}
+
+static void ext_value_path_step(VALUE rstep, struct me_value_path_step *step) {
+  switch (rb_type(rstep)) {
+  case T_STRING:
+    if (RSTRING_LEN(rstep) == 1 && RSTRING_PTR(rstep)[0] == '*') {
+      *step = (struct me_value_path_step){ .type = ME_VALUE_PATH_WILDCARD };
+    } else {
+      *step = (struct me_value_path_step){
+        .type = ME_VALUE_PATH_STRING,
+        .key = { .bytes = RSTRING_PTR(rstep), .size = RSTRING_LEN(rstep) },
+      };
+    }
+    return;
+  case T_SYMBOL:
+    {
+      VALUE rname = rb_sym2str(rstep);
+      *step = (struct me_value_path_step){
+        .type = ME_VALUE_PATH_SYMBOL,
+        .key = { .bytes = RSTRING_PTR(rname), .size = RSTRING_LEN(rname) },
+      };
+      return;
+    }
+  case T_FIXNUM:
+    *step = (struct me_value_path_step){
+      .type = ME_VALUE_PATH_INDEX,
+      .index = FIX2LONG(rstep),
+    };
+    return;
+  default:
+    rb_raise(rb_eArgError, "path steps must be strings, symbols or integers, not %"PRIsVALUE, rstep);
+  }
+}
+
+static VALUE ext_mruby_engine_extract_paths(VALUE rself, VALUE r_ivar_name, VALUE rpaths) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "extract_paths");
+  check_quota_error_raised(self);
+
+  const char *ivar_name = StringValueCStr(r_ivar_name);
+  Check_Type(rpaths, T_ARRAY);
+  long count = RARRAY_LEN(rpaths);
+  long step_count = 0;
+  for (long i = 0; i < count; ++i) {
+    VALUE rpath = RARRAY_AREF(rpaths, i);
+    Check_Type(rpath, T_ARRAY);
+    step_count += RARRAY_LEN(rpath);
+  }
+
+  // No Ruby code runs from here on, so the paths cannot change while steps
+  // point into their strings.
+  VALUE rpaths_buffer;
+  VALUE rsteps_buffer;
+  struct me_value_path *paths = ALLOCV_N(struct me_value_path, rpaths_buffer, count);
+  struct me_value_path_step *steps = ALLOCV_N(struct me_value_path_step, rsteps_buffer, step_count);
+  struct me_value_path_step *step = steps;
+  for (long i = 0; i < count; ++i) {
+    VALUE rpath = RARRAY_AREF(rpaths, i);
+    long size = RARRAY_LEN(rpath);
+    paths[i] = (struct me_value_path){ .steps = step, .size = size };
+    for (long j = 0; j < size; ++j) {
+      ext_value_path_step(RARRAY_AREF(rpath, j), step++);
+    }
+  }
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  VALUE result = me_mruby_engine_extract_paths(self, ivar_name, paths, count, &err);
+  ALLOCV_END(rpaths_buffer);
+  ALLOCV_END(rsteps_buffer);
+  RB_GC_GUARD(rpaths);
+  RB_GC_GUARD(r_ivar_name);
+  ext_mruby_engine_check_value_err(&err);
+
+  return result;
+}
+
+static enum me_value_patch_op_type ext_patch_op_type(VALUE rtype) {
+  if (SYMBOL_P(rtype)) {
+    ID type = SYM2ID(rtype);
+    if (type == me_ext_id_set) {
+      return ME_VALUE_PATCH_SET;
+    }
+    if (type == me_ext_id_insert) {
+      return ME_VALUE_PATCH_INSERT;
+    }
+    if (type == me_ext_id_delete) {
+      return ME_VALUE_PATCH_DELETE;
+    }
+  }
+
+  rb_raise(rb_eArgError, "unknown patch operation %"PRIsVALUE, rtype);
+}
+
+// Operations are [:set, path, value], [:insert, path, value] or
+// [:delete, path].
+static VALUE ext_mruby_engine_patch(VALUE rself, VALUE r_ivar_name, VALUE rops) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "patch");
+  check_quota_error_raised(self);
+
+  const char *ivar_name = StringValueCStr(r_ivar_name);
+  Check_Type(rops, T_ARRAY);
+  long count = RARRAY_LEN(rops);
+  long step_count = 0;
+  for (long i = 0; i < count; ++i) {
+    VALUE rop = RARRAY_AREF(rops, i);
+    Check_Type(rop, T_ARRAY);
+    long size = ext_patch_op_type(rb_ary_entry(rop, 0)) == ME_VALUE_PATCH_DELETE ? 2 : 3;
+    if (RARRAY_LEN(rop) != size) {
+      rb_raise(rb_eArgError, "patch operation %ld must have %ld elements", i, size);
+    }
+    VALUE rpath = RARRAY_AREF(rop, 1);
+    Check_Type(rpath, T_ARRAY);
+    if (RARRAY_LEN(rpath) == 0) {
+      rb_raise(rb_eArgError, "patch paths cannot be empty");
+    }
+    step_count += RARRAY_LEN(rpath);
+  }
+
+  // As with extract_paths, steps point into the strings of the operations.
+  // The values converted along the way may run Ruby code, but only their own.
+  VALUE rops_buffer;
+  VALUE rsteps_buffer;
+  struct me_value_patch_op *ops = ALLOCV_N(struct me_value_patch_op, rops_buffer, count);
+  struct me_value_path_step *steps = ALLOCV_N(struct me_value_path_step, rsteps_buffer, step_count);
+  struct me_value_path_step *step = steps;
+  for (long i = 0; i < count; ++i) {
+    VALUE rop = RARRAY_AREF(rops, i);
+    VALUE rpath = RARRAY_AREF(rop, 1);
+    long size = RARRAY_LEN(rpath);
+    ops[i] = (struct me_value_patch_op){
+      .type = ext_patch_op_type(RARRAY_AREF(rop, 0)),
+      .path = { .steps = step, .size = size },
+      .value = rb_ary_entry(rop, 2),
+    };
+    for (long j = 0; j < size; ++j, ++step) {
+      ext_value_path_step(RARRAY_AREF(rpath, j), step);
+      if (step->type == ME_VALUE_PATH_WILDCARD) {
+        rb_raise(rb_eArgError, "patch paths cannot contain wildcards");
+      }
+    }
+  }
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  me_mruby_engine_patch(self, ivar_name, ops, count, &err);
+  ALLOCV_END(rops_buffer);
+  ALLOCV_END(rsteps_buffer);
+  RB_GC_GUARD(rops);
+  RB_GC_GUARD(r_ivar_name);
+  ext_mruby_engine_check_value_err(&err);
+
+  return rself;
+}
+
+static bool ext_json_decimal_as_number(VALUE rdecimal) {
+  if (rdecimal == Qundef || NIL_P(rdecimal)) {
+    return false;
+  }
+
+  Check_Type(rdecimal, T_SYMBOL);
+  ID decimal = SYM2ID(rdecimal);
+  if (decimal == me_ext_id_string) {
+    return false;
+  }
+  if (decimal == me_ext_id_number) {
+    return true;
+  }
+
+  rb_raise(rb_eArgError, "unknown decimal format %"PRIsVALUE, rdecimal);
+}
+
+struct ext_mruby_engine_extract_serialized_args {
+  struct me_mruby_engine *self;
+  const char *ivar_name;
+  const struct me_json_options *json_options;
+  struct me_value_err *err;
+};
+
+static void *ext_mruby_engine_extract_json_without_gvl(void *data) {
+  struct ext_mruby_engine_extract_serialized_args *args = data;
+  return (void *)me_mruby_engine_extract_json(args->self, args->ivar_name, args->json_options, args->err);
+}
+
+static void *ext_mruby_engine_extract_packed_without_gvl(void *data) {
+  struct ext_mruby_engine_extract_serialized_args *args = data;
+  return (void *)me_mruby_engine_extract_packed(args->self, args->ivar_name, args->err);
+}
+
+static VALUE ext_mruby_engine_extract_json(int argc, VALUE *argv, VALUE rself) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "extract_json");
+  check_quota_error_raised(self);
+
+  VALUE r_ivar_name;
+  VALUE roptions;
+  rb_scan_args(argc, argv, "1:", &r_ivar_name, &roptions);
+
+  ID option_ids[] = { me_ext_id_float_precision, me_ext_id_decimal };
+  VALUE roption_values[] = { Qundef, Qundef };
+  if (!NIL_P(roptions)) {
+    rb_get_kwargs(roptions, option_ids, 0, 2, roption_values);
+  }
+
+  struct me_json_options options = (struct me_json_options){
+    .float_precision = 0,
+    .decimal_as_number = ext_json_decimal_as_number(roption_values[1]),
+  };
+  if (roption_values[0] != Qundef && !NIL_P(roption_values[0])) {
+    options.float_precision = NUM2INT(roption_values[0]);
+    if (options.float_precision < 1 || 17 < options.float_precision) {
+      rb_raise(rb_eArgError, "float precision must be within 1..17");
+    }
+  }
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  struct ext_mruby_engine_extract_serialized_args args = (struct ext_mruby_engine_extract_serialized_args){
+    .self = self,
+    .ivar_name = StringValueCStr(r_ivar_name),
+    .json_options = &options,
+    .err = &err,
+  };
+  const struct me_buffer *buffer =
+    me_host_invoke_unblocking(ext_mruby_engine_extract_json_without_gvl, &args);
+
+  me_value_guest_take_exception(self, &err);
+  ext_mruby_engine_check_value_err(&err);
+
+  return rb_utf8_str_new(buffer->bytes, buffer->size);
+}
+
+static VALUE ext_mruby_engine_extract_packed(VALUE rself, VALUE r_ivar_name) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "extract_packed");
+  check_quota_error_raised(self);
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  struct ext_mruby_engine_extract_serialized_args args = (struct ext_mruby_engine_extract_serialized_args){
+    .self = self,
+    .ivar_name = StringValueCStr(r_ivar_name),
+    .err = &err,
+  };
+  const struct me_buffer *buffer =
+    me_host_invoke_unblocking(ext_mruby_engine_extract_packed_without_gvl, &args);
+
+  me_value_guest_take_exception(self, &err);
+  ext_mruby_engine_check_value_err(&err);
+
+  return rb_str_new(buffer->bytes, buffer->size);
+}
+
+// Unlike extract_packed this keeps the GVL: the buffer is a Ruby object that
+// another thread could be reading while it grows.
+static VALUE ext_mruby_engine_extract_into(VALUE rself, VALUE r_ivar_name, VALUE rbuffer) {
+  struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
+  ext_mruby_engine_check_initialized(self, "extract_into");
+  check_quota_error_raised(self);
+
+  if (!rb_obj_is_kind_of(rbuffer, me_ext_c_result_buffer)) {
+    rb_raise(rb_eTypeError, "buffer must be a MRubyEngine::ResultBuffer");
+  }
+  struct me_result_buffer *buffer = ext_result_buffer_unwrap(rbuffer);
+
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  me_mruby_engine_extract_result(self, StringValueCStr(r_ivar_name), buffer, &err);
+  me_value_guest_take_exception(self, &err);
+  ext_mruby_engine_check_value_err(&err);
+
+  return rbuffer;
+}
+
+static VALUE ext_mruby_engine_s_pack(VALUE rclass, VALUE rvalue) {
+  (void)rclass;
+  struct me_buffer buffer = (struct me_buffer){ .bytes = NULL };
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  me_value_host_pack(rvalue, &buffer, &err);
+  VALUE result = err.type == ME_VALUE_NO_ERR ? rb_str_new(buffer.bytes, buffer.size) : Qnil;
+  me_buffer_destroy(&buffer);
+  ext_mruby_engine_check_value_err(&err);
+
+  return result;
+}
+
+static VALUE ext_mruby_engine_s_unpack(VALUE rclass, VALUE rpacked) {
+  (void)rclass;
+  StringValue(rpacked);
+  struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+  VALUE result = me_value_host_unpack(RSTRING_PTR(rpacked), RSTRING_LEN(rpacked), &err);
+  RB_GC_GUARD(rpacked);
+  ext_mruby_engine_check_value_err(&err);
+
+  return result;
+}
+
 static VALUE ext_mruby_engine_stat(VALUE rself) {
   struct me_mruby_engine *self = ext_mruby_engine_unwrap(rself);
   ext_mruby_engine_check_initialized(self, "stat");
@@ -300,6 +1185,11 @@ static VALUE ext_mruby_engine_stat(VALUE rself) {
   int64_t cpu_time = me_mruby_engine_get_cpu_time(self);
   rb_hash_aset(stat, ID2SYM(me_ext_id_cpu_time), LONG2NUM(cpu_time));
 
+  rb_hash_aset(stat, ID2SYM(me_ext_id_gc_runs), ULONG2NUM(me_mruby_engine_get_gc_runs(self)));
+  rb_hash_aset(stat, ID2SYM(me_ext_id_gc_time), LONG2NUM(me_mruby_engine_get_gc_time(self)));
+  rb_hash_aset(stat, ID2SYM(me_ext_id_gc_live), ULONG2NUM(me_mruby_engine_get_gc_live(self)));
+  rb_hash_aset(stat, ID2SYM(me_ext_id_gc_heap_pages), ULONG2NUM(me_mruby_engine_get_gc_heap_pages(self)));
+
   return stat;
 }
 
@@ -329,7 +1219,10 @@ static VALUE ext_iseq_initialize(VALUE rself, VALUE rsources) {
   sources[source_count] = (struct me_source){0};
 
   struct me_memory_pool_err pool_err;
-  struct me_memory_pool *allocator = me_memory_pool_new(COMPILE_MEMORY_CAPACITY, &pool_err);
+  struct me_memory_pool *allocator = me_memory_pool_new(
+    COMPILE_MEMORY_CAPACITY,
+    ME_MEMORY_POOL_DLMALLOC,
+    &pool_err);
   check_memory_pool_err(&pool_err);
 
   struct me_iseq_err err;
@@ -341,6 +1234,240 @@ static VALUE ext_iseq_initialize(VALUE rself, VALUE rsources) {
   return Qnil;
 }
 
+static const size_t SHARED_SEGMENT_DEFAULT_CAPACITY = 64 * MiB;
+
+static VALUE ext_shared_segment_initialize(int argc, VALUE *argv, VALUE rself) {
+  ext_shared_segment_free(DATA_PTR(rself));
+  DATA_PTR(rself) = NULL;
+
+  VALUE rvalue;
+  VALUE roptions;
+  rb_scan_args(argc, argv, "1:", &rvalue, &roptions);
+
+  ID option_ids[] = { me_ext_id_capacity };
+  VALUE roption_values[] = { Qundef };
+  if (!NIL_P(roptions)) {
+    rb_get_kwargs(roptions, option_ids, 0, 1, roption_values);
+  }
+
+  size_t capacity = SHARED_SEGMENT_DEFAULT_CAPACITY;
+  if (roption_values[0] != Qundef) {
+    long rcapacity = NUM2LONG(roption_values[0]);
+    if (rcapacity <= 0) {
+      rb_raise(rb_eArgError, "shared segment capacity cannot be negative");
+    }
+    capacity = rcapacity;
+  }
+
+  ext_shared_segment_build(rself, rvalue, capacity);
+  return Qnil;
+}
+
+static VALUE ext_shared_segment_size(VALUE rself) {
+  struct me_shared_segment *segment = ext_shared_segment_unwrap(rself);
+  if (!segment) {
+    rb_raise(rb_eArgError, "uninitialized value when calling 'size'");
+  }
+
+  return ULONG2NUM(me_shared_segment_get_size(segment));
+}
+
+// Result buffer nodes are addressed by their index, 0 being the root. They
+// are only materialized as Ruby objects when asked for their value.
+static const struct me_result_node *ext_result_buffer_node(
+  const struct me_result_buffer *buffer,
+  VALUE rnode)
+{
+  long index = NUM2LONG(rnode);
+  const struct me_result_node *node = index < 0 ? NULL : me_result_buffer_get_node(buffer, index);
+  if (node == NULL) {
+    rb_raise(rb_eIndexError, "no node %ld in the result buffer", index);
+  }
+  return node;
+}
+
+static const struct me_result_node *ext_result_buffer_container(
+  const struct me_result_buffer *buffer,
+  VALUE rnode,
+  enum me_result_node_type type)
+{
+  const struct me_result_node *node = ext_result_buffer_node(buffer, rnode);
+  if (node->type == type || (type == ME_RESULT_ARRAY && node->type == ME_RESULT_HASH)) {
+    return node;
+  }
+  rb_raise(
+    rb_eTypeError,
+    "node %"PRIsVALUE" is not %s",
+    rnode,
+    type == ME_RESULT_HASH ? "a hash" : "an array or a hash");
+}
+
+static long ext_result_buffer_position(const struct me_result_node *node, VALUE rindex) {
+  long index = NUM2LONG(rindex);
+  if (index < 0 || (unsigned long)index >= node->size) {
+    rb_raise(rb_eIndexError, "index %ld outside of %u elements", index, node->size);
+  }
+  return index;
+}
+
+static VALUE ext_result_buffer_args_node(int argc, VALUE *argv) {
+  VALUE rnode;
+  rb_scan_args(argc, argv, "01", &rnode);
+  return NIL_P(rnode) ? INT2FIX(0) : rnode;
+}
+
+static VALUE ext_result_buffer_type(int argc, VALUE *argv, VALUE rself) {
+  const struct me_result_buffer *buffer = ext_result_buffer_unwrap(rself);
+  const struct me_result_node *node = ext_result_buffer_node(buffer, ext_result_buffer_args_node(argc, argv));
+  switch (node->type) {
+  case ME_RESULT_NIL:
+    return ID2SYM(me_ext_id_nil);
+  case ME_RESULT_FALSE:
+  case ME_RESULT_TRUE:
+    return ID2SYM(me_ext_id_boolean);
+  case ME_RESULT_INTEGER:
+    return ID2SYM(me_ext_id_integer);
+  case ME_RESULT_FLOAT:
+    return ID2SYM(me_ext_id_float);
+  case ME_RESULT_STRING:
+    return ID2SYM(me_ext_id_string);
+  case ME_RESULT_SYMBOL:
+    return ID2SYM(me_ext_id_symbol);
+  case ME_RESULT_ARRAY:
+    return ID2SYM(me_ext_id_array);
+  case ME_RESULT_HASH:
+    return ID2SYM(me_ext_id_hash);
+  case ME_RESULT_DECIMAL:
+    return ID2SYM(me_ext_id_decimal);
+  case ME_RESULT_TIME:
+  case ME_RESULT_UTC_TIME:
+    return ID2SYM(me_ext_id_time);
+  }
+  rb_raise(me_ext_e_engine_internal_error, "unknown result node type");
+}
+
+// Elements of an array, pairs of a hash, bytes of a string or a symbol.
+static VALUE ext_result_buffer_size(int argc, VALUE *argv, VALUE rself) {
+  const struct me_result_buffer *buffer = ext_result_buffer_unwrap(rself);
+  VALUE rnode = ext_result_buffer_args_node(argc, argv);
+  const struct me_result_node *node = ext_result_buffer_node(buffer, rnode);
+  switch (node->type) {
+  case ME_RESULT_STRING:
+  case ME_RESULT_SYMBOL:
+  case ME_RESULT_ARRAY:
+  case ME_RESULT_HASH:
+    return UINT2NUM(node->size);
+  default:
+    rb_raise(rb_eTypeError, "node %"PRIsVALUE" has no size", rnode);
+  }
+}
+
+// The element at `rindex` of an array, or the value of the pair at `rindex`
+// of a hash.
+static VALUE ext_result_buffer_child(VALUE rself, VALUE rnode, VALUE rindex) {
+  const struct me_result_buffer *buffer = ext_result_buffer_unwrap(rself);
+  const struct me_result_node *node = ext_result_buffer_container(buffer, rnode, ME_RESULT_ARRAY);
+  long index = ext_result_buffer_position(node, rindex);
+  return ULONG2NUM(node->type == ME_RESULT_HASH ? node->first + 2 * index + 1 : node->first + index);
+}
+
+static VALUE ext_result_buffer_key(VALUE rself, VALUE rnode, VALUE rindex) {
+  const struct me_result_buffer *buffer = ext_result_buffer_unwrap(rself);
+  const struct me_result_node *node = ext_result_buffer_container(buffer, rnode, ME_RESULT_HASH);
+  long index = ext_result_buffer_position(node, rindex);
+  return ULONG2NUM(node->first + 2 * index);
+}
+
+// Finds the value for a string or symbol key by comparing bytes, without
+// materializing any key. Returns nil if there is none.
+static VALUE ext_result_buffer_lookup(VALUE rself, VALUE rnode, VALUE rkey) {
+  const struct me_result_buffer *buffer = ext_result_buffer_unwrap(rself);
+  const struct me_result_node *node = ext_result_buffer_container(buffer, rnode, ME_RESULT_HASH);
+
+  enum me_result_node_type type;
+  if (SYMBOL_P(rkey)) {
+    type = ME_RESULT_SYMBOL;
+    rkey = rb_sym2str(rkey);
+  } else if (RB_TYPE_P(rkey, T_STRING)) {
+    type = ME_RESULT_STRING;
+  } else {
+    rb_raise(rb_eTypeError, "keys must be strings or symbols, not %"PRIsVALUE, rkey);
+  }
+
+  for (uint32_t i = 0; i < node->size; ++i) {
+    const struct me_result_node *key = &buffer->nodes[node->first + 2 * i];
+    if (key->type == type &&
+        key->size == (unsigned long)RSTRING_LEN(rkey) &&
+        memcmp(me_result_buffer_get_bytes(buffer, key), RSTRING_PTR(rkey), key->size) == 0) {
+      return ULONG2NUM(node->first + 2 * i + 1);
+    }
+  }
+  return Qnil;
+}
+
+static VALUE ext_result_buffer_to_host(
+  const struct me_result_buffer *buffer,
+  const struct me_result_node *node)
+{
+  switch (node->type) {
+  case ME_RESULT_NIL:
+    return Qnil;
+  case ME_RESULT_FALSE:
+    return Qfalse;
+  case ME_RESULT_TRUE:
+    return Qtrue;
+  case ME_RESULT_INTEGER:
+    return LL2NUM(node->integer);
+  case ME_RESULT_FLOAT:
+    return DBL2NUM(node->real);
+  case ME_RESULT_STRING:
+    return rb_enc_str_new(me_result_buffer_get_bytes(buffer, node), node->size, rb_utf8_encoding());
+  case ME_RESULT_SYMBOL:
+    return ID2SYM(rb_intern3(me_result_buffer_get_bytes(buffer, node), node->size, rb_utf8_encoding()));
+  case ME_RESULT_ARRAY:
+    {
+      VALUE rarray = rb_ary_new_capa(node->size);
+      for (uint32_t i = 0; i < node->size; ++i) {
+        rb_ary_push(rarray, ext_result_buffer_to_host(buffer, &buffer->nodes[node->first + i]));
+      }
+      return rarray;
+    }
+  case ME_RESULT_HASH:
+    {
+      VALUE rhash = rb_hash_new();
+      for (uint32_t i = 0; i < node->size; ++i) {
+        VALUE rkey = ext_result_buffer_to_host(buffer, &buffer->nodes[node->first + 2 * i]);
+        VALUE rvalue = ext_result_buffer_to_host(buffer, &buffer->nodes[node->first + 2 * i + 1]);
+        rb_hash_aset(rhash, rkey, rvalue);
+      }
+      return rhash;
+    }
+  case ME_RESULT_DECIMAL:
+    {
+      struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+      VALUE rdecimal = me_value_host_decimal_new(me_result_buffer_get_bytes(buffer, node), node->size, &err);
+      ext_mruby_engine_check_value_err(&err);
+      return rdecimal;
+    }
+  case ME_RESULT_TIME:
+  case ME_RESULT_UTC_TIME:
+    {
+      struct me_value_err err = (struct me_value_err){ .type = ME_VALUE_NO_ERR };
+      VALUE rtime = me_value_host_time_new(node->integer, node->size, node->type == ME_RESULT_UTC_TIME, &err);
+      ext_mruby_engine_check_value_err(&err);
+      return rtime;
+    }
+  }
+  rb_raise(me_ext_e_engine_internal_error, "unknown result node type");
+}
+
+// Materializes the node and everything it holds.
+static VALUE ext_result_buffer_value(int argc, VALUE *argv, VALUE rself) {
+  const struct me_result_buffer *buffer = ext_result_buffer_unwrap(rself);
+  const struct me_result_node *node = ext_result_buffer_node(buffer, ext_result_buffer_args_node(argc, argv));
+  return ext_result_buffer_to_host(buffer, node);
+}
+
 static VALUE ext_iseq_size(VALUE rself) {
   struct me_iseq *iseq = ext_iseq_unwrap(rself);
 
@@ -358,6 +1485,154 @@ static VALUE ext_iseq_hash(VALUE rself) {
   return ULONG2NUM((unsigned long)me_iseq_hash(iseq));
 }
 
+static uint32_t ext_schema_compile(
+  struct me_schema *schema,
+  VALUE rkeys,
+  VALUE rspec,
+  int depth);
+
+struct ext_schema_field_args {
+  struct me_schema *schema;
+  VALUE rkeys;
+  uint32_t field;
+  int depth;
+};
+
+static int ext_schema_compile_field(VALUE rkey, VALUE rspec, VALUE data) {
+  struct ext_schema_field_args *args = (struct ext_schema_field_args *)data;
+
+  VALUE rfield_key;
+  ID symbol_id = 0;
+  if (RB_TYPE_P(rkey, T_SYMBOL)) {
+    symbol_id = rb_sym2id(rkey);
+    rfield_key = ID2SYM(symbol_id);
+  } else if (RB_TYPE_P(rkey, T_STRING)) {
+    rfield_key = rb_str_new_frozen(rkey);
+  } else {
+    rb_raise(rb_eArgError, "schema keys must be strings or symbols, not %"PRIsVALUE, rkey);
+  }
+  rb_ary_push(args->rkeys, rfield_key);
+
+  uint32_t node = ext_schema_compile(args->schema, args->rkeys, rspec, args->depth + 1);
+  args->schema->fields[args->field] = (struct me_schema_field){
+    .key = rfield_key,
+    .symbol_id = symbol_id,
+    .node = node,
+  };
+  args->field++;
+  return ST_CONTINUE;
+}
+
+// Returns the index of the node compiled from `rspec`. A node is reserved
+// before its children so that the root always ends up at index zero.
+static uint32_t ext_schema_compile(
+  struct me_schema *schema,
+  VALUE rkeys,
+  VALUE rspec,
+  int depth)
+{
+  if (depth > ME_HOST_DATA_DEPTH_LIMIT) {
+    rb_raise(rb_eArgError, "schema nested too deeply");
+  }
+
+  uint32_t index;
+  if (!me_schema_nodes_new(schema, 1, &index)) {
+    rb_memerror();
+  }
+
+  switch (rb_type(rspec)) {
+  case T_SYMBOL:
+    {
+      ID type = SYM2ID(rspec);
+      enum me_schema_node_type node_type;
+      if (type == me_ext_id_any) {
+        node_type = ME_SCHEMA_ANY;
+      } else if (type == me_ext_id_boolean) {
+        node_type = ME_SCHEMA_BOOLEAN;
+      } else if (type == me_ext_id_integer) {
+        node_type = ME_SCHEMA_INTEGER;
+      } else if (type == me_ext_id_string) {
+        node_type = ME_SCHEMA_STRING;
+      } else if (type == me_ext_id_symbol) {
+        node_type = ME_SCHEMA_SYMBOL;
+      } else {
+        rb_raise(rb_eArgError, "unknown schema type %"PRIsVALUE, rspec);
+      }
+      schema->nodes[index] = (struct me_schema_node){ .type = node_type };
+      return index;
+    }
+  case T_ARRAY:
+    {
+      if (RARRAY_LEN(rspec) != 1) {
+        rb_raise(rb_eArgError, "array schemas must have exactly one element type");
+      }
+      uint32_t element = ext_schema_compile(schema, rkeys, RARRAY_AREF(rspec, 0), depth + 1);
+      schema->nodes[index] = (struct me_schema_node){
+        .type = ME_SCHEMA_ARRAY,
+        .array = { .element = element },
+      };
+      return index;
+    }
+  case T_HASH:
+    {
+      uint32_t fields;
+      if (!me_schema_fields_new(schema, RHASH_SIZE(rspec), &fields)) {
+        rb_memerror();
+      }
+      schema->nodes[index] = (struct me_schema_node){
+        .type = ME_SCHEMA_HASH,
+        .hash = { .fields = fields, .size = (uint32_t)RHASH_SIZE(rspec) },
+      };
+
+      struct ext_schema_field_args args = (struct ext_schema_field_args){
+        .schema = schema,
+        .rkeys = rkeys,
+        .field = fields,
+        .depth = depth,
+      };
+      rb_hash_foreach(rspec, ext_schema_compile_field, (VALUE)&args);
+      return index;
+    }
+  default:
+    rb_raise(rb_eArgError, "invalid schema %"PRIsVALUE, rspec);
+  }
+}
+
+struct ext_schema_compile_args {
+  struct me_schema *schema;
+  VALUE rkeys;
+  VALUE rspec;
+};
+
+static VALUE ext_schema_compile_body(VALUE data) {
+  struct ext_schema_compile_args *args = (struct ext_schema_compile_args *)data;
+  ext_schema_compile(args->schema, args->rkeys, args->rspec, 0);
+  return Qnil;
+}
+
+// Compiles into a schema of its own, which only replaces the current one once
+// it is complete: an invalid spec leaves the object as it was.
+static VALUE ext_schema_initialize(VALUE rself, VALUE rspec) {
+  // Compiled fields point to their keys, which stay referenced from the
+  // schema object for as long as it lives.
+  struct ext_schema_compile_args args = (struct ext_schema_compile_args){
+    .schema = me_schema_new(),
+    .rkeys = rb_ary_new(),
+    .rspec = rspec,
+  };
+  int state = 0;
+  rb_protect(ext_schema_compile_body, (VALUE)&args, &state);
+  if (state) {
+    ext_schema_free(args.schema);
+    rb_jump_tag(state);
+  }
+
+  ext_schema_free(DATA_PTR(rself));
+  DATA_PTR(rself) = args.schema;
+  rb_ivar_set(rself, me_ext_id_schema_keys, args.rkeys);
+  return Qnil;
+}
+
 __attribute__((visibility("default")))
 void Init_mruby_engine(void) {
   rb_require("json");
@@ -374,16 +1649,79 @@ void Init_mruby_engine(void) {
   me_ext_id_cpu_time = rb_intern("cpu_time");
   me_ext_id_mul = rb_intern("*");
   me_ext_id_type_eq = rb_intern("type=");
+  me_ext_id_allocator = rb_intern("allocator");
+  me_ext_id_dlmalloc = rb_intern("dlmalloc");
+  me_ext_id_arena = rb_intern("arena");
+  me_ext_id_tlsf = rb_intern("tlsf");
+  me_ext_id_gc_disabled = rb_intern("gc_disabled");
+  me_ext_id_gc_watermark = rb_intern("gc_watermark");
+  me_ext_id_gc_mode = rb_intern("gc_mode");
+  me_ext_id_gc_interval_ratio = rb_intern("gc_interval_ratio");
+  me_ext_id_gc_step_ratio = rb_intern("gc_step_ratio");
+  me_ext_id_max_depth = rb_intern("max_depth");
+  me_ext_id_incremental = rb_intern("incremental");
+  me_ext_id_generational = rb_intern("generational");
+  me_ext_id_gc_runs = rb_intern("gc_runs");
+  me_ext_id_gc_time = rb_intern("gc_time");
+  me_ext_id_gc_live = rb_intern("gc_live");
+  me_ext_id_gc_heap_pages = rb_intern("gc_heap_pages");
+  me_ext_id_capacity = rb_intern("capacity");
+  me_ext_id_shared_segments = rb_intern("__shared_segments__");
+  me_ext_id_float_precision = rb_intern("float_precision");
+  me_ext_id_decimal = rb_intern("decimal");
+  me_ext_id_string = rb_intern("string");
+  me_ext_id_number = rb_intern("number");
+  me_ext_id_schema = rb_intern("schema");
+  me_ext_id_track = rb_intern("track");
+  me_ext_id_dedup = rb_intern("dedup");
+  me_ext_id_zero_copy = rb_intern("zero_copy");
+  me_ext_id_borrowed_strings = rb_intern("__borrowed_strings__");
+  me_ext_id_freeze = rb_intern("freeze");
+  me_ext_id_digest = rb_intern("digest");
+  me_ext_id_frozen_digests = rb_intern("__frozen_digests__");
+  me_ext_id_compare_by_identity = rb_intern("compare_by_identity");
+  me_ext_id_schema_keys = rb_intern("__schema_keys__");
+  me_ext_id_any = rb_intern("any");
+  me_ext_id_boolean = rb_intern("boolean");
+  me_ext_id_integer = rb_intern("integer");
+  me_ext_id_symbol = rb_intern("symbol");
+  me_ext_id_big_decimal = rb_intern("BigDecimal");
+  me_ext_id_n_significant_digits = rb_intern("n_significant_digits");
+  me_ext_id_to_s = rb_intern("to_s");
+  me_ext_id_utc_p = rb_intern("utc?");
+  me_ext_id_nil = rb_intern("nil");
+  me_ext_id_float = rb_intern("float");
+  me_ext_id_array = rb_intern("array");
+  me_ext_id_hash = rb_intern("hash");
+  me_ext_id_time = rb_intern("time");
+  me_ext_id_set = rb_intern("set");
+  me_ext_id_insert = rb_intern("insert");
+  me_ext_id_delete = rb_intern("delete");
 
   me_ext_m_json = rb_path2class("JSON");
+  me_ext_e_json_parser_error = rb_path2class("JSON::ParserError");
 
   me_ext_c_mruby_engine = rb_define_class("MRubyEngine", rb_cObject);
   rb_define_alloc_func(me_ext_c_mruby_engine, ext_mruby_engine_alloc);
   rb_define_method(me_ext_c_mruby_engine, "initialize", ext_mruby_engine_initialize, -1);
   rb_define_method(me_ext_c_mruby_engine, "sandbox_eval", ext_mruby_engine_eval, 2);
   rb_define_method(me_ext_c_mruby_engine, "load_instruction_sequence", ext_mruby_engine_load, 1);
-  rb_define_method(me_ext_c_mruby_engine, "inject", ext_mruby_engine_inject, 2);
+  rb_define_method(me_ext_c_mruby_engine, "inject", ext_mruby_engine_inject, -1);
+  rb_define_method(me_ext_c_mruby_engine, "inject_all", ext_mruby_engine_inject_all, -1);
+  rb_define_method(me_ext_c_mruby_engine, "inject_lazy", ext_mruby_engine_inject_lazy, 2);
+  rb_define_method(me_ext_c_mruby_engine, "inject_json", ext_mruby_engine_inject_json, 2);
+  rb_define_method(me_ext_c_mruby_engine, "injected?", ext_mruby_engine_injected_p, 2);
   rb_define_method(me_ext_c_mruby_engine, "extract", ext_mruby_engine_extract, 1);
+  rb_define_method(me_ext_c_mruby_engine, "extract_all", ext_mruby_engine_extract_all, 1);
+  rb_define_method(me_ext_c_mruby_engine, "extract_paths", ext_mruby_engine_extract_paths, 2);
+  rb_define_method(me_ext_c_mruby_engine, "patch", ext_mruby_engine_patch, 2);
+  rb_define_method(me_ext_c_mruby_engine, "extract_changes", ext_mruby_engine_extract_changes, 1);
+  rb_define_method(me_ext_c_mruby_engine, "extract_json", ext_mruby_engine_extract_json, -1);
+  rb_define_method(me_ext_c_mruby_engine, "inject_packed", ext_mruby_engine_inject_packed, 2);
+  rb_define_method(me_ext_c_mruby_engine, "extract_packed", ext_mruby_engine_extract_packed, 1);
+  rb_define_method(me_ext_c_mruby_engine, "extract_into", ext_mruby_engine_extract_into, 2);
+  rb_define_singleton_method(me_ext_c_mruby_engine, "pack", ext_mruby_engine_s_pack, 1);
+  rb_define_singleton_method(me_ext_c_mruby_engine, "unpack", ext_mruby_engine_s_unpack, 1);
   rb_define_method(me_ext_c_mruby_engine, "stat", ext_mruby_engine_stat, 0);
 
   me_ext_c_iseq = rb_define_class_under(
@@ -396,6 +1734,33 @@ void Init_mruby_engine(void) {
   rb_define_method(me_ext_c_iseq, "data", ext_iseq_data, 0);
   rb_define_private_method(me_ext_c_iseq, "compute_hash", ext_iseq_hash, 0);
 
+  me_ext_c_shared_segment = rb_define_class_under(
+    me_ext_c_mruby_engine,
+    "SharedSegment",
+    rb_cObject);
+  rb_define_alloc_func(me_ext_c_shared_segment, ext_shared_segment_alloc);
+  rb_define_method(me_ext_c_shared_segment, "initialize", ext_shared_segment_initialize, -1);
+  rb_define_method(me_ext_c_shared_segment, "size", ext_shared_segment_size, 0);
+
+  me_ext_c_result_buffer = rb_define_class_under(
+    me_ext_c_mruby_engine,
+    "ResultBuffer",
+    rb_cObject);
+  rb_define_alloc_func(me_ext_c_result_buffer, ext_result_buffer_alloc);
+  rb_define_method(me_ext_c_result_buffer, "type", ext_result_buffer_type, -1);
+  rb_define_method(me_ext_c_result_buffer, "size", ext_result_buffer_size, -1);
+  rb_define_method(me_ext_c_result_buffer, "child", ext_result_buffer_child, 2);
+  rb_define_method(me_ext_c_result_buffer, "key", ext_result_buffer_key, 2);
+  rb_define_method(me_ext_c_result_buffer, "lookup", ext_result_buffer_lookup, 2);
+  rb_define_method(me_ext_c_result_buffer, "value", ext_result_buffer_value, -1);
+
+  me_ext_c_schema = rb_define_class_under(
+    me_ext_c_mruby_engine,
+    "Schema",
+    rb_cObject);
+  rb_define_alloc_func(me_ext_c_schema, ext_schema_alloc);
+  rb_define_method(me_ext_c_schema, "initialize", ext_schema_initialize, 1);
+
   me_ext_e_engine_error = rb_define_class_under(
     me_ext_c_mruby_engine, "EngineError", rb_eStandardError);
   me_ext_e_engine_runtime_error = rb_define_class_under(
@@ -14,9 +14,61 @@ extern ID me_ext_id_ctx_switch_v;
 extern ID me_ext_id_ctx_switch_iv;
 extern ID me_ext_id_cpu_time;
 extern ID me_ext_id_type_eq;
+extern ID me_ext_id_allocator;
+extern ID me_ext_id_dlmalloc;
+extern ID me_ext_id_arena;
+extern ID me_ext_id_tlsf;
+extern ID me_ext_id_gc_disabled;
+extern ID me_ext_id_gc_watermark;
+extern ID me_ext_id_gc_mode;
+extern ID me_ext_id_gc_interval_ratio;
+extern ID me_ext_id_gc_step_ratio;
+extern ID me_ext_id_max_depth;
+extern ID me_ext_id_incremental;
+extern ID me_ext_id_generational;
+extern ID me_ext_id_gc_runs;
+extern ID me_ext_id_gc_time;
+extern ID me_ext_id_gc_live;
+extern ID me_ext_id_gc_heap_pages;
+extern ID me_ext_id_capacity;
+extern ID me_ext_id_shared_segments;
+extern ID me_ext_id_float_precision;
+extern ID me_ext_id_decimal;
+extern ID me_ext_id_string;
+extern ID me_ext_id_number;
+extern ID me_ext_id_schema;
+extern ID me_ext_id_track;
+extern ID me_ext_id_dedup;
+extern ID me_ext_id_zero_copy;
+extern ID me_ext_id_borrowed_strings;
+extern ID me_ext_id_freeze;
+extern ID me_ext_id_digest;
+extern ID me_ext_id_frozen_digests;
+extern ID me_ext_id_compare_by_identity;
+extern ID me_ext_id_schema_keys;
+extern ID me_ext_id_any;
+extern ID me_ext_id_boolean;
+extern ID me_ext_id_integer;
+extern ID me_ext_id_symbol;
+extern ID me_ext_id_big_decimal;
+extern ID me_ext_id_n_significant_digits;
+extern ID me_ext_id_to_s;
+extern ID me_ext_id_utc_p;
+extern ID me_ext_id_nil;
+extern ID me_ext_id_float;
+extern ID me_ext_id_array;
+extern ID me_ext_id_hash;
+extern ID me_ext_id_time;
+extern ID me_ext_id_set;
+extern ID me_ext_id_insert;
+extern ID me_ext_id_delete;
 extern VALUE me_ext_m_json;
+extern VALUE me_ext_e_json_parser_error;
 extern VALUE me_ext_c_mruby_engine;
 extern VALUE me_ext_c_iseq;
+extern VALUE me_ext_c_shared_segment;
+extern VALUE me_ext_c_schema;
+extern VALUE me_ext_c_result_buffer;
 extern VALUE me_ext_e_engine_error;
 extern VALUE me_ext_e_engine_runtime_error;
 extern VALUE me_ext_e_engine_type_error;
@@ -1,7 +1,4 @@
-#include "memory_pool.h"
-#include "mruby_engine.h"
-#include "dlmalloc.h"
-#undef NOINLINE
+#include "memory_pool_private.h"
 #include <ruby.h>
 #include <sys/mman.h>
 #include <errno.h>
@@ -15,15 +12,8 @@
 #error "this gem requires anonymous memory regions"
 #endif
 
-struct me_memory_pool {
-  mspace mspace;
-  uint8_t *start;
-  size_t capacity;
-};
-
 #define CAPACITY_MIN ((size_t)(256 * KiB))
 #define CAPACITY_MAX ((size_t)(256 * MiB))
-#define ALLOC_MAX ((size_t)(256 * MiB))
 
 static size_t round_capacity(size_t capacity) {
   size_t page_size = (size_t)sysconf(_SC_PAGE_SIZE);
@@ -33,7 +23,23 @@ static size_t round_capacity(size_t capacity) {
   return capacity;
 }
 
-struct me_memory_pool *me_memory_pool_new(size_t capacity, struct me_memory_pool_err *err) {
+static const struct me_memory_pool_backend *backend_for_type(enum me_memory_pool_type type) {
+  switch (type) {
+  case ME_MEMORY_POOL_ARENA:
+    return &me_memory_pool_arena_backend;
+  case ME_MEMORY_POOL_TLSF:
+    return &me_memory_pool_tlsf_backend;
+  case ME_MEMORY_POOL_DLMALLOC:
+  default:
+    return &me_memory_pool_dlmalloc_backend;
+  }
+}
+
+struct me_memory_pool *me_memory_pool_new(
+  size_t capacity,
+  enum me_memory_pool_type type,
+  struct me_memory_pool_err *err)
+{
   size_t rounded_capacity = round_capacity(capacity);
   if (rounded_capacity < CAPACITY_MIN || CAPACITY_MAX < rounded_capacity) {
     err->type = ME_MEMORY_POOL_INVALID_CAPACITY;
@@ -53,10 +59,9 @@ struct me_memory_pool *me_memory_pool_new(size_t capacity, struct me_memory_pool
     return NULL;
   }
 
-  mspace mspace = create_mspace_with_base(bytes, rounded_capacity, 0);
-  mspace_set_footprint_limit(mspace, rounded_capacity);
-  struct me_memory_pool *self = mspace_malloc(mspace, sizeof(struct me_memory_pool));
-  self->mspace = mspace;
+  const struct me_memory_pool_backend *backend = backend_for_type(type);
+  struct me_memory_pool *self = backend->create(bytes, rounded_capacity);
+  self->backend = backend;
   self->start = bytes;
   self->capacity = rounded_capacity;
 
@@ -65,34 +70,41 @@ struct me_memory_pool *me_memory_pool_new(size_t capacity, struct me_memory_pool
 }
 
 struct meminfo me_memory_pool_info(struct me_memory_pool *self) {
-  struct meminfo info;
-  struct mallinfo dlinfo = mspace_mallinfo(self->mspace);
-  info.arena = dlinfo.arena;
-  info.hblkhd = dlinfo.hblkhd;
-  info.uordblks = dlinfo.uordblks;
-  info.fordblks = dlinfo.fordblks;
-  return info;
+  return self->backend->info(self);
 }
 
 size_t me_memory_pool_get_capacity(struct me_memory_pool *self) {
   return self->capacity;
 }
 
+size_t me_memory_pool_get_usage(struct me_memory_pool *self) {
+  return self->backend->usage(self);
+}
+
 void *me_memory_pool_malloc(struct me_memory_pool *self, size_t size) {
-  return mspace_malloc(self->mspace, size);
+  return self->backend->malloc(self, size);
 }
 
 void *me_memory_pool_realloc(struct me_memory_pool *self, void *block, size_t size) {
-  return mspace_realloc(self->mspace, block, size);
+  return self->backend->realloc(self, block, size);
 }
 
 void me_memory_pool_free(struct me_memory_pool *self, void *block) {
-  return mspace_free(self->mspace, block);
+  self->backend->free(self, block);
+}
+
+// Makes the whole region read-only. Any later allocation in the pool will
+// fault, so this is only meant for pools that are done being built.
+int me_memory_pool_protect(struct me_memory_pool *self) {
+  if (mprotect(self->start, self->capacity, PROT_READ)) {
+    return errno;
+  }
+  return 0;
 }
 
 void me_memory_pool_destroy(struct me_memory_pool *self) {
   uint8_t *start = self->start;
   size_t capacity = self->capacity;
-  destroy_mspace(self->mspace);
+  self->backend->destroy(self);
   munmap(start, capacity);
 }
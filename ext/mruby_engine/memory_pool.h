@@ -9,6 +9,12 @@ enum me_memory_pool_err_type {
   ME_MEMORY_POOL_SYSTEM_ERR,
 };
 
+enum me_memory_pool_type {
+  ME_MEMORY_POOL_DLMALLOC = 0,
+  ME_MEMORY_POOL_ARENA,
+  ME_MEMORY_POOL_TLSF,
+};
+
 struct me_memory_pool_err {
   enum me_memory_pool_err_type type;
   union {
@@ -35,13 +41,18 @@ struct meminfo {
 
 struct me_memory_pool;
 
-struct me_memory_pool *me_memory_pool_new(size_t capacity, struct me_memory_pool_err *err);
+struct me_memory_pool *me_memory_pool_new(
+  size_t capacity,
+  enum me_memory_pool_type type,
+  struct me_memory_pool_err *err);
 void me_memory_pool_destroy(struct me_memory_pool *self);
 
 struct meminfo me_memory_pool_info(struct me_memory_pool *self);
 size_t me_memory_pool_get_capacity(struct me_memory_pool *self);
+size_t me_memory_pool_get_usage(struct me_memory_pool *self);
 void *me_memory_pool_malloc(struct me_memory_pool *self, size_t size);
 void *me_memory_pool_realloc(struct me_memory_pool *self, void *block, size_t size);
 void me_memory_pool_free(struct me_memory_pool *self, void *block);
+int me_memory_pool_protect(struct me_memory_pool *self);
 
 #endif
@@ -0,0 +1,134 @@
+#include "memory_pool_private.h"
+#include <string.h>
+
+// Every arena block is preceded by a header holding its requested size. The
+// header is padded so that blocks keep the alignment malloc guarantees.
+#define ARENA_ALIGNMENT ((size_t)16)
+#define ARENA_HEADER_SIZE ARENA_ALIGNMENT
+
+struct me_arena_pool {
+  struct me_memory_pool base;
+
+  // `top` is the first unused byte and `last` is the header of the most
+  // recent block, which is the only one that can grow in place.
+  uint8_t *top;
+  uint8_t *last;
+};
+
+static size_t arena_round(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+static uint8_t *arena_end(struct me_arena_pool *self) {
+  return self->base.start + self->base.capacity;
+}
+
+static size_t arena_block_size(uint8_t *header) {
+  return *(size_t *)header;
+}
+
+static uint8_t *arena_block_header(void *block) {
+  return (uint8_t *)block - ARENA_HEADER_SIZE;
+}
+
+static struct me_memory_pool *arena_create(uint8_t *bytes, size_t capacity) {
+  (void)capacity;
+  struct me_arena_pool *self = (struct me_arena_pool *)bytes;
+  self->top = bytes + arena_round(sizeof(struct me_arena_pool));
+  self->last = NULL;
+  return &self->base;
+}
+
+static void arena_destroy(struct me_memory_pool *base) {
+  (void)base;
+}
+
+static void *arena_malloc(struct me_memory_pool *base, size_t size) {
+  struct me_arena_pool *self = (struct me_arena_pool *)base;
+  if (size > ME_MEMORY_POOL_ALLOC_MAX) {
+    return NULL;
+  }
+
+  size_t needed = ARENA_HEADER_SIZE + arena_round(size);
+  if ((size_t)(arena_end(self) - self->top) < needed) {
+    return NULL;
+  }
+
+  uint8_t *header = self->top;
+  *(size_t *)header = size;
+  self->last = header;
+  self->top += needed;
+  return header + ARENA_HEADER_SIZE;
+}
+
+static void *arena_realloc(struct me_memory_pool *base, void *block, size_t size) {
+  struct me_arena_pool *self = (struct me_arena_pool *)base;
+  if (block == NULL) {
+    return arena_malloc(base, size);
+  }
+  if (size > ME_MEMORY_POOL_ALLOC_MAX) {
+    return NULL;
+  }
+
+  uint8_t *header = arena_block_header(block);
+  size_t old_size = arena_block_size(header);
+
+  if (header == self->last) {
+    size_t needed = ARENA_HEADER_SIZE + arena_round(size);
+    if ((size_t)(arena_end(self) - header) < needed) {
+      return NULL;
+    }
+    *(size_t *)header = size;
+    self->top = header + needed;
+    return block;
+  }
+
+  if (size <= old_size) {
+    return block;
+  }
+
+  void *new_block = arena_malloc(base, size);
+  if (new_block == NULL) {
+    return NULL;
+  }
+  memcpy(new_block, block, old_size);
+  return new_block;
+}
+
+static void arena_free(struct me_memory_pool *base, void *block) {
+  struct me_arena_pool *self = (struct me_arena_pool *)base;
+  if (block == NULL) {
+    return;
+  }
+
+  uint8_t *header = arena_block_header(block);
+  if (header == self->last) {
+    self->top = header;
+    self->last = NULL;
+  }
+}
+
+static struct meminfo arena_info(struct me_memory_pool *base) {
+  struct me_arena_pool *self = (struct me_arena_pool *)base;
+  struct meminfo info;
+  info.arena = self->base.capacity;
+  info.hblkhd = 0;
+  info.uordblks = (size_t)(self->top - self->base.start);
+  info.fordblks = (size_t)(arena_end(self) - self->top);
+  return info;
+}
+
+static size_t arena_usage(struct me_memory_pool *base) {
+  struct me_arena_pool *self = (struct me_arena_pool *)base;
+  return (size_t)(self->top - self->base.start);
+}
+
+const struct me_memory_pool_backend me_memory_pool_arena_backend = {
+  .create = arena_create,
+  .destroy = arena_destroy,
+  .malloc = arena_malloc,
+  .realloc = arena_realloc,
+  .free = arena_free,
+  .info = arena_info,
+  .usage = arena_usage,
+};
@@ -0,0 +1,77 @@
+#include "memory_pool_private.h"
+#include "dlmalloc.h"
+
+struct me_dlmalloc_pool {
+  struct me_memory_pool base;
+  mspace mspace;
+
+  // mspace_mallinfo walks every chunk, so keep a running total for `usage`.
+  size_t in_use;
+};
+
+static struct me_memory_pool *dlmalloc_create(uint8_t *bytes, size_t capacity) {
+  mspace mspace = create_mspace_with_base(bytes, capacity, 0);
+  mspace_set_footprint_limit(mspace, capacity);
+  struct me_dlmalloc_pool *self = mspace_malloc(mspace, sizeof(struct me_dlmalloc_pool));
+  self->mspace = mspace;
+  self->in_use = 0;
+  return &self->base;
+}
+
+static void dlmalloc_destroy(struct me_memory_pool *base) {
+  struct me_dlmalloc_pool *self = (struct me_dlmalloc_pool *)base;
+  destroy_mspace(self->mspace);
+}
+
+static void *dlmalloc_malloc(struct me_memory_pool *base, size_t size) {
+  struct me_dlmalloc_pool *self = (struct me_dlmalloc_pool *)base;
+  void *block = mspace_malloc(self->mspace, size);
+  if (block != NULL) {
+    self->in_use += mspace_usable_size(block);
+  }
+  return block;
+}
+
+static void *dlmalloc_realloc(struct me_memory_pool *base, void *block, size_t size) {
+  struct me_dlmalloc_pool *self = (struct me_dlmalloc_pool *)base;
+  size_t old_size = block != NULL ? mspace_usable_size(block) : 0;
+  void *new_block = mspace_realloc(self->mspace, block, size);
+  if (new_block != NULL) {
+    self->in_use += mspace_usable_size(new_block) - old_size;
+  }
+  return new_block;
+}
+
+static void dlmalloc_free(struct me_memory_pool *base, void *block) {
+  struct me_dlmalloc_pool *self = (struct me_dlmalloc_pool *)base;
+  if (block != NULL) {
+    self->in_use -= mspace_usable_size(block);
+  }
+  mspace_free(self->mspace, block);
+}
+
+static struct meminfo dlmalloc_info(struct me_memory_pool *base) {
+  struct me_dlmalloc_pool *self = (struct me_dlmalloc_pool *)base;
+  struct meminfo info;
+  struct mallinfo dlinfo = mspace_mallinfo(self->mspace);
+  info.arena = dlinfo.arena;
+  info.hblkhd = dlinfo.hblkhd;
+  info.uordblks = dlinfo.uordblks;
+  info.fordblks = dlinfo.fordblks;
+  return info;
+}
+
+static size_t dlmalloc_usage(struct me_memory_pool *base) {
+  struct me_dlmalloc_pool *self = (struct me_dlmalloc_pool *)base;
+  return self->in_use;
+}
+
+const struct me_memory_pool_backend me_memory_pool_dlmalloc_backend = {
+  .create = dlmalloc_create,
+  .destroy = dlmalloc_destroy,
+  .malloc = dlmalloc_malloc,
+  .realloc = dlmalloc_realloc,
+  .free = dlmalloc_free,
+  .info = dlmalloc_info,
+  .usage = dlmalloc_usage,
+};
@@ -0,0 +1,35 @@
+#ifndef MRUBY_ENGINE_MEMORY_POOL_PRIVATE_H
+#define MRUBY_ENGINE_MEMORY_POOL_PRIVATE_H
+
+#include "memory_pool.h"
+#include "definitions.h"
+#include <stdint.h>
+
+#define ME_MEMORY_POOL_ALLOC_MAX ((size_t)(256 * MiB))
+
+// A backend manages the bytes of one mmap'd region. `create` must place its
+// own state inside the region, starting with the common `struct
+// me_memory_pool`, so that destroying the pool only takes unmapping it.
+struct me_memory_pool_backend {
+  struct me_memory_pool *(*create)(uint8_t *bytes, size_t capacity);
+  void (*destroy)(struct me_memory_pool *self);
+  void *(*malloc)(struct me_memory_pool *self, size_t size);
+  void *(*realloc)(struct me_memory_pool *self, void *block, size_t size);
+  void (*free)(struct me_memory_pool *self, void *block);
+  struct meminfo (*info)(struct me_memory_pool *self);
+  // Bytes currently handed out, including per-block overhead. Unlike `info`
+  // this must be cheap enough to call on every allocation.
+  size_t (*usage)(struct me_memory_pool *self);
+};
+
+struct me_memory_pool {
+  const struct me_memory_pool_backend *backend;
+  uint8_t *start;
+  size_t capacity;
+};
+
+extern const struct me_memory_pool_backend me_memory_pool_dlmalloc_backend;
+extern const struct me_memory_pool_backend me_memory_pool_arena_backend;
+extern const struct me_memory_pool_backend me_memory_pool_tlsf_backend;
+
+#endif
@@ -5,7 +5,7 @@
 
 static VALUE test_trigger_user_error(VALUE self) {
   struct me_memory_pool_err err;
-  struct me_memory_pool *allocator = me_memory_pool_new(1 << 22, &err);
+  struct me_memory_pool *allocator = me_memory_pool_new(1 << 22, ME_MEMORY_POOL_DLMALLOC, &err);
   if (allocator == NULL) {
     me_host_raise(me_host_internal_error_new("failed to create memory pool"));
   }
@@ -17,7 +17,23 @@ static VALUE test_trigger_user_error(VALUE self) {
   return Qnil;
 }
 
+static VALUE test_arena_realloc_in_place(VALUE self) {
+  struct me_memory_pool_err err;
+  struct me_memory_pool *allocator = me_memory_pool_new(1 << 22, ME_MEMORY_POOL_ARENA, &err);
+  if (allocator == NULL) {
+    me_host_raise(me_host_internal_error_new("failed to create memory pool"));
+  }
+
+  void *first = me_memory_pool_malloc(allocator, 16);
+  void *last = me_memory_pool_malloc(allocator, 16);
+  int grown_in_place = me_memory_pool_realloc(allocator, last, 4096) == last;
+  int moved = me_memory_pool_realloc(allocator, first, 4096) != first;
+  me_memory_pool_destroy(allocator);
+  return grown_in_place && moved ? Qtrue : Qfalse;
+}
+
 void init_memory_pool_tests(void) {
   VALUE m_memory_pool_tests = rb_define_module("MemoryPoolTests");
   rb_define_singleton_method(m_memory_pool_tests, "trigger_user_error!", test_trigger_user_error, 0);
+  rb_define_singleton_method(m_memory_pool_tests, "arena_realloc_in_place?", test_arena_realloc_in_place, 0);
 }
@@ -0,0 +1,356 @@
+#include "memory_pool_private.h"
+#include <stdbool.h>
+#include <string.h>
+
+// Two-level segregated fit allocator (Masmano et al., "TLSF: a New Dynamic
+// Memory Allocator for Real-Time Systems"). Free blocks are kept in lists
+// indexed by a first level (power of two) and a second level (linear
+// subdivision of that power of two); two bitmaps record which lists are
+// non-empty so that malloc and free never search more than a couple of
+// machine words. Neighbouring free blocks are coalesced immediately, so there
+// is no deferred work either.
+
+#define TLSF_ALIGNMENT_LOG2 4
+#define TLSF_ALIGNMENT ((size_t)1 << TLSF_ALIGNMENT_LOG2)
+
+#define TLSF_SL_INDEX_COUNT_LOG2 5
+#define TLSF_SL_INDEX_COUNT (1 << TLSF_SL_INDEX_COUNT_LOG2)
+#define TLSF_FL_INDEX_SHIFT (TLSF_SL_INDEX_COUNT_LOG2 + TLSF_ALIGNMENT_LOG2)
+#define TLSF_FL_INDEX_MAX 28
+#define TLSF_FL_INDEX_COUNT (TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1)
+#define TLSF_SMALL_BLOCK_SIZE ((size_t)1 << TLSF_FL_INDEX_SHIFT)
+
+#define TLSF_BLOCK_FREE ((size_t)1)
+#define TLSF_BLOCK_PREV_FREE ((size_t)2)
+#define TLSF_BLOCK_FLAGS (TLSF_BLOCK_FREE | TLSF_BLOCK_PREV_FREE)
+
+// `prev_phys` is only meaningful when the previous block is free. The free
+// list links live in the payload and are only meaningful when this block is
+// free, which is why the minimum payload is two pointers.
+struct tlsf_block {
+  struct tlsf_block *prev_phys;
+  size_t size;
+  struct tlsf_block *next_free;
+  struct tlsf_block *prev_free;
+};
+
+#define TLSF_HEADER_SIZE offsetof(struct tlsf_block, next_free)
+#define TLSF_BLOCK_SIZE_MIN (sizeof(struct tlsf_block) - TLSF_HEADER_SIZE)
+
+struct me_tlsf_pool {
+  struct me_memory_pool base;
+  size_t in_use;
+  uint32_t fl_bitmap;
+  uint32_t sl_bitmap[TLSF_FL_INDEX_COUNT];
+  struct tlsf_block *blocks[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT];
+};
+
+static size_t tlsf_align_up(size_t size) {
+  return (size + TLSF_ALIGNMENT - 1) & ~(TLSF_ALIGNMENT - 1);
+}
+
+static int tlsf_fls(size_t word) {
+  return (int)(sizeof(unsigned long long) * 8) - 1 - __builtin_clzll((unsigned long long)word);
+}
+
+static int tlsf_ffs(uint32_t word) {
+  return __builtin_ctz(word);
+}
+
+static size_t block_size(const struct tlsf_block *block) {
+  return block->size & ~TLSF_BLOCK_FLAGS;
+}
+
+static void block_set_size(struct tlsf_block *block, size_t size) {
+  block->size = size | (block->size & TLSF_BLOCK_FLAGS);
+}
+
+static bool block_is_free(const struct tlsf_block *block) {
+  return block->size & TLSF_BLOCK_FREE;
+}
+
+static bool block_is_prev_free(const struct tlsf_block *block) {
+  return block->size & TLSF_BLOCK_PREV_FREE;
+}
+
+static void *block_to_ptr(struct tlsf_block *block) {
+  return (uint8_t *)block + TLSF_HEADER_SIZE;
+}
+
+static struct tlsf_block *block_from_ptr(void *ptr) {
+  return (struct tlsf_block *)((uint8_t *)ptr - TLSF_HEADER_SIZE);
+}
+
+static struct tlsf_block *block_next(struct tlsf_block *block) {
+  return (struct tlsf_block *)((uint8_t *)block_to_ptr(block) + block_size(block));
+}
+
+static void block_mark_free(struct tlsf_block *block) {
+  struct tlsf_block *next = block_next(block);
+  next->prev_phys = block;
+  next->size |= TLSF_BLOCK_PREV_FREE;
+  block->size |= TLSF_BLOCK_FREE;
+}
+
+static void block_mark_used(struct tlsf_block *block) {
+  struct tlsf_block *next = block_next(block);
+  next->size &= ~TLSF_BLOCK_PREV_FREE;
+  block->size &= ~TLSF_BLOCK_FREE;
+}
+
+static void mapping_insert(size_t size, int *fli, int *sli) {
+  if (size < TLSF_SMALL_BLOCK_SIZE) {
+    *fli = 0;
+    *sli = (int)(size / (TLSF_SMALL_BLOCK_SIZE / TLSF_SL_INDEX_COUNT));
+    return;
+  }
+
+  int fl = tlsf_fls(size);
+  *sli = (int)(size >> (fl - TLSF_SL_INDEX_COUNT_LOG2)) ^ TLSF_SL_INDEX_COUNT;
+  *fli = fl - (TLSF_FL_INDEX_SHIFT - 1);
+}
+
+// Rounds the request up to the next list boundary so that any block found in
+// the resulting list is large enough, without walking the list.
+static void mapping_search(size_t size, int *fli, int *sli) {
+  if (size >= TLSF_SMALL_BLOCK_SIZE) {
+    size += ((size_t)1 << (tlsf_fls(size) - TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+  }
+  mapping_insert(size, fli, sli);
+}
+
+static void remove_free_block(struct me_tlsf_pool *self, struct tlsf_block *block, int fl, int sl) {
+  struct tlsf_block *prev = block->prev_free;
+  struct tlsf_block *next = block->next_free;
+  if (next) {
+    next->prev_free = prev;
+  }
+  if (prev) {
+    prev->next_free = next;
+  }
+
+  if (self->blocks[fl][sl] == block) {
+    self->blocks[fl][sl] = next;
+    if (next == NULL) {
+      self->sl_bitmap[fl] &= ~(1U << sl);
+      if (self->sl_bitmap[fl] == 0) {
+        self->fl_bitmap &= ~(1U << fl);
+      }
+    }
+  }
+}
+
+static void insert_free_block(struct me_tlsf_pool *self, struct tlsf_block *block, int fl, int sl) {
+  struct tlsf_block *current = self->blocks[fl][sl];
+  block->next_free = current;
+  block->prev_free = NULL;
+  if (current) {
+    current->prev_free = block;
+  }
+  self->blocks[fl][sl] = block;
+  self->fl_bitmap |= 1U << fl;
+  self->sl_bitmap[fl] |= 1U << sl;
+}
+
+static void block_remove(struct me_tlsf_pool *self, struct tlsf_block *block) {
+  int fl, sl;
+  mapping_insert(block_size(block), &fl, &sl);
+  remove_free_block(self, block, fl, sl);
+}
+
+static void block_insert(struct me_tlsf_pool *self, struct tlsf_block *block) {
+  int fl, sl;
+  mapping_insert(block_size(block), &fl, &sl);
+  insert_free_block(self, block, fl, sl);
+}
+
+static struct tlsf_block *search_suitable_block(struct me_tlsf_pool *self, int *fli, int *sli) {
+  int fl = *fli;
+  int sl = *sli;
+
+  uint32_t sl_map = self->sl_bitmap[fl] & (~0U << sl);
+  if (!sl_map) {
+    if (fl + 1 >= TLSF_FL_INDEX_COUNT) {
+      return NULL;
+    }
+    uint32_t fl_map = self->fl_bitmap & (~0U << (fl + 1));
+    if (!fl_map) {
+      return NULL;
+    }
+    fl = tlsf_ffs(fl_map);
+    sl_map = self->sl_bitmap[fl];
+  }
+  sl = tlsf_ffs(sl_map);
+
+  *fli = fl;
+  *sli = sl;
+  return self->blocks[fl][sl];
+}
+
+// Splits `block` so that it is exactly `size` bytes long and returns the
+// remainder to the free lists, merging it with the following block when
+// that one is free too.
+static void block_trim(struct me_tlsf_pool *self, struct tlsf_block *block, size_t size) {
+  if (block_size(block) < size + TLSF_HEADER_SIZE + TLSF_BLOCK_SIZE_MIN) {
+    return;
+  }
+
+  struct tlsf_block *remaining = (struct tlsf_block *)((uint8_t *)block_to_ptr(block) + size);
+  remaining->size = block_size(block) - size - TLSF_HEADER_SIZE;
+  block_set_size(block, size);
+
+  struct tlsf_block *next = block_next(remaining);
+  if (block_is_free(next)) {
+    block_remove(self, next);
+    remaining->size += TLSF_HEADER_SIZE + block_size(next);
+  }
+
+  block_mark_free(remaining);
+  block_insert(self, remaining);
+}
+
+static size_t adjust_request(size_t size) {
+  if (size == 0 || size > ME_MEMORY_POOL_ALLOC_MAX) {
+    return 0;
+  }
+  size_t adjusted = tlsf_align_up(size);
+  return adjusted < TLSF_BLOCK_SIZE_MIN ? TLSF_BLOCK_SIZE_MIN : adjusted;
+}
+
+static struct me_memory_pool *tlsf_create(uint8_t *bytes, size_t capacity) {
+  struct me_tlsf_pool *self = (struct me_tlsf_pool *)bytes;
+  memset(self, 0, sizeof(struct me_tlsf_pool));
+
+  // One large free block spanning the region, followed by a zero-sized,
+  // permanently used sentinel so that block_next never leaves the region.
+  uint8_t *region = bytes + tlsf_align_up(sizeof(struct me_tlsf_pool));
+  uint8_t *end = bytes + capacity;
+  struct tlsf_block *block = (struct tlsf_block *)region;
+  block->prev_phys = NULL;
+  block->size = (size_t)(end - region) - 2 * TLSF_HEADER_SIZE;
+
+  struct tlsf_block *sentinel = block_next(block);
+  sentinel->size = 0;
+  block_mark_free(block);
+  block_insert(self, block);
+  return &self->base;
+}
+
+static void tlsf_destroy(struct me_memory_pool *base) {
+  (void)base;
+}
+
+static void *tlsf_malloc(struct me_memory_pool *base, size_t size) {
+  struct me_tlsf_pool *self = (struct me_tlsf_pool *)base;
+  size_t adjusted = adjust_request(size);
+  if (adjusted == 0) {
+    return NULL;
+  }
+
+  int fl, sl;
+  mapping_search(adjusted, &fl, &sl);
+  if (fl >= TLSF_FL_INDEX_COUNT) {
+    return NULL;
+  }
+
+  struct tlsf_block *block = search_suitable_block(self, &fl, &sl);
+  if (block == NULL) {
+    return NULL;
+  }
+  remove_free_block(self, block, fl, sl);
+
+  block_trim(self, block, adjusted);
+  block_mark_used(block);
+  self->in_use += TLSF_HEADER_SIZE + block_size(block);
+  return block_to_ptr(block);
+}
+
+static void tlsf_free(struct me_memory_pool *base, void *ptr) {
+  struct me_tlsf_pool *self = (struct me_tlsf_pool *)base;
+  if (ptr == NULL) {
+    return;
+  }
+
+  struct tlsf_block *block = block_from_ptr(ptr);
+  self->in_use -= TLSF_HEADER_SIZE + block_size(block);
+
+  if (block_is_prev_free(block)) {
+    struct tlsf_block *prev = block->prev_phys;
+    block_remove(self, prev);
+    prev->size += TLSF_HEADER_SIZE + block_size(block);
+    block = prev;
+  }
+
+  struct tlsf_block *next = block_next(block);
+  if (block_is_free(next)) {
+    block_remove(self, next);
+    block->size += TLSF_HEADER_SIZE + block_size(next);
+  }
+
+  block_mark_free(block);
+  block_insert(self, block);
+}
+
+static void *tlsf_realloc(struct me_memory_pool *base, void *ptr, size_t size) {
+  struct me_tlsf_pool *self = (struct me_tlsf_pool *)base;
+  if (ptr == NULL) {
+    return tlsf_malloc(base, size);
+  }
+
+  size_t adjusted = adjust_request(size);
+  if (adjusted == 0) {
+    return NULL;
+  }
+
+  struct tlsf_block *block = block_from_ptr(ptr);
+  size_t current = block_size(block);
+  struct tlsf_block *next = block_next(block);
+
+  if (adjusted > current) {
+    size_t combined = current + TLSF_HEADER_SIZE + block_size(next);
+    if (!block_is_free(next) || combined < adjusted) {
+      void *new_ptr = tlsf_malloc(base, size);
+      if (new_ptr == NULL) {
+        return NULL;
+      }
+      memcpy(new_ptr, ptr, current);
+      tlsf_free(base, ptr);
+      return new_ptr;
+    }
+
+    block_remove(self, next);
+    block_set_size(block, combined);
+    block_mark_used(block);
+  }
+
+  self->in_use -= current;
+  block_trim(self, block, adjusted);
+  self->in_use += block_size(block);
+  return ptr;
+}
+
+static struct meminfo tlsf_info(struct me_memory_pool *base) {
+  struct me_tlsf_pool *self = (struct me_tlsf_pool *)base;
+  size_t overhead = tlsf_align_up(sizeof(struct me_tlsf_pool)) + 2 * TLSF_HEADER_SIZE;
+  struct meminfo info;
+  info.arena = self->base.capacity;
+  info.hblkhd = 0;
+  info.uordblks = overhead + self->in_use;
+  info.fordblks = self->base.capacity - info.uordblks;
+  return info;
+}
+
+static size_t tlsf_usage(struct me_memory_pool *base) {
+  struct me_tlsf_pool *self = (struct me_tlsf_pool *)base;
+  return self->in_use;
+}
+
+const struct me_memory_pool_backend me_memory_pool_tlsf_backend = {
+  .create = tlsf_create,
+  .destroy = tlsf_destroy,
+  .malloc = tlsf_malloc,
+  .realloc = tlsf_realloc,
+  .free = tlsf_free,
+  .info = tlsf_info,
+  .usage = tlsf_usage,
+};
@@ -0,0 +1,11 @@
+#ifndef MRUBY_DECIMAL_H
+#define MRUBY_DECIMAL_H
+
+#include <mruby.h>
+#include <stddef.h>
+
+// Creates a Decimal from its string form, as Decimal.new would, without
+// dispatching to it. Raises ArgumentError if the bytes are not a decimal.
+MRB_API mrb_value mrb_decimal_new(mrb_state *state, const char *bytes, size_t size);
+
+#endif
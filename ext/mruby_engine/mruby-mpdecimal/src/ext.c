@@ -2,6 +2,7 @@
 #include <mruby.h>
 #include <mruby/class.h>
 #include <mruby/data.h>
+#include <mruby/decimal.h>
 #include <mruby/proc.h>
 #include <mruby/string.h>
 #include <mruby/variable.h>
@@ -10,6 +11,11 @@
 
 static const ssize_t PRECISION = 64;
 
+// The class and context Decimal was defined with, kept where scripts cannot
+// reach them.
+#define DECIMAL_CLASS_VARIABLE "_mpd_decimal_class_"
+#define DECIMAL_CONTEXT_VARIABLE "_mpd_decimal_context_"
+
 struct decimal_t {
   mpd_context_t *context;
   mpd_t *decimal;
@@ -65,6 +71,13 @@ static void check_status(mrb_state *state, uint32_t status) {
   }
 }
 
+static void check_conversion_status(mrb_state *state, mrb_value value, uint32_t status) {
+  if (status & MPD_Conversion_syntax) {
+    mrb_raisef(state, mrb_class_get(state, "ArgumentError"), "can't convert %S into Decimal", mrb_inspect(state, value));
+  }
+  check_status(state, status);
+}
+
 static mrb_value ext_decimal_initialize(mrb_state *state, mrb_value self) {
   mrb_value value = mrb_fixnum_value(0);
   mrb_get_args(state, "|o", &value);
@@ -90,14 +103,25 @@ static mrb_value ext_decimal_initialize(mrb_state *state, mrb_value self) {
     mrb_value converted_value = mrb_convert_type(state, value, MRB_TT_STRING, "String", "to_s");
     mpd_qset_string(decimal->decimal, mrb_str_to_cstr(state, converted_value), context, &status);
   }
-  if (status & MPD_Conversion_syntax) {
-    mrb_raisef(state, mrb_class_get(state, "ArgumentError"), "can't convert %S into Decimal", mrb_inspect(state, value));
-  }
-  check_status(state, status);
+  check_conversion_status(state, value, status);
 
   return self;
 }
 
+MRB_API mrb_value mrb_decimal_new(mrb_state *state, const char *bytes, size_t size) {
+  struct RClass *klass = mrb_class_ptr(mrb_gv_get(state, mrb_intern_lit(state, DECIMAL_CLASS_VARIABLE)));
+  mrb_value wrapped_context = mrb_gv_get(state, mrb_intern_lit(state, DECIMAL_CONTEXT_VARIABLE));
+  mpd_context_t *context = mrb_data_check_get_ptr(state, wrapped_context, &CONTEXT_DATA_TYPE);
+
+  // Wrapped before it is set, so that it is freed if the bytes do not parse.
+  mrb_value string = mrb_str_new(state, bytes, size);
+  mrb_value result = wrap_decimal(state, klass, context, mpd_qnew(context));
+  uint32_t status = 0;
+  mpd_qset_string(unwrap_decimal(state, result)->decimal, mrb_str_to_cstr(state, string), context, &status);
+  check_conversion_status(state, string, status);
+  return result;
+}
+
 typedef void (*unary_op_t)(mpd_t *, const mpd_t *, const mpd_context_t *, uint32_t *);
 typedef void (*binary_op_t)(mpd_t *, const mpd_t *, const mpd_t *, const mpd_context_t *, uint32_t *);
 
@@ -266,6 +290,8 @@ void mrb_mruby_mpdecimal_gem_init(mrb_state *state) {
 
   struct RClass *c_decimal = mrb_define_class(state, "Decimal", state->object_class);
   MRB_SET_INSTANCE_TT(c_decimal, MRB_TT_DATA);
+  mrb_gv_set(state, mrb_intern_lit(state, DECIMAL_CLASS_VARIABLE), mrb_obj_value(c_decimal));
+  mrb_gv_set(state, mrb_intern_lit(state, DECIMAL_CONTEXT_VARIABLE), context);
 
   mrb_define_method_raw(
     state,
@@ -0,0 +1,18 @@
+/*
+** mruby/time.h - Time class
+**
+** See Copyright Notice in mruby.h
+*/
+
+#ifndef MRUBY_TIME_H
+#define MRUBY_TIME_H
+
+#include <mruby.h>
+#include <stdint.h>
+
+/* Creates a Time at `sec` seconds and `usec` microseconds since the epoch,
+* in UTC or local time, as Time.at and Time#utc would. It does not dispatch
+* to either, so it is unaffected by scripts redefining them. */
+MRB_API mrb_value mrb_time_new_at(mrb_state *mrb, int64_t sec, long usec, mrb_bool utc);
+
+#endif
@@ -10,6 +10,11 @@
 #include <mruby.h>
 #include <mruby/class.h>
 #include <mruby/data.h>
+#include <mruby/time.h>
+#include <mruby/variable.h>
+
+/* The class Time was defined as, kept where scripts cannot reach it. */
+#define TIME_CLASS_VARIABLE "_mruby_time_class_"
 
 #if _MSC_VER < 1800
 double round(double x) {
@@ -253,6 +258,24 @@ mrb_time_make(mrb_state *mrb, struct RClass *c, double sec, double usec, enum mr
   return mrb_time_wrap(mrb, c, time_alloc(mrb, sec, usec, timezone));
 }
 
+MRB_API mrb_value
+mrb_time_new_at(mrb_state *mrb, int64_t sec, long usec, mrb_bool utc)
+{
+  struct mrb_time *tm;
+  mrb_value time;
+  struct RClass *tc;
+
+  tc = mrb_class_ptr(mrb_gv_get(mrb, mrb_intern_lit(mrb, TIME_CLASS_VARIABLE)));
+  tm = (struct mrb_time *)mrb_malloc(mrb, sizeof(struct mrb_time));
+  tm->sec = (time_t)sec;
+  tm->usec = (time_t)usec;
+  tm->timezone = utc ? MRB_TIMEZONE_UTC : MRB_TIMEZONE_LOCAL;
+  /* Wrapped first, so that the struct is freed if the time is out of range. */
+  time = mrb_time_wrap(mrb, tc, tm);
+  time_update_datetime(mrb, tm);
+  return time;
+}
+
 /* 15.2.19.6.1 */
 /* Creates an instance of time at the given time in seconds, etc. */
 static mrb_value
@@ -673,6 +696,7 @@ mrb_mruby_time_gem_init(mrb_state* mrb)
   /* ISO 15.2.19.2 */
   tc = mrb_define_class(mrb, "Time", mrb->object_class);
   MRB_SET_INSTANCE_TT(tc, MRB_TT_DATA);
+  mrb_gv_set(mrb, mrb_intern_lit(mrb, TIME_CLASS_VARIABLE), mrb_obj_value(tc));
   mrb_include_module(mrb, tc, mrb_module_get(mrb, "Comparable"));
   mrb_define_class_method(mrb, tc, "at", mrb_time_at, MRB_ARGS_ARG(1, 1));      /* 15.2.19.6.1 */
   mrb_define_class_method(mrb, tc, "utc", mrb_time_gm, MRB_ARGS_ARG(1,6));      /* 15.2.19.6.6 */
@@ -11,8 +11,15 @@
 #include <mruby/throw.h>
 #include <mruby/variable.h>
 #include <stdlib.h>
+#include <time.h>
 
 #define ME_EXIT_EXCEPTION_CLASS_VARIABLE "_me_exit_exception_class_"
+#define ME_FROZEN_INJECTIONS_VARIABLE "_me_frozen_injections_"
+#define ME_GC_GENERATIONAL_MODE_SETTER_VARIABLE "_me_gc_generational_mode_setter_"
+
+// Defined in mruby's gc.c by script/mkmruby: called before and after every
+// incremental step and every full collection.
+extern void (*mrb_gc_hook)(struct mrb_state *mrb, mrb_bool start);
 
 static struct RClass *get_exit_exception_class(struct mrb_state *state) {
   mrb_value c = mrb_gv_get(state, mrb_intern_lit(state, ME_EXIT_EXCEPTION_CLASS_VARIABLE));
@@ -28,8 +35,8 @@ struct me_iseq {
   uint8_t *data;
 };
 
-static void mruby_engine_signal_memory_quota_reached(struct me_mruby_engine *self, size_t size) {
-  struct me_eval_err err = (struct me_eval_err){
+static struct me_eval_err mruby_engine_memory_quota_err(struct me_mruby_engine *self, size_t size) {
+  return (struct me_eval_err){
     .type = ME_EVAL_MEMORY_QUOTA_REACHED,
     .memory_quota_reached = {
       .size = size,
@@ -37,7 +44,10 @@ static void mruby_engine_signal_memory_quota_reached(struct me_mruby_engine *sel
       .capacity = me_memory_pool_get_capacity(self->allocator),
     },
   };
-  me_mruby_engine_eval_leave(self, err);
+}
+
+void me_mruby_engine_signal_memory_quota_reached(struct me_mruby_engine *self, size_t size) {
+  me_mruby_engine_eval_leave(self, mruby_engine_memory_quota_err(self, size));
 }
 
 static void mruby_engine_signal_instruction_quota_reached(struct me_mruby_engine *self) {
@@ -61,9 +71,44 @@ static void mruby_engine_signal_stack_exhausted(
 }
 #endif
 
-static void *mruby_engine_allocf(struct mrb_state *state, void *block, size_t size, void *data) {
-  (void)state;
+static void *mruby_engine_pool_alloc(struct me_mruby_engine *self, void *block, size_t size) {
+  if (block == NULL) {
+    return me_memory_pool_malloc(self->allocator, size);
+  }
+  return me_memory_pool_realloc(self->allocator, block, size);
+}
+
+// The incremental GC is paced by object count, so a few large strings can
+// fill the pool long before their garbage is swept. A full collection is only
+// attempted once the heap exists and outside of another collection.
+static bool mruby_engine_collect(struct me_mruby_engine *self, struct mrb_state *state) {
+  if (state == NULL || state->gc.heaps == NULL || state->gc.disabled || self->gc_collecting) {
+    return false;
+  }
+
+  self->gc_collecting = true;
+  mrb_full_gc(state);
+  self->gc_collecting = false;
+  return true;
+}
+
+// Lowering the threshold to the live count makes the next `mrb_obj_alloc` run
+// an incremental step, rather than collecting in the middle of a realloc.
+// That is only done when usage crosses the watermark: while it stays above,
+// the GC's own pacing applies until the cycle completes.
+static void mruby_engine_check_gc_watermark(struct me_mruby_engine *self, struct mrb_state *state) {
+  if (self->gc_watermark == 0 || state == NULL) {
+    return;
+  }
+  if (me_memory_pool_get_usage(self->allocator) < self->gc_watermark) {
+    self->gc_watermark_armed = true;
+  } else if (self->gc_watermark_armed) {
+    self->gc_watermark_armed = false;
+    state->gc.threshold = state->gc.live;
+  }
+}
 
+static void *mruby_engine_allocf(struct mrb_state *state, void *block, size_t size, void *data) {
   struct me_mruby_engine *engine = data;
 
   if (size == 0) {
@@ -73,16 +118,23 @@ static void *mruby_engine_allocf(struct mrb_state *state, void *block, size_t si
     return NULL;
   }
 
-  if (block == NULL) {
-    block = me_memory_pool_malloc(engine->allocator, size);
-  } else {
-    block = me_memory_pool_realloc(engine->allocator, block, size);
+  void *new_block = mruby_engine_pool_alloc(engine, block, size);
+  if (new_block == NULL && mruby_engine_collect(engine, state)) {
+    new_block = mruby_engine_pool_alloc(engine, block, size);
   }
 
-  if (block == NULL) {
-    mruby_engine_signal_memory_quota_reached(engine, size);
+  if (new_block == NULL) {
+    if (!engine->alloc_soft_fail) {
+      me_mruby_engine_signal_memory_quota_reached(engine, size);
+    }
+    if (engine->alloc_err.type == ME_EVAL_NO_ERR) {
+      engine->alloc_err = mruby_engine_memory_quota_err(engine, size);
+    }
+    return NULL;
   }
-  return block;
+
+  mruby_engine_check_gc_watermark(engine, state);
+  return new_block;
 }
 
 bool me_mruby_engine_get_quota_exception_raised(struct me_mruby_engine *self) {
@@ -136,6 +188,33 @@ static void mruby_engine_check_stack(
 }
 #endif
 
+// A cycle has run when a step or a full collection leaves the GC back in its
+// root state. Both return straight away, in that state, while the GC is
+// disabled.
+static void mruby_engine_gc_hook(struct mrb_state *mrb, mrb_bool start) {
+  struct me_mruby_engine *engine = mrb->allocf_ud;
+  struct timespec now;
+
+  if (start) {
+    if (engine->gc_hook_depth++ == 0) {
+      clock_gettime(CLOCK_MONOTONIC, &engine->gc_started);
+    }
+    return;
+  }
+
+  if (--engine->gc_hook_depth > 0) {
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  engine->gc_time_ns +=
+    (int64_t)(now.tv_sec - engine->gc_started.tv_sec) * 1000000000 +
+    (now.tv_nsec - engine->gc_started.tv_nsec);
+  if (!mrb->gc.disabled && mrb->gc.state == MRB_GC_STATE_ROOT) {
+    engine->gc_runs++;
+    engine->gc_watermark_armed = true;
+  }
+}
+
 static void mruby_engine_code_fetch_hook(
   struct mrb_state* mrb,
   struct mrb_irep *irep,
@@ -168,6 +247,15 @@ static void mruby_engine_code_fetch_hook(
 #endif
 }
 
+void me_mruby_engine_charge_instructions(struct me_mruby_engine *self, uint64_t count) {
+  if (count > self->instruction_quota - self->instruction_count) {
+    self->instruction_count = self->instruction_quota;
+    mruby_engine_signal_instruction_quota_reached(self);
+  }
+
+  self->instruction_count += count;
+}
+
 static mrb_value mruby_engine_exit(struct mrb_state *state, mrb_value rvalue) {
   struct RClass *c = get_exit_exception_class(state);
   mrb_raise(state, c, "exit exception");
@@ -182,6 +270,23 @@ struct me_mruby_engine *me_mruby_engine_new(
   struct RClass *eExitException_class;
   struct me_mruby_engine *self = me_memory_pool_malloc(allocator, sizeof(struct me_mruby_engine));
   self->allocator = allocator;
+  self->gc_watermark = 0;
+  self->gc_watermark_armed = true;
+  self->gc_collecting = false;
+  self->alloc_soft_fail = false;
+  self->alloc_err = (struct me_eval_err){ .type = ME_EVAL_NO_ERR };
+  self->output_buffer = (struct me_buffer){ .bytes = NULL };
+  self->symbols_to_guest = (struct me_symbol_cache){ .entries = NULL };
+  self->symbols_to_host = (struct me_symbol_cache){ .entries = NULL };
+  self->tracker = (struct me_tracker){ .entries = NULL };
+  self->injected_strings = NULL;
+  self->injected_strings_root = mrb_nil_value();
+  self->borrowed_strings = ME_HOST_NIL;
+  self->data_depth_max = ME_HOST_DATA_DEPTH_MAX;
+  self->lazy_array_class = NULL;
+  self->lazy_hash_class = NULL;
+  self->gc_hook_depth = 0;
+  mrb_gc_hook = mruby_engine_gc_hook;
   self->state = mrb_open_allocf(mruby_engine_allocf, self);
 
   if (self->state == NULL) {
@@ -191,6 +296,23 @@ struct me_mruby_engine *me_mruby_engine_new(
   eExitException_class = mrb_define_class(self->state, "ExitException", self->state->eException_class);
   mrb_gv_set(self->state, mrb_intern_lit(self->state, ME_EXIT_EXCEPTION_CLASS_VARIABLE), mrb_obj_value(eExitException_class));
   mrb_define_method(self->state, self->state->kernel_module, "exit", mruby_engine_exit, 1);
+  me_value_guest_define_json(self);
+
+  self->lookup_key = mrb_str_new_static(self->state, "", 0);
+  MRB_SET_FROZEN_FLAG(mrb_basic_ptr(self->lookup_key));
+  mrb_gv_set(self->state, mrb_intern_lit(self->state, ME_LOOKUP_KEY_VARIABLE), self->lookup_key);
+
+  // Kept before any script can redefine GC.generational_mode=, so that the
+  // engine can switch modes later without dispatching to the method.
+  struct RClass *gc_module = mrb_module_get(self->state, "GC");
+  struct RProc *generational_mode_setter = mrb_method_search(
+    self->state,
+    mrb_class(self->state, mrb_obj_value(gc_module)),
+    mrb_intern_lit(self->state, "generational_mode="));
+  mrb_gv_set(
+    self->state,
+    mrb_intern_lit(self->state, ME_GC_GENERATIONAL_MODE_SETTER_VARIABLE),
+    mrb_obj_value(generational_mode_setter));
 
   self->instruction_quota = instruction_quota;
   self->instruction_count = 0;
@@ -200,6 +322,9 @@ struct me_mruby_engine *me_mruby_engine_new(
   self->ctx_switches_v = -1;
   self->ctx_switches_iv = -1;
   self->cpu_time_ns = 0;
+  // Collections made while setting the engine up are not the script's.
+  self->gc_runs = 0;
+  self->gc_time_ns = 0;
 
   return self;
 }
@@ -207,9 +332,57 @@ struct me_mruby_engine *me_mruby_engine_new(
 void me_mruby_engine_destroy(struct me_mruby_engine *self) {
   struct me_memory_pool *allocator = me_mruby_engine_get_allocator(self);
   mrb_close(self->state);
+  me_buffer_destroy(&self->output_buffer);
+  me_symbol_cache_destroy(&self->symbols_to_guest);
+  me_symbol_cache_destroy(&self->symbols_to_host);
+  me_tracker_destroy(&self->tracker);
   me_memory_pool_free(allocator, self);
 }
 
+void me_mruby_engine_set_gc_disabled(struct me_mruby_engine *self, bool disabled) {
+  self->state->gc.disabled = disabled;
+}
+
+void me_mruby_engine_set_gc_watermark(struct me_mruby_engine *self, double fraction) {
+  self->gc_watermark = (size_t)(fraction * me_memory_pool_get_capacity(self->allocator));
+  self->gc_watermark_armed = true;
+}
+
+// Switching modes has to finish the current cycle first, which only the GC
+// module's own setter knows how to do. It is called as a block, straight into
+// its C function; it does not look at its receiver.
+static me_guest_value_t mruby_engine_set_gc_generational_body(
+  struct me_mruby_engine *self,
+  void *data,
+  struct me_value_err *err)
+{
+  (void)err;
+  mrb_state *mrb = self->state;
+  mrb_value setter = mrb_gv_get(mrb, mrb_intern_lit(mrb, ME_GC_GENERATIONAL_MODE_SETTER_VARIABLE));
+  mrb_value generational = mrb_bool_value(*(bool *)data);
+  return mrb_yield_with_class(mrb, setter, 1, &generational, mrb_nil_value(), mrb->object_class).w;
+}
+
+void me_mruby_engine_set_gc_generational(
+  struct me_mruby_engine *self,
+  bool generational,
+  struct me_value_err *err)
+{
+  me_value_guest_protect(self, mruby_engine_set_gc_generational_body, &generational, err);
+}
+
+void me_mruby_engine_set_gc_interval_ratio(struct me_mruby_engine *self, int ratio) {
+  self->state->gc.interval_ratio = ratio;
+}
+
+void me_mruby_engine_set_gc_step_ratio(struct me_mruby_engine *self, int ratio) {
+  self->state->gc.step_ratio = ratio;
+}
+
+void me_mruby_engine_set_data_depth_max(struct me_mruby_engine *self, int depth) {
+  self->data_depth_max = depth;
+}
+
 struct me_memory_pool *me_mruby_engine_get_allocator(struct me_mruby_engine *self) {
   return self->allocator;
 }
@@ -294,19 +467,328 @@ void me_mruby_engine_iseq_load(
   me_mruby_engine_eval(self,(struct me_proc *)proc, err);
 }
 
+// Sets up the string options for the conversion. The dedup table only lives
+// as long as the conversion, and so does the guest array keeping the strings
+// it holds alive.
+static void mruby_engine_conversion_begin(
+  struct me_mruby_engine *self,
+  const struct me_inject_options *options,
+  struct me_symbol_cache *injected_strings)
+{
+  *injected_strings = (struct me_symbol_cache){ .entries = NULL };
+  if (options->dedup) {
+    self->injected_strings = injected_strings;
+  }
+  self->borrowed_strings = options->borrowed_strings;
+}
+
+static void mruby_engine_conversion_end(
+  struct me_mruby_engine *self,
+  struct me_symbol_cache *injected_strings)
+{
+  self->injected_strings = NULL;
+  self->borrowed_strings = ME_HOST_NIL;
+  me_symbol_cache_destroy(injected_strings);
+  if (!mrb_nil_p(self->injected_strings_root)) {
+    mrb_gv_set(self->state, mrb_intern_lit(self->state, ME_INJECTED_STRINGS_VARIABLE), mrb_nil_value());
+    self->injected_strings_root = mrb_nil_value();
+  }
+}
+
+// Frozen values are kept by ivar name in a hash that scripts cannot reach,
+// both to compare them by identity and so that their addresses are not
+// reused while they are remembered. Any other injection forgets them.
+static void mruby_engine_remember_frozen(
+  struct me_mruby_engine *self,
+  mrb_sym ivar_name,
+  bool freeze,
+  mrb_value value)
+{
+  mrb_sym variable = mrb_intern_lit(self->state, ME_FROZEN_INJECTIONS_VARIABLE);
+  mrb_value frozen = mrb_gv_get(self->state, variable);
+  if (mrb_nil_p(frozen)) {
+    if (!freeze) {
+      return;
+    }
+    frozen = mrb_hash_new(self->state);
+    mrb_gv_set(self->state, variable, frozen);
+  }
+
+  if (freeze) {
+    mrb_hash_set(self->state, frozen, mrb_symbol_value(ivar_name), value);
+  } else {
+    mrb_hash_delete_key(self->state, frozen, mrb_symbol_value(ivar_name));
+  }
+}
+
+struct mruby_engine_store_args {
+  mrb_sym ivar_name;
+  bool freeze;
+  mrb_value value;
+};
+
+static me_guest_value_t mruby_engine_store_body(
+  struct me_mruby_engine *self,
+  void *data,
+  struct me_value_err *err)
+{
+  (void)err;
+  struct mruby_engine_store_args *args = data;
+  mrb_iv_set(self->state, mrb_top_self(self->state), args->ivar_name, args->value);
+  mruby_engine_remember_frozen(self, args->ivar_name, args->freeze, args->value);
+  return me_value_guest_nil_new();
+}
+
+// Storing the value and remembering it may allocate in the guest, so they run
+// in a protect scope: running out of memory there must not leave the calling
+// thread.
+static void mruby_engine_store(
+  struct me_mruby_engine *self,
+  mrb_sym ivar_name,
+  bool freeze,
+  mrb_value value,
+  struct me_value_err *err)
+{
+  struct mruby_engine_store_args args = (struct mruby_engine_store_args){
+    .ivar_name = ivar_name,
+    .freeze = freeze,
+    .value = value,
+  };
+  me_value_guest_protect(self, mruby_engine_store_body, &args, err);
+}
+
+// Tracking and freezing do not allocate in the guest; storing does, but the
+// value stays in the arena, where its conversion left it, until it is stored.
+static void mruby_engine_inject_converted(
+  struct me_mruby_engine *self,
+  mrb_sym ivar_name,
+  const struct me_inject_options *options,
+  mrb_value value,
+  struct me_value_err *err)
+{
+  if (options->track) {
+    me_value_guest_track(self, ivar_name, value.w, err);
+    if (err->type != ME_VALUE_NO_ERR) {
+      return;
+    }
+  }
+  if (options->freeze) {
+    me_value_guest_freeze_deep(value.w);
+  }
+
+  mruby_engine_store(self, ivar_name, options->freeze, value, err);
+}
+
+struct mruby_engine_patch_args {
+  mrb_value root;
+  const struct me_value_patch_op *op;
+  mrb_value value;
+};
+
+static me_guest_value_t mruby_engine_patch_body(
+  struct me_mruby_engine *self,
+  void *data,
+  struct me_value_err *err)
+{
+  struct mruby_engine_patch_args *args = data;
+  me_value_guest_patch(self, args->root.w, args->op, args->value.w, err);
+  return me_value_guest_nil_new();
+}
+
+// Each converted value is kept alive by the arena until it is attached, and
+// then by the value it was attached to.
+void me_mruby_engine_patch(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_value_patch_op *ops,
+  size_t count,
+  struct me_value_err *err)
+{
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_name);
+  mrb_value root = mrb_iv_get(self->state, mrb_top_self(self->state), ivar_name_mrb);
+  int arena_index = mrb_gc_arena_save(self->state);
+
+  for (size_t i = 0; i < count && err->type == ME_VALUE_NO_ERR; ++i) {
+    struct mruby_engine_patch_args args = (struct mruby_engine_patch_args){
+      .root = root,
+      .op = &ops[i],
+      .value = mrb_nil_value(),
+    };
+    if (ops[i].type != ME_VALUE_PATCH_DELETE) {
+      args.value = (mrb_value){ .w = me_value_to_guest(self, NULL, ops[i].value, err) };
+      if (err->type != ME_VALUE_NO_ERR) {
+        break;
+      }
+    }
+
+    me_value_guest_protect(self, mruby_engine_patch_body, &args, err);
+    if (err->type == ME_VALUE_BAD_PATCH) {
+      err->patch_err.op = i;
+    }
+    mrb_gc_arena_restore(self->state, arena_index);
+  }
+}
+
+bool me_mruby_engine_injected_p(struct me_mruby_engine *self, const char *ivar_name) {
+  mrb_value frozen = mrb_gv_get(self->state, mrb_intern_lit(self->state, ME_FROZEN_INJECTIONS_VARIABLE));
+  if (mrb_nil_p(frozen)) {
+    return false;
+  }
+
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_name);
+  mrb_value injected = mrb_hash_fetch(self->state, frozen, mrb_symbol_value(ivar_name_mrb), mrb_undef_value());
+  if (mrb_undef_p(injected)) {
+    return false;
+  }
+  mrb_value current = mrb_iv_get(self->state, mrb_top_self(self->state), ivar_name_mrb);
+  return mrb_obj_eq(self->state, current, injected);
+}
+
 void me_mruby_engine_inject(
   struct me_mruby_engine *self,
   const char *ivar_name,
+  const struct me_inject_options *options,
   me_host_value_t value,
   struct me_value_err *err)
 {
   mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_name);
-  mrb_value value_mrb = (mrb_value){ .w = me_value_to_guest(self, value, err) };
+  int arena_index = mrb_gc_arena_save(self->state);
+
+  struct me_symbol_cache injected_strings;
+  mruby_engine_conversion_begin(self, options, &injected_strings);
+  mrb_value value_mrb = (mrb_value){ .w = me_value_to_guest(self, options->schema, value, err) };
+  mruby_engine_conversion_end(self, &injected_strings);
+  if (err->type == ME_VALUE_NO_ERR) {
+    mruby_engine_inject_converted(self, ivar_name_mrb, options, value_mrb, err);
+  }
+  mrb_gc_arena_restore(self->state, arena_index);
+}
+
+void me_mruby_engine_inject_all(
+  struct me_mruby_engine *self,
+  const char *const *ivar_names,
+  const me_host_value_t *values,
+  size_t count,
+  const struct me_inject_options *options,
+  struct me_value_err *err)
+{
+  int arena_index = mrb_gc_arena_save(self->state);
+
+  struct me_symbol_cache injected_strings;
+  mruby_engine_conversion_begin(self, options, &injected_strings);
+  mrb_value values_mrb = (mrb_value){ .w = me_value_to_guest_all(self, values, count, err) };
+  mruby_engine_conversion_end(self, &injected_strings);
+
+  for (size_t i = 0; i < count && err->type == ME_VALUE_NO_ERR; ++i) {
+    mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_names[i]);
+    mrb_value value_mrb = mrb_ary_ref(self->state, values_mrb, (mrb_int)i);
+    mruby_engine_inject_converted(self, ivar_name_mrb, options, value_mrb, err);
+  }
+  mrb_gc_arena_restore(self->state, arena_index);
+}
+
+void me_mruby_engine_inject_shared(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_shared_node *node,
+  struct me_value_err *err)
+{
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_name);
+  int arena_index = mrb_gc_arena_save(self->state);
+  mrb_value value_mrb = (mrb_value){ .w = me_value_guest_from_shared(self, node, err) };
+  if (err->type == ME_VALUE_NO_ERR) {
+    mruby_engine_store(self, ivar_name_mrb, false, value_mrb, err);
+  }
+  mrb_gc_arena_restore(self->state, arena_index);
+}
+
+void me_mruby_engine_inject_lazy(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_shared_node *node,
+  struct me_value_err *err)
+{
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_name);
+  int arena_index = mrb_gc_arena_save(self->state);
+  mrb_value value_mrb = (mrb_value){ .w = me_value_guest_lazy(self, node, err) };
+  if (err->type == ME_VALUE_NO_ERR) {
+    mruby_engine_store(self, ivar_name_mrb, false, value_mrb, err);
+  }
+  mrb_gc_arena_restore(self->state, arena_index);
+}
+
+// Parses serialized data straight into guest values. Runs inside a protect
+// scope, without touching the host.
+typedef me_guest_value_t (*mruby_engine_parse_t)(
+  struct me_mruby_engine *self,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err);
+
+struct mruby_engine_inject_serialized_args {
+  const char *ivar_name;
+  const char *bytes;
+  size_t size;
+  mruby_engine_parse_t parse;
+};
+
+static me_guest_value_t mruby_engine_inject_serialized_body(
+  struct me_mruby_engine *self,
+  void *data,
+  struct me_value_err *err)
+{
+  struct mruby_engine_inject_serialized_args *args = data;
+  mrb_value value_mrb = (mrb_value){
+    .w = args->parse(self, args->bytes, args->size, err),
+  };
   if (err->type != ME_VALUE_NO_ERR) {
-    return;
+    return me_value_guest_nil_new();
   }
 
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, args->ivar_name);
   mrb_iv_set(self->state, mrb_top_self(self->state), ivar_name_mrb, value_mrb);
+  mruby_engine_remember_frozen(self, ivar_name_mrb, false, value_mrb);
+  // Stored, so the value needs no protection beyond the scope.
+  return me_value_guest_nil_new();
+}
+
+// Does not touch the host, so it can run without the GVL. A guest error is
+// left pending in `err`; see me_value_guest_take_exception.
+static void mruby_engine_inject_serialized(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const char *bytes,
+  size_t size,
+  mruby_engine_parse_t parse,
+  struct me_value_err *err)
+{
+  struct mruby_engine_inject_serialized_args args = (struct mruby_engine_inject_serialized_args){
+    .ivar_name = ivar_name,
+    .bytes = bytes,
+    .size = size,
+    .parse = parse,
+  };
+  me_value_guest_try(self, mruby_engine_inject_serialized_body, &args, err);
+}
+
+void me_mruby_engine_inject_json(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const char *json,
+  size_t size,
+  struct me_value_err *err)
+{
+  mruby_engine_inject_serialized(self, ivar_name, json, size, me_value_guest_parse_json, err);
+}
+
+void me_mruby_engine_inject_packed(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err)
+{
+  mruby_engine_inject_serialized(self, ivar_name, bytes, size, me_value_guest_unpack, err);
 }
 
 me_host_value_t me_mruby_engine_extract(
@@ -329,6 +811,170 @@ me_host_value_t me_mruby_engine_extract(
   return me_value_to_host(self, value.w, err);
 }
 
+me_host_value_t me_mruby_engine_extract_all(
+  struct me_mruby_engine *self,
+  const char *const *ivar_names,
+  size_t count,
+  struct me_value_err *err)
+{
+  mrb_value top_self = mrb_top_self(self->state);
+  me_host_value_t results = me_value_host_array_new(err);
+  for (size_t i = 0; i < count && err->type == ME_VALUE_NO_ERR; ++i) {
+    mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_names[i]);
+    mrb_value value = mrb_iv_get(self->state, top_self, ivar_name_mrb);
+    me_host_value_t result = me_value_to_host(self, value.w, err);
+    if (err->type == ME_VALUE_NO_ERR) {
+      me_value_host_array_push(results, result, err);
+    }
+  }
+  return results;
+}
+
+me_host_value_t me_mruby_engine_extract_changes(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  struct me_value_err *err)
+{
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_name);
+  mrb_value value = mrb_iv_get(self->state, mrb_top_self(self->state), ivar_name_mrb);
+  return me_value_to_host_changes(self, ivar_name_mrb, value.w, err);
+}
+
+me_host_value_t me_mruby_engine_extract_paths(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_value_path *paths,
+  size_t count,
+  struct me_value_err *err)
+{
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, ivar_name);
+  mrb_value value = mrb_iv_get(self->state, mrb_top_self(self->state), ivar_name_mrb);
+
+  me_host_value_t results = me_value_host_array_new(err);
+  for (size_t i = 0; i < count && err->type == ME_VALUE_NO_ERR; ++i) {
+    me_host_value_t result = me_value_to_host_path(
+      self, value.w, paths[i].steps, paths[i].size, err);
+    if (err->type == ME_VALUE_NO_ERR) {
+      me_value_host_array_push(results, result, err);
+    }
+  }
+  return results;
+}
+
+// Writes a guest value into the engine's output buffer. Runs inside a
+// protect scope, without touching the host.
+typedef void (*mruby_engine_serialize_t)(
+  struct me_mruby_engine *self,
+  me_guest_value_t value,
+  const void *options,
+  struct me_buffer *buffer,
+  struct me_value_err *err);
+
+struct mruby_engine_extract_serialized_args {
+  const char *ivar_name;
+  mruby_engine_serialize_t serialize;
+  const void *options;
+};
+
+static me_guest_value_t mruby_engine_extract_serialized_body(
+  struct me_mruby_engine *self,
+  void *data,
+  struct me_value_err *err)
+{
+  struct mruby_engine_extract_serialized_args *args = data;
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, args->ivar_name);
+  mrb_value value = mrb_iv_get(self->state, mrb_top_self(self->state), ivar_name_mrb);
+  args->serialize(self, value.w, args->options, &self->output_buffer, err);
+  return me_value_guest_nil_new();
+}
+
+// Does not touch the host, so it can run without the GVL. The result lives in
+// the engine's output buffer until the next call; a guest error is left pending
+// in `err`.
+static const struct me_buffer *mruby_engine_extract_serialized(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  mruby_engine_serialize_t serialize,
+  const void *options,
+  struct me_value_err *err)
+{
+  struct mruby_engine_extract_serialized_args args = (struct mruby_engine_extract_serialized_args){
+    .ivar_name = ivar_name,
+    .serialize = serialize,
+    .options = options,
+  };
+  me_value_guest_try(self, mruby_engine_extract_serialized_body, &args, err);
+  return &self->output_buffer;
+}
+
+static void mruby_engine_generate_json(
+  struct me_mruby_engine *self,
+  me_guest_value_t value,
+  const void *options,
+  struct me_buffer *buffer,
+  struct me_value_err *err)
+{
+  me_value_guest_generate_json(self, value, options, buffer, err);
+}
+
+static void mruby_engine_pack(
+  struct me_mruby_engine *self,
+  me_guest_value_t value,
+  const void *options,
+  struct me_buffer *buffer,
+  struct me_value_err *err)
+{
+  (void)options;
+  me_value_guest_pack(self, value, buffer, err);
+}
+
+const struct me_buffer *me_mruby_engine_extract_json(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_json_options *options,
+  struct me_value_err *err)
+{
+  return mruby_engine_extract_serialized(self, ivar_name, mruby_engine_generate_json, options, err);
+}
+
+const struct me_buffer *me_mruby_engine_extract_packed(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  struct me_value_err *err)
+{
+  return mruby_engine_extract_serialized(self, ivar_name, mruby_engine_pack, NULL, err);
+}
+
+struct mruby_engine_extract_result_args {
+  const char *ivar_name;
+  struct me_result_buffer *buffer;
+};
+
+static me_guest_value_t mruby_engine_extract_result_body(
+  struct me_mruby_engine *self,
+  void *data,
+  struct me_value_err *err)
+{
+  struct mruby_engine_extract_result_args *args = data;
+  mrb_sym ivar_name_mrb = mrb_intern_cstr(self->state, args->ivar_name);
+  mrb_value value = mrb_iv_get(self->state, mrb_top_self(self->state), ivar_name_mrb);
+  me_value_guest_to_result(self, value.w, args->buffer, err);
+  return me_value_guest_nil_new();
+}
+
+void me_mruby_engine_extract_result(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  struct me_result_buffer *buffer,
+  struct me_value_err *err)
+{
+  struct mruby_engine_extract_result_args args = (struct mruby_engine_extract_result_args){
+    .ivar_name = ivar_name,
+    .buffer = buffer,
+  };
+  me_value_guest_try(self, mruby_engine_extract_result_body, &args, err);
+}
+
 uint64_t me_mruby_engine_get_instruction_count(struct me_mruby_engine *self) {
   return self->instruction_count;
 }
@@ -349,6 +995,26 @@ int64_t me_mruby_engine_get_cpu_time(struct me_mruby_engine *self) {
   return self->cpu_time_ns;
 }
 
+uint64_t me_mruby_engine_get_gc_runs(struct me_mruby_engine *self) {
+  return self->gc_runs;
+}
+
+int64_t me_mruby_engine_get_gc_time(struct me_mruby_engine *self) {
+  return self->gc_time_ns;
+}
+
+size_t me_mruby_engine_get_gc_live(struct me_mruby_engine *self) {
+  return self->state->gc.live;
+}
+
+size_t me_mruby_engine_get_gc_heap_pages(struct me_mruby_engine *self) {
+  size_t pages = 0;
+  for (mrb_heap_page *page = self->state->gc.heaps; page != NULL; page = page->next) {
+    pages++;
+  }
+  return pages;
+}
+
 static int next_source(struct mrb_parser_state *parser_state) {
   struct mrbc_context *context = parser_state->cxt;
   struct me_source *sources = context->partial_data;
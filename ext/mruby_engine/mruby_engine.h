@@ -1,9 +1,12 @@
 #ifndef MRUBY_ENGINE_MRUBY_ENGINE_H
 #define MRUBY_ENGINE_MRUBY_ENGINE_H
 
+#include "buffer.h"
 #include "definitions.h"
 #include "host.h"
 #include "memory_pool.h"
+#include "result_buffer.h"
+#include "shared_segment.h"
 #include <time.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -58,12 +61,26 @@ struct me_mruby_engine *me_mruby_engine_new(
   struct timespec time_quota);
 void me_mruby_engine_destroy(struct me_mruby_engine *self);
 
+void me_mruby_engine_set_gc_disabled(struct me_mruby_engine *self, bool disabled);
+void me_mruby_engine_set_gc_watermark(struct me_mruby_engine *self, double fraction);
+void me_mruby_engine_set_gc_generational(
+  struct me_mruby_engine *self,
+  bool generational,
+  struct me_value_err *err);
+void me_mruby_engine_set_gc_interval_ratio(struct me_mruby_engine *self, int ratio);
+void me_mruby_engine_set_gc_step_ratio(struct me_mruby_engine *self, int ratio);
+void me_mruby_engine_set_data_depth_max(struct me_mruby_engine *self, int depth);
+
 struct me_memory_pool *me_mruby_engine_get_allocator(struct me_mruby_engine *self);
 uint64_t me_mruby_engine_get_instruction_count(struct me_mruby_engine *self);
 struct meminfo me_mruby_engine_get_memory_info(struct me_mruby_engine *self);
 int64_t me_mruby_engine_get_ctx_switches_voluntary(struct me_mruby_engine *self);
 int64_t me_mruby_engine_get_ctx_switches_involuntary(struct me_mruby_engine *self);
 int64_t me_mruby_engine_get_cpu_time(struct me_mruby_engine *self);
+uint64_t me_mruby_engine_get_gc_runs(struct me_mruby_engine *self);
+int64_t me_mruby_engine_get_gc_time(struct me_mruby_engine *self);
+size_t me_mruby_engine_get_gc_live(struct me_mruby_engine *self);
+size_t me_mruby_engine_get_gc_heap_pages(struct me_mruby_engine *self);
 bool me_mruby_engine_get_quota_exception_raised(struct me_mruby_engine *self);
 struct me_proc *me_mruby_engine_generate_code(
   struct me_mruby_engine *self,
@@ -75,15 +92,112 @@ void me_mruby_engine_eval(
   struct me_proc *proc,
   me_host_exception_t *err);
 void me_mruby_engine_iseq_load(struct me_mruby_engine *self, const struct me_iseq *iseq, me_host_exception_t *err);
+struct me_inject_options {
+  // NULL for a value of unknown shape.
+  const struct me_schema *schema;
+  // Remembers the injected value so that its changes can be extracted later.
+  bool track;
+  // Injects equal strings as one frozen guest string.
+  bool dedup;
+  // A host identity hash to which large frozen strings are added when the
+  // guest strings injected for them point at their bytes, or ME_HOST_NIL to
+  // copy every string. The caller keeps it alive for the engine's lifetime.
+  me_host_value_t borrowed_strings;
+  // Deep-freezes the value and remembers it, for me_mruby_engine_injected_p.
+  bool freeze;
+};
+
 void me_mruby_engine_inject(
   struct me_mruby_engine *self,
   const char *ivar_name,
+  const struct me_inject_options *options,
   me_host_value_t value,
   struct me_value_err *err);
+// Converts every value in a single protect scope, sharing one dedup table,
+// before storing any of them. Schemas are per value, so `options->schema` is
+// ignored.
+void me_mruby_engine_inject_all(
+  struct me_mruby_engine *self,
+  const char *const *ivar_names,
+  const me_host_value_t *values,
+  size_t count,
+  const struct me_inject_options *options,
+  struct me_value_err *err);
+// Applies the operations in order to the value held by `ivar_name`. Those
+// before a failing one stay applied.
+void me_mruby_engine_patch(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_value_patch_op *ops,
+  size_t count,
+  struct me_value_err *err);
+// Whether `ivar_name` still holds the value last injected into it with
+// freeze, which then cannot have changed.
+bool me_mruby_engine_injected_p(struct me_mruby_engine *self, const char *ivar_name);
+void me_mruby_engine_inject_shared(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_shared_node *node,
+  struct me_value_err *err);
+void me_mruby_engine_inject_lazy(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_shared_node *node,
+  struct me_value_err *err);
+// The serialized variants of inject and extract do not touch the host, so
+// they can run without the GVL. A guest error is left pending in `err`; see
+// me_value_guest_take_exception. Extracted data lives in the engine's output
+// buffer until the next extraction.
+void me_mruby_engine_inject_json(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const char *json,
+  size_t size,
+  struct me_value_err *err);
+void me_mruby_engine_inject_packed(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err);
 me_host_value_t me_mruby_engine_extract(
   struct me_mruby_engine *self,
   const char *ivar_name,
   struct me_value_err *err);
+// Extracts one value per instance variable, in an array.
+me_host_value_t me_mruby_engine_extract_all(
+  struct me_mruby_engine *self,
+  const char *const *ivar_names,
+  size_t count,
+  struct me_value_err *err);
+// Lists the parts of a value injected with tracking that were modified
+// since, as [path, value] pairs.
+me_host_value_t me_mruby_engine_extract_changes(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  struct me_value_err *err);
+// Extracts one result per path, in an array.
+me_host_value_t me_mruby_engine_extract_paths(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_value_path *paths,
+  size_t count,
+  struct me_value_err *err);
+const struct me_buffer *me_mruby_engine_extract_json(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  const struct me_json_options *options,
+  struct me_value_err *err);
+const struct me_buffer *me_mruby_engine_extract_packed(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  struct me_value_err *err);
+// Fills `buffer` instead of building host values. Does not touch the host.
+void me_mruby_engine_extract_result(
+  struct me_mruby_engine *self,
+  const char *ivar_name,
+  struct me_result_buffer *buffer,
+  struct me_value_err *err);
 
 struct me_iseq *me_iseq_new(
   struct me_source sources[],
@@ -4,9 +4,14 @@
 #include "mruby_engine.h"
 #include "definitions.h"
 #include "host.h"
+#include "symbol_cache.h"
+#include "tracker.h"
 #include <mruby/proc.h>
 #include <stdbool.h>
 
+#define ME_INJECTED_STRINGS_VARIABLE "_me_injected_strings_"
+#define ME_LOOKUP_KEY_VARIABLE "_me_lookup_key_"
+
 struct me_proc {
   struct RProc proc;
 };
@@ -39,8 +44,73 @@ struct me_mruby_engine {
   int64_t ctx_switches_v;
   int64_t ctx_switches_iv;
   int64_t cpu_time_ns;
+
+  // Pool usage, in bytes, above which the next object allocation runs a GC
+  // step. Zero disables the watermark.
+  size_t gc_watermark;
+  // Cleared once crossing the watermark has scheduled a step, and set again
+  // when usage drops back below it or a GC cycle completes.
+  bool gc_watermark_armed;
+  bool gc_collecting;
+
+  // Set while converting values outside of an evaluation. Allocation
+  // failures are then handed back to mruby, which raises into the
+  // conversion's protect scope, instead of leaving the eval thread.
+  bool alloc_soft_fail;
+  struct me_eval_err alloc_err;
+
+  // Maintained by the GC hook that script/mkmruby adds to mruby, which sees
+  // every step and full collection, wherever they are triggered. Nested
+  // collections are timed as part of the outermost one.
+  uint64_t gc_runs;
+  int64_t gc_time_ns;
+  int gc_hook_depth;
+  struct timespec gc_started;
+
+  // Reused by every serializing extraction and by the guest's JSON.generate,
+  // so that steady-state serialization does not allocate. Neither runs
+  // script code while writing, so they cannot overlap.
+  struct me_buffer output_buffer;
+
+  // Host symbol IDs to guest symbols and back.
+  struct me_symbol_cache symbols_to_guest;
+  struct me_symbol_cache symbols_to_host;
+
+  // Digests of the values injected with tracking.
+  struct me_tracker tracker;
+
+  // Guest strings by the digest of their contents, set only for the duration
+  // of an injection with dedup. The table is not marked, so the strings are
+  // also held by an array kept in the ME_INJECTED_STRINGS_VARIABLE global,
+  // created on the first one and dropped with the table.
+  struct me_symbol_cache *injected_strings;
+  mrb_value injected_strings_root;
+
+  // The borrowed_strings of the injection under way, ME_HOST_NIL otherwise.
+  me_host_value_t borrowed_strings;
+
+  // How deeply injected and extracted values may nest.
+  int data_depth_max;
+
+  // Defined on the first lazy injection.
+  struct RClass *lazy_array_class;
+  struct RClass *lazy_hash_class;
+
+  // A frozen, static guest string, held by the ME_LOOKUP_KEY_VARIABLE global.
+  // Hash lookups by a host string point it at the string's bytes for the
+  // duration of the lookup, so that they do not allocate.
+  mrb_value lookup_key;
 };
 
+// Counts `count` instructions of native work done on behalf of the script,
+// leaving the evaluation if that goes over the quota.
+void me_mruby_engine_charge_instructions(struct me_mruby_engine *self, uint64_t count);
+
+// Leaves the evaluation with a memory quota error for an allocation of
+// `size` bytes.
+void me_mruby_engine_signal_memory_quota_reached(struct me_mruby_engine *self, size_t size)
+  __attribute__((noreturn));
+
 me_host_exception_t me_eval_err_to_host(struct me_eval_err *err);
 
 me_host_exception_t me_mruby_engine_get_exception(struct me_mruby_engine *self);
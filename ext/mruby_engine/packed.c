@@ -0,0 +1,312 @@
+#include "packed.h"
+#include <string.h>
+
+static uint64_t packed_read_big_endian(const uint8_t *bytes, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+// Takes `size` bytes off the reader, or fails if there are not that many.
+static const uint8_t *packed_take(struct me_packed_reader *reader, size_t size) {
+  if ((size_t)(reader->end - reader->cursor) < size) {
+    return NULL;
+  }
+  const uint8_t *bytes = reader->cursor;
+  reader->cursor += size;
+  return bytes;
+}
+
+static bool packed_take_uint(struct me_packed_reader *reader, int size, uint64_t *value) {
+  const uint8_t *bytes = packed_take(reader, (size_t)size);
+  if (bytes == NULL) {
+    return false;
+  }
+  *value = packed_read_big_endian(bytes, size);
+  return true;
+}
+
+static bool packed_take_bytes(
+  struct me_packed_reader *reader,
+  size_t size,
+  struct me_packed_item *item,
+  enum me_packed_type type)
+{
+  const uint8_t *bytes = packed_take(reader, size);
+  if (bytes == NULL) {
+    return false;
+  }
+  item->type = type;
+  item->string.bytes = (const char *)bytes;
+  item->string.size = size;
+  return true;
+}
+
+// Every element takes at least a byte, so a count larger than what is left
+// is malformed; checking it here keeps callers from pre-sizing containers
+// from a bogus header.
+static bool packed_take_count(
+  struct me_packed_reader *reader,
+  uint64_t count,
+  size_t bytes_per_element,
+  struct me_packed_item *item,
+  enum me_packed_type type)
+{
+  if ((uint64_t)(reader->end - reader->cursor) / bytes_per_element < count) {
+    return false;
+  }
+  item->type = type;
+  item->count = (size_t)count;
+  return true;
+}
+
+static bool packed_read_ext(
+  struct me_packed_reader *reader,
+  uint64_t size,
+  struct me_packed_item *item)
+{
+  const uint8_t *type = packed_take(reader, 1);
+  if (type == NULL || *type != ME_PACKED_EXT_SYMBOL) {
+    return false;
+  }
+  return packed_take_bytes(reader, (size_t)size, item, ME_PACKED_SYMBOL);
+}
+
+static bool packed_read(
+  struct me_packed_reader *reader,
+  struct me_packed_item *item,
+  struct me_value_err *err)
+{
+  const uint8_t *tag_byte = packed_take(reader, 1);
+  if (tag_byte == NULL) {
+    return false;
+  }
+
+  uint8_t tag = *tag_byte;
+  uint64_t value;
+  if (tag <= 0x7f) {
+    *item = (struct me_packed_item){ .type = ME_PACKED_INTEGER, .integer = tag };
+    return true;
+  }
+  if (tag >= 0xe0) {
+    *item = (struct me_packed_item){ .type = ME_PACKED_INTEGER, .integer = (int8_t)tag };
+    return true;
+  }
+  if ((tag & 0xe0) == 0xa0) {
+    return packed_take_bytes(reader, tag & 0x1f, item, ME_PACKED_STRING);
+  }
+  if ((tag & 0xf0) == 0x90) {
+    return packed_take_count(reader, tag & 0x0f, 1, item, ME_PACKED_ARRAY);
+  }
+  if ((tag & 0xf0) == 0x80) {
+    return packed_take_count(reader, tag & 0x0f, 2, item, ME_PACKED_MAP);
+  }
+
+  switch (tag) {
+  case 0xc0:
+    item->type = ME_PACKED_NIL;
+    return true;
+  case 0xc2:
+    item->type = ME_PACKED_FALSE;
+    return true;
+  case 0xc3:
+    item->type = ME_PACKED_TRUE;
+    return true;
+  case 0xc4: case 0xc5: case 0xc6:
+    return packed_take_uint(reader, 1 << (tag - 0xc4), &value) &&
+      packed_take_bytes(reader, (size_t)value, item, ME_PACKED_BINARY);
+  case 0xc7: case 0xc8: case 0xc9:
+    return packed_take_uint(reader, 1 << (tag - 0xc7), &value) &&
+      packed_read_ext(reader, value, item);
+  case 0xca:
+    {
+      if (!packed_take_uint(reader, 4, &value)) {
+        return false;
+      }
+      uint32_t bits = (uint32_t)value;
+      float real;
+      memcpy(&real, &bits, sizeof(real));
+      *item = (struct me_packed_item){ .type = ME_PACKED_FLOAT, .real = real };
+      return true;
+    }
+  case 0xcb:
+    {
+      if (!packed_take_uint(reader, 8, &value)) {
+        return false;
+      }
+      double real;
+      memcpy(&real, &value, sizeof(real));
+      *item = (struct me_packed_item){ .type = ME_PACKED_FLOAT, .real = real };
+      return true;
+    }
+  case 0xcc: case 0xcd: case 0xce: case 0xcf:
+    if (!packed_take_uint(reader, 1 << (tag - 0xcc), &value)) {
+      return false;
+    }
+    if (value > INT64_MAX) {
+      *err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+      return false;
+    }
+    *item = (struct me_packed_item){ .type = ME_PACKED_INTEGER, .integer = (int64_t)value };
+    return true;
+  case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+    {
+      int size = 1 << (tag - 0xd0);
+      if (!packed_take_uint(reader, size, &value)) {
+        return false;
+      }
+      // Sign-extend from the encoded width.
+      int shift = 64 - 8 * size;
+      int64_t integer = (int64_t)(value << shift) >> shift;
+      *item = (struct me_packed_item){ .type = ME_PACKED_INTEGER, .integer = integer };
+      return true;
+    }
+  case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+    return packed_read_ext(reader, (uint64_t)1 << (tag - 0xd4), item);
+  case 0xd9: case 0xda: case 0xdb:
+    return packed_take_uint(reader, 1 << (tag - 0xd9), &value) &&
+      packed_take_bytes(reader, (size_t)value, item, ME_PACKED_STRING);
+  case 0xdc: case 0xdd:
+    return packed_take_uint(reader, 2 << (tag - 0xdc), &value) &&
+      packed_take_count(reader, value, 1, item, ME_PACKED_ARRAY);
+  case 0xde: case 0xdf:
+    return packed_take_uint(reader, 2 << (tag - 0xde), &value) &&
+      packed_take_count(reader, value, 2, item, ME_PACKED_MAP);
+  default:
+    return false;
+  }
+}
+
+bool me_packed_read(
+  struct me_packed_reader *reader,
+  struct me_packed_item *item,
+  struct me_value_err *err)
+{
+  const uint8_t *start = reader->cursor;
+  if (packed_read(reader, item, err)) {
+    return true;
+  }
+  if (err->type == ME_VALUE_NO_ERR) {
+    *err = (struct me_value_err){
+      .type = ME_VALUE_PACK_ERR,
+      .parse_err = { .offset = (size_t)(start - reader->start) },
+    };
+  }
+  return false;
+}
+
+bool me_packed_at_end(const struct me_packed_reader *reader) {
+  return reader->cursor == reader->end;
+}
+
+static bool packed_write_byte(struct me_buffer *buffer, uint8_t byte) {
+  return me_buffer_append(buffer, &byte, 1);
+}
+
+static bool packed_write_tagged(struct me_buffer *buffer, uint8_t tag, uint64_t value, int size) {
+  uint8_t bytes[9] = { tag };
+  for (int i = 0; i < size; ++i) {
+    bytes[size - i] = (uint8_t)(value >> (8 * i));
+  }
+  return me_buffer_append(buffer, bytes, (size_t)size + 1);
+}
+
+// Writes the smallest of the 8, 16 and 32 bit headers of a family, whose
+// tags are consecutive.
+static bool packed_write_length(struct me_buffer *buffer, uint8_t tag8, size_t size) {
+  if (size > UINT32_MAX) {
+    return false;
+  }
+  if (size <= UINT8_MAX) {
+    return packed_write_tagged(buffer, tag8, size, 1);
+  }
+  if (size <= UINT16_MAX) {
+    return packed_write_tagged(buffer, tag8 + 1, size, 2);
+  }
+  return packed_write_tagged(buffer, tag8 + 2, size, 4);
+}
+
+bool me_packed_write_nil(struct me_buffer *buffer) {
+  return packed_write_byte(buffer, 0xc0);
+}
+
+bool me_packed_write_bool(struct me_buffer *buffer, bool value) {
+  return packed_write_byte(buffer, value ? 0xc3 : 0xc2);
+}
+
+bool me_packed_write_integer(struct me_buffer *buffer, int64_t value) {
+  if (value >= 0) {
+    if (value <= 0x7f) {
+      return packed_write_byte(buffer, (uint8_t)value);
+    }
+    if (value <= UINT8_MAX) {
+      return packed_write_tagged(buffer, 0xcc, (uint64_t)value, 1);
+    }
+    if (value <= UINT16_MAX) {
+      return packed_write_tagged(buffer, 0xcd, (uint64_t)value, 2);
+    }
+    if (value <= UINT32_MAX) {
+      return packed_write_tagged(buffer, 0xce, (uint64_t)value, 4);
+    }
+    return packed_write_tagged(buffer, 0xcf, (uint64_t)value, 8);
+  }
+
+  if (value >= -32) {
+    return packed_write_byte(buffer, (uint8_t)(int8_t)value);
+  }
+  if (value >= INT8_MIN) {
+    return packed_write_tagged(buffer, 0xd0, (uint64_t)value, 1);
+  }
+  if (value >= INT16_MIN) {
+    return packed_write_tagged(buffer, 0xd1, (uint64_t)value, 2);
+  }
+  if (value >= INT32_MIN) {
+    return packed_write_tagged(buffer, 0xd2, (uint64_t)value, 4);
+  }
+  return packed_write_tagged(buffer, 0xd3, (uint64_t)value, 8);
+}
+
+bool me_packed_write_float(struct me_buffer *buffer, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return packed_write_tagged(buffer, 0xcb, bits, 8);
+}
+
+bool me_packed_write_string(struct me_buffer *buffer, const char *bytes, size_t size) {
+  bool written = size <= 31
+    ? packed_write_byte(buffer, (uint8_t)(0xa0 | size))
+    : packed_write_length(buffer, 0xd9, size);
+  return written && me_buffer_append(buffer, bytes, size);
+}
+
+bool me_packed_write_symbol(struct me_buffer *buffer, const char *bytes, size_t size) {
+  return packed_write_length(buffer, 0xc7, size) &&
+    packed_write_byte(buffer, ME_PACKED_EXT_SYMBOL) &&
+    me_buffer_append(buffer, bytes, size);
+}
+
+bool me_packed_write_array_header(struct me_buffer *buffer, size_t count) {
+  if (count <= 15) {
+    return packed_write_byte(buffer, (uint8_t)(0x90 | count));
+  }
+  if (count > UINT32_MAX) {
+    return false;
+  }
+  return count <= UINT16_MAX
+    ? packed_write_tagged(buffer, 0xdc, count, 2)
+    : packed_write_tagged(buffer, 0xdd, count, 4);
+}
+
+bool me_packed_write_map_header(struct me_buffer *buffer, size_t count) {
+  if (count <= 15) {
+    return packed_write_byte(buffer, (uint8_t)(0x80 | count));
+  }
+  if (count > UINT32_MAX) {
+    return false;
+  }
+  return count <= UINT16_MAX
+    ? packed_write_tagged(buffer, 0xde, count, 2)
+    : packed_write_tagged(buffer, 0xdf, count, 4);
+}
@@ -0,0 +1,68 @@
+#ifndef MRUBY_ENGINE_PACKED_H
+#define MRUBY_ENGINE_PACKED_H
+
+#include "buffer.h"
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The packed format is MessagePack. Symbols are an extension type, so that
+// they survive a round trip; everything else uses the standard families.
+// Strings are written as str, and bin is read back as a string too.
+#define ME_PACKED_EXT_SYMBOL 0
+
+enum me_packed_type {
+  ME_PACKED_NIL,
+  ME_PACKED_FALSE,
+  ME_PACKED_TRUE,
+  ME_PACKED_INTEGER,
+  ME_PACKED_FLOAT,
+  ME_PACKED_STRING,
+  ME_PACKED_BINARY,
+  ME_PACKED_SYMBOL,
+  ME_PACKED_ARRAY,
+  ME_PACKED_MAP,
+};
+
+struct me_packed_item {
+  enum me_packed_type type;
+  union {
+    int64_t integer;
+    double real;
+    struct {
+      const char *bytes;
+      size_t size;
+    } string;
+    // Elements of an array, pairs of a map.
+    size_t count;
+  };
+};
+
+struct me_packed_reader {
+  const uint8_t *start;
+  const uint8_t *cursor;
+  const uint8_t *end;
+};
+
+// Reads the header of the next item; the elements of arrays and maps follow
+// as separate items. Sets `err` to ME_VALUE_PACK_ERR, with the offset of the
+// item, on malformed input and to ME_VALUE_OUT_OF_RANGE on integers that do
+// not fit 64 signed bits.
+bool me_packed_read(
+  struct me_packed_reader *reader,
+  struct me_packed_item *item,
+  struct me_value_err *err);
+bool me_packed_at_end(const struct me_packed_reader *reader);
+
+// The writers return false if the buffer cannot grow.
+bool me_packed_write_nil(struct me_buffer *buffer);
+bool me_packed_write_bool(struct me_buffer *buffer, bool value);
+bool me_packed_write_integer(struct me_buffer *buffer, int64_t value);
+bool me_packed_write_float(struct me_buffer *buffer, double value);
+bool me_packed_write_string(struct me_buffer *buffer, const char *bytes, size_t size);
+bool me_packed_write_symbol(struct me_buffer *buffer, const char *bytes, size_t size);
+bool me_packed_write_array_header(struct me_buffer *buffer, size_t count);
+bool me_packed_write_map_header(struct me_buffer *buffer, size_t count);
+
+#endif
@@ -0,0 +1,76 @@
+#include "result_buffer.h"
+#include "host.h"
+#include <stdlib.h>
+
+#define RESULT_BUFFER_NODES_MIN ((size_t)64)
+
+struct me_result_buffer *me_result_buffer_new(void) {
+  struct me_result_buffer *self = me_host_malloc(sizeof(struct me_result_buffer));
+  *self = (struct me_result_buffer){ .nodes = NULL };
+  return self;
+}
+
+void me_result_buffer_destroy(struct me_result_buffer *self) {
+  free(self->nodes);
+  me_buffer_destroy(&self->bytes);
+  me_host_free(self);
+}
+
+void me_result_buffer_clear(struct me_result_buffer *self) {
+  self->node_count = 0;
+  self->bytes.size = 0;
+}
+
+bool me_result_buffer_nodes_new(struct me_result_buffer *self, size_t count, uint32_t *index) {
+  if (count > UINT32_MAX - self->node_count) {
+    return false;
+  }
+
+  if (self->node_capacity - self->node_count < count) {
+    size_t capacity = self->node_capacity ? self->node_capacity : RESULT_BUFFER_NODES_MIN;
+    while (capacity - self->node_count < count) {
+      capacity *= 2;
+    }
+    struct me_result_node *nodes = realloc(self->nodes, capacity * sizeof(struct me_result_node));
+    if (nodes == NULL) {
+      return false;
+    }
+    self->nodes = nodes;
+    self->node_capacity = capacity;
+  }
+
+  *index = (uint32_t)self->node_count;
+  self->node_count += count;
+  return true;
+}
+
+bool me_result_buffer_bytes_new(
+  struct me_result_buffer *self,
+  const char *bytes,
+  size_t size,
+  uint32_t *offset)
+{
+  if (size > UINT32_MAX - self->bytes.size) {
+    return false;
+  }
+
+  *offset = (uint32_t)self->bytes.size;
+  return me_buffer_append(&self->bytes, bytes, size);
+}
+
+const struct me_result_node *me_result_buffer_get_node(
+  const struct me_result_buffer *self,
+  size_t index)
+{
+  if (index >= self->node_count) {
+    return NULL;
+  }
+  return &self->nodes[index];
+}
+
+const char *me_result_buffer_get_bytes(
+  const struct me_result_buffer *self,
+  const struct me_result_node *node)
+{
+  return self->bytes.bytes + node->offset;
+}
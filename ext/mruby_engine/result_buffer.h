@@ -0,0 +1,75 @@
+#ifndef MRUBY_ENGINE_RESULT_BUFFER_H
+#define MRUBY_ENGINE_RESULT_BUFFER_H
+
+#include "buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A result buffer holds an extracted value as a flat table of nodes, with
+// the bytes of its strings and symbols in a separate arena. Node 0 is the
+// root. It is cleared rather than freed between extractions, so once it has
+// grown to fit the usual results, extracting into it allocates nothing.
+
+enum me_result_node_type {
+  ME_RESULT_NIL,
+  ME_RESULT_FALSE,
+  ME_RESULT_TRUE,
+  ME_RESULT_INTEGER,
+  ME_RESULT_FLOAT,
+  ME_RESULT_STRING,
+  ME_RESULT_SYMBOL,
+  ME_RESULT_ARRAY,
+  ME_RESULT_HASH,
+  ME_RESULT_DECIMAL,
+  ME_RESULT_TIME,
+  ME_RESULT_UTC_TIME,
+};
+
+// Strings, symbols and decimals are `size` bytes at `offset` in the arena,
+// decimals in the form written by me_value_guest_decimal_to_s. Arrays are
+// `size` consecutive nodes starting at `first`; hashes `size` consecutive
+// key/value pairs, so `2 * size` nodes. Times are `integer` seconds since the
+// epoch and `size` microseconds.
+struct me_result_node {
+  enum me_result_node_type type;
+  uint32_t size;
+  union {
+    int64_t integer;
+    double real;
+    uint32_t offset;
+    uint32_t first;
+  };
+};
+
+struct me_result_buffer {
+  struct me_result_node *nodes;
+  size_t node_count;
+  size_t node_capacity;
+  struct me_buffer bytes;
+};
+
+struct me_result_buffer *me_result_buffer_new(void);
+void me_result_buffer_destroy(struct me_result_buffer *self);
+
+// Forgets the current result, keeping the memory for the next one.
+void me_result_buffer_clear(struct me_result_buffer *self);
+
+// Both return false if the buffer cannot grow. Pointers to nodes are
+// invalidated by the next reservation; hold on to indices instead.
+bool me_result_buffer_nodes_new(struct me_result_buffer *self, size_t count, uint32_t *index);
+bool me_result_buffer_bytes_new(
+  struct me_result_buffer *self,
+  const char *bytes,
+  size_t size,
+  uint32_t *offset);
+
+// Returns NULL if there is no such node.
+const struct me_result_node *me_result_buffer_get_node(
+  const struct me_result_buffer *self,
+  size_t index);
+const char *me_result_buffer_get_bytes(
+  const struct me_result_buffer *self,
+  const struct me_result_node *node);
+
+#endif
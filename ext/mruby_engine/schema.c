@@ -0,0 +1,55 @@
+#include "schema.h"
+#include "host.h"
+#include <stdlib.h>
+
+struct me_schema *me_schema_new(void) {
+  struct me_schema *self = me_host_malloc(sizeof(struct me_schema));
+  *self = (struct me_schema){ .nodes = NULL };
+  return self;
+}
+
+void me_schema_destroy(struct me_schema *self) {
+  free(self->nodes);
+  free(self->fields);
+  me_host_free(self);
+}
+
+static bool me_schema_entries_new(
+  void **entries,
+  size_t *size,
+  size_t entry_size,
+  size_t count,
+  uint32_t *index)
+{
+  if (count > UINT32_MAX - *size) {
+    return false;
+  }
+
+  void *grown = realloc(*entries, (*size + count) * entry_size);
+  if (grown == NULL && *size + count > 0) {
+    return false;
+  }
+
+  *entries = grown;
+  *index = (uint32_t)*size;
+  *size += count;
+  return true;
+}
+
+bool me_schema_nodes_new(struct me_schema *self, size_t count, uint32_t *index) {
+  return me_schema_entries_new(
+    (void **)&self->nodes,
+    &self->node_count,
+    sizeof(struct me_schema_node),
+    count,
+    index);
+}
+
+bool me_schema_fields_new(struct me_schema *self, size_t count, uint32_t *index) {
+  return me_schema_entries_new(
+    (void **)&self->fields,
+    &self->field_count,
+    sizeof(struct me_schema_field),
+    count,
+    index);
+}
@@ -0,0 +1,63 @@
+#ifndef MRUBY_ENGINE_SCHEMA_H
+#define MRUBY_ENGINE_SCHEMA_H
+
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A schema describes the shape of values that get injected over and over,
+// compiled into a flat table of nodes. Node 0 is the root; containers refer
+// to their children by index. Injecting with a schema skips the type dispatch
+// for every node that matches, and converts any node that does not the
+// generic way.
+
+enum me_schema_node_type {
+  ME_SCHEMA_ANY,
+  ME_SCHEMA_BOOLEAN,
+  ME_SCHEMA_INTEGER,
+  ME_SCHEMA_STRING,
+  ME_SCHEMA_SYMBOL,
+  ME_SCHEMA_ARRAY,
+  ME_SCHEMA_HASH,
+};
+
+struct me_schema_node {
+  enum me_schema_node_type type;
+  union {
+    struct {
+      uint32_t element;
+    } array;
+    // Fields are `size` consecutive entries starting at `fields`.
+    struct {
+      uint32_t fields;
+      uint32_t size;
+    } hash;
+  };
+};
+
+// `key` is a frozen host string or a static host symbol, kept alive by the
+// owner of the schema. `symbol_id` is the ID of a symbol key, zero otherwise.
+struct me_schema_field {
+  me_host_value_t key;
+  me_host_value_t symbol_id;
+  uint32_t node;
+};
+
+struct me_schema {
+  struct me_schema_node *nodes;
+  size_t node_count;
+  struct me_schema_field *fields;
+  size_t field_count;
+};
+
+struct me_schema *me_schema_new(void);
+void me_schema_destroy(struct me_schema *self);
+
+// Both reserve `count` consecutive entries and return the index of the first
+// one. They return false if the table cannot grow. Pointers to entries are
+// invalidated by the next reservation; hold on to indices instead.
+bool me_schema_nodes_new(struct me_schema *self, size_t count, uint32_t *index);
+bool me_schema_fields_new(struct me_schema *self, size_t count, uint32_t *index);
+
+#endif
@@ -0,0 +1,208 @@
+#include "shared_segment.h"
+#include "host.h"
+#include <string.h>
+
+// Smaller hashes are searched key by key, which is as fast for the records
+// payloads are mostly made of. Larger ones get an open-addressing index of
+// pair positions plus one, twice as large as the hash and zero when free,
+// stored right after their pairs.
+#define SHARED_HASH_INDEX_MIN ((size_t)8)
+
+struct me_shared_segment {
+  struct me_memory_pool *pool;
+  struct me_shared_node *root;
+  bool sealed;
+};
+
+struct me_shared_segment *me_shared_segment_new(
+  size_t capacity,
+  struct me_memory_pool_err *err)
+{
+  struct me_memory_pool *pool = me_memory_pool_new(capacity, ME_MEMORY_POOL_ARENA, err);
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  struct me_shared_segment *self = me_host_malloc(sizeof(struct me_shared_segment));
+  *self = (struct me_shared_segment){
+    .pool = pool,
+    .root = NULL,
+    .sealed = false,
+  };
+  return self;
+}
+
+void me_shared_segment_destroy(struct me_shared_segment *self) {
+  me_memory_pool_destroy(self->pool);
+  me_host_free(self);
+}
+
+struct me_shared_node *me_shared_segment_nodes_new(
+  struct me_shared_segment *self,
+  size_t count)
+{
+  if (count == 0) {
+    return NULL;
+  }
+
+  struct me_shared_node *nodes = me_memory_pool_malloc(self->pool, count * sizeof(struct me_shared_node));
+  if (nodes != NULL) {
+    memset(nodes, 0, count * sizeof(struct me_shared_node));
+  }
+  return nodes;
+}
+
+static size_t shared_hash_index_capacity(size_t size) {
+  if (size < SHARED_HASH_INDEX_MIN || size > UINT32_MAX / 4) {
+    return 0;
+  }
+  size_t capacity = SHARED_HASH_INDEX_MIN;
+  while (capacity < 2 * size) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+static uint32_t *shared_hash_index(const struct me_shared_node *hash, size_t *capacity) {
+  *capacity = shared_hash_index_capacity(hash->children.size);
+  if (*capacity == 0) {
+    return NULL;
+  }
+  return (uint32_t *)(hash->children.nodes + 2 * hash->children.size);
+}
+
+static uint64_t shared_key_hash(const struct me_shared_key *key) {
+  uint64_t h = UINT64_C(0xcbf29ce484222325) ^ (uint64_t)key->type;
+  if (key->type == ME_SHARED_FIXNUM) {
+    h = (h ^ (uint64_t)key->fixnum) * UINT64_C(0x100000001b3);
+  } else if (key->type == ME_SHARED_STRING || key->type == ME_SHARED_SYMBOL) {
+    for (size_t i = 0; i < key->size; ++i) {
+      h = (h ^ (unsigned char)key->bytes[i]) * UINT64_C(0x100000001b3);
+    }
+  }
+  return h ^ (h >> 32);
+}
+
+static struct me_shared_key shared_node_key(const struct me_shared_node *node) {
+  struct me_shared_key key = (struct me_shared_key){ .type = node->type };
+  if (node->type == ME_SHARED_FIXNUM) {
+    key.fixnum = node->fixnum;
+  } else if (node->type == ME_SHARED_STRING || node->type == ME_SHARED_SYMBOL) {
+    key.bytes = node->string.bytes;
+    key.size = node->string.size;
+  }
+  return key;
+}
+
+static bool shared_key_eq(const struct me_shared_node *node, const struct me_shared_key *key) {
+  if (node->type != key->type) {
+    return false;
+  }
+  switch (node->type) {
+  case ME_SHARED_FIXNUM:
+    return node->fixnum == key->fixnum;
+  case ME_SHARED_STRING:
+  case ME_SHARED_SYMBOL:
+    return node->string.size == key->size && memcmp(node->string.bytes, key->bytes, key->size) == 0;
+  default:
+    return true;
+  }
+}
+
+static size_t shared_hash_bytes(size_t size) {
+  return 2 * size * sizeof(struct me_shared_node) + shared_hash_index_capacity(size) * sizeof(uint32_t);
+}
+
+struct me_shared_node *me_shared_segment_hash_new(
+  struct me_shared_segment *self,
+  size_t size)
+{
+  if (size == 0) {
+    return NULL;
+  }
+
+  size_t bytes = shared_hash_bytes(size);
+  struct me_shared_node *pairs = me_memory_pool_malloc(self->pool, bytes);
+  if (pairs != NULL) {
+    memset(pairs, 0, bytes);
+  }
+  return pairs;
+}
+
+// Keys already in the index are skipped, so that lookups find the first of
+// several equal keys, as a search key by key would.
+void me_shared_segment_hash_index(struct me_shared_node *hash) {
+  size_t capacity;
+  uint32_t *index = shared_hash_index(hash, &capacity);
+  if (index == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < hash->children.size; ++i) {
+    struct me_shared_key key = shared_node_key(&hash->children.nodes[2 * i]);
+    size_t slot = shared_key_hash(&key) & (capacity - 1);
+    while (index[slot] != 0 && !shared_key_eq(&hash->children.nodes[2 * (index[slot] - 1)], &key)) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    if (index[slot] == 0) {
+      index[slot] = (uint32_t)(i + 1);
+    }
+  }
+}
+
+long me_shared_hash_find(const struct me_shared_node *hash, const struct me_shared_key *key) {
+  size_t capacity;
+  const uint32_t *index = shared_hash_index(hash, &capacity);
+  if (index == NULL) {
+    for (size_t i = 0; i < hash->children.size; ++i) {
+      if (shared_key_eq(&hash->children.nodes[2 * i], key)) {
+        return (long)i;
+      }
+    }
+    return -1;
+  }
+
+  for (size_t slot = shared_key_hash(key) & (capacity - 1); index[slot] != 0; slot = (slot + 1) & (capacity - 1)) {
+    long i = (long)index[slot] - 1;
+    if (shared_key_eq(&hash->children.nodes[2 * i], key)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const char *me_shared_segment_bytes_new(
+  struct me_shared_segment *self,
+  const char *bytes,
+  size_t size)
+{
+  // Keep a terminating NUL so guest code handing the string to C functions
+  // expecting one does not read past the end.
+  char *copy = me_memory_pool_malloc(self->pool, size + 1);
+  if (copy != NULL) {
+    memcpy(copy, bytes, size);
+    copy[size] = '\0';
+  }
+  return copy;
+}
+
+int me_shared_segment_seal(
+  struct me_shared_segment *self,
+  struct me_shared_node *root)
+{
+  self->root = root;
+  self->sealed = true;
+  return me_memory_pool_protect(self->pool);
+}
+
+bool me_shared_segment_sealed_p(struct me_shared_segment *self) {
+  return self->sealed;
+}
+
+const struct me_shared_node *me_shared_segment_get_root(struct me_shared_segment *self) {
+  return self->root;
+}
+
+size_t me_shared_segment_get_size(struct me_shared_segment *self) {
+  return me_memory_pool_get_usage(self->pool);
+}
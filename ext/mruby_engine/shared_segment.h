@@ -0,0 +1,83 @@
+#ifndef MRUBY_ENGINE_SHARED_SEGMENT_H
+#define MRUBY_ENGINE_SHARED_SEGMENT_H
+
+#include "memory_pool.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A shared segment holds a data structure built once, outside of any engine,
+// and then made read-only. Engines materialize it without copying string
+// contents: their strings point straight into the segment.
+
+enum me_shared_node_type {
+  ME_SHARED_NIL,
+  ME_SHARED_FALSE,
+  ME_SHARED_TRUE,
+  ME_SHARED_FIXNUM,
+  ME_SHARED_STRING,
+  ME_SHARED_SYMBOL,
+  ME_SHARED_ARRAY,
+  ME_SHARED_HASH,
+};
+
+// Arrays point to `size` consecutive nodes; hashes to `size` consecutive
+// key/value pairs, so `2 * size` nodes.
+struct me_shared_node {
+  enum me_shared_node_type type;
+  union {
+    long fixnum;
+    struct {
+      const char *bytes;
+      size_t size;
+    } string;
+    struct {
+      struct me_shared_node *nodes;
+      size_t size;
+    } children;
+  };
+};
+
+// A key to look up in a hash node. Only `fixnum` or `bytes` and `size` are
+// set, depending on `type`.
+struct me_shared_key {
+  enum me_shared_node_type type;
+  long fixnum;
+  const char *bytes;
+  size_t size;
+};
+
+struct me_shared_segment;
+
+struct me_shared_segment *me_shared_segment_new(
+  size_t capacity,
+  struct me_memory_pool_err *err);
+void me_shared_segment_destroy(struct me_shared_segment *self);
+
+struct me_shared_node *me_shared_segment_nodes_new(
+  struct me_shared_segment *self,
+  size_t count);
+// Reserves the pairs of a hash of `size` entries, followed by room for an
+// index over its keys when it is large enough to need one. The index is
+// written by me_shared_segment_hash_index once the keys are in place.
+struct me_shared_node *me_shared_segment_hash_new(
+  struct me_shared_segment *self,
+  size_t size);
+void me_shared_segment_hash_index(struct me_shared_node *hash);
+
+// The position of the pair whose key is `key` in `hash`, or -1.
+long me_shared_hash_find(const struct me_shared_node *hash, const struct me_shared_key *key);
+
+const char *me_shared_segment_bytes_new(
+  struct me_shared_segment *self,
+  const char *bytes,
+  size_t size);
+int me_shared_segment_seal(
+  struct me_shared_segment *self,
+  struct me_shared_node *root);
+
+bool me_shared_segment_sealed_p(struct me_shared_segment *self);
+const struct me_shared_node *me_shared_segment_get_root(struct me_shared_segment *self);
+size_t me_shared_segment_get_size(struct me_shared_segment *self);
+
+#endif
@@ -0,0 +1,79 @@
+#include "symbol_cache.h"
+#include <stdlib.h>
+
+#define SYMBOL_CACHE_CAPACITY_MIN ((size_t)64)
+
+struct me_symbol_cache_entry {
+  uint64_t key;
+  uint64_t value;
+};
+
+// Fibonacci hashing: keys are small, dense integers on both sides.
+static size_t symbol_cache_slot(uint64_t key, size_t capacity) {
+  return (size_t)((key * UINT64_C(11400714819323198485)) >> 32) & (capacity - 1);
+}
+
+static struct me_symbol_cache_entry *symbol_cache_find(
+  struct me_symbol_cache_entry *entries,
+  size_t capacity,
+  uint64_t key)
+{
+  size_t slot = symbol_cache_slot(key, capacity);
+  while (entries[slot].key != 0 && entries[slot].key != key) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  return &entries[slot];
+}
+
+static bool symbol_cache_grow(struct me_symbol_cache *self) {
+  size_t capacity = self->capacity ? self->capacity * 2 : SYMBOL_CACHE_CAPACITY_MIN;
+  struct me_symbol_cache_entry *entries = calloc(capacity, sizeof(struct me_symbol_cache_entry));
+  if (entries == NULL) {
+    return false;
+  }
+
+  for (size_t i = 0; i < self->capacity; ++i) {
+    if (self->entries[i].key != 0) {
+      *symbol_cache_find(entries, capacity, self->entries[i].key) = self->entries[i];
+    }
+  }
+  free(self->entries);
+  self->entries = entries;
+  self->capacity = capacity;
+  return true;
+}
+
+bool me_symbol_cache_get(const struct me_symbol_cache *self, uint64_t key, uint64_t *value) {
+  if (self->size == 0) {
+    return false;
+  }
+
+  struct me_symbol_cache_entry *entry = symbol_cache_find(self->entries, self->capacity, key);
+  if (entry->key == 0) {
+    return false;
+  }
+  *value = entry->value;
+  return true;
+}
+
+// The cache is only an accelerator: when it is full or cannot grow, the
+// entry is simply dropped.
+void me_symbol_cache_put(struct me_symbol_cache *self, uint64_t key, uint64_t value) {
+  if (self->size >= ME_SYMBOL_CACHE_SIZE_MAX) {
+    return;
+  }
+  if (2 * (self->size + 1) > self->capacity && !symbol_cache_grow(self)) {
+    return;
+  }
+
+  struct me_symbol_cache_entry *entry = symbol_cache_find(self->entries, self->capacity, key);
+  if (entry->key == 0) {
+    ++self->size;
+  }
+  *entry = (struct me_symbol_cache_entry){ .key = key, .value = value };
+}
+
+void me_symbol_cache_destroy(struct me_symbol_cache *self) {
+  free(self->entries);
+  *self = (struct me_symbol_cache){ .entries = NULL };
+}
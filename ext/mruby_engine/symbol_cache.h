@@ -0,0 +1,27 @@
+#ifndef MRUBY_ENGINE_SYMBOL_CACHE_H
+#define MRUBY_ENGINE_SYMBOL_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Maps symbols of one side to those of the other, so that converting a
+// symbol seen before skips both name lookups. Neither side ever frees a
+// symbol once interned (host IDs are immortal, mruby has no symbol GC), so
+// entries never go stale. Zero is not a valid key.
+//
+// The table is allocated with the system allocator and stops accepting new
+// entries once it holds ME_SYMBOL_CACHE_SIZE_MAX of them.
+struct me_symbol_cache {
+  struct me_symbol_cache_entry *entries;
+  size_t size;
+  size_t capacity;
+};
+
+#define ME_SYMBOL_CACHE_SIZE_MAX ((size_t)4096)
+
+bool me_symbol_cache_get(const struct me_symbol_cache *self, uint64_t key, uint64_t *value);
+void me_symbol_cache_put(struct me_symbol_cache *self, uint64_t key, uint64_t value);
+void me_symbol_cache_destroy(struct me_symbol_cache *self);
+
+#endif
@@ -0,0 +1,118 @@
+#include "tracker.h"
+#include <stdlib.h>
+
+#define TRACKER_CAPACITY_MIN ((size_t)256)
+
+struct me_tracker_entry {
+  uint64_t object;
+  uint64_t digest;
+  uint64_t owner;
+};
+
+struct me_tracker_root {
+  uint64_t owner;
+  uint64_t value;
+};
+
+static size_t tracker_slot(uint64_t object, size_t capacity) {
+  return (size_t)((object * UINT64_C(11400714819323198485)) >> 32) & (capacity - 1);
+}
+
+static struct me_tracker_entry *tracker_find(
+  struct me_tracker_entry *entries,
+  size_t capacity,
+  uint64_t object)
+{
+  size_t slot = tracker_slot(object, capacity);
+  while (entries[slot].object != 0 && entries[slot].object != object) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  return &entries[slot];
+}
+
+// Rehashes every entry that does not belong to `dropped_owner` (zero keeps
+// them all) into a table of `capacity` slots.
+static bool tracker_rehash(struct me_tracker *self, size_t capacity, uint64_t dropped_owner) {
+  struct me_tracker_entry *entries = calloc(capacity, sizeof(struct me_tracker_entry));
+  if (entries == NULL) {
+    return false;
+  }
+
+  size_t size = 0;
+  for (size_t i = 0; i < self->capacity; ++i) {
+    struct me_tracker_entry *entry = &self->entries[i];
+    if (entry->object != 0 && (dropped_owner == 0 || entry->owner != dropped_owner)) {
+      *tracker_find(entries, capacity, entry->object) = *entry;
+      ++size;
+    }
+  }
+  free(self->entries);
+  self->entries = entries;
+  self->size = size;
+  self->capacity = capacity;
+  return true;
+}
+
+bool me_tracker_track(struct me_tracker *self, uint64_t owner, uint64_t root) {
+  for (size_t i = 0; i < self->root_count; ++i) {
+    if (self->roots[i].owner == owner) {
+      self->roots[i].value = root;
+      return self->capacity == 0 || tracker_rehash(self, self->capacity, owner);
+    }
+  }
+
+  struct me_tracker_root *roots = realloc(
+    self->roots,
+    (self->root_count + 1) * sizeof(struct me_tracker_root));
+  if (roots == NULL) {
+    return false;
+  }
+  roots[self->root_count++] = (struct me_tracker_root){ .owner = owner, .value = root };
+  self->roots = roots;
+  return true;
+}
+
+bool me_tracker_put(struct me_tracker *self, uint64_t owner, uint64_t object, uint64_t digest) {
+  if (2 * (self->size + 1) > self->capacity) {
+    size_t capacity = self->capacity ? self->capacity * 2 : TRACKER_CAPACITY_MIN;
+    if (!tracker_rehash(self, capacity, 0)) {
+      return false;
+    }
+  }
+
+  struct me_tracker_entry *entry = tracker_find(self->entries, self->capacity, object);
+  if (entry->object == 0) {
+    ++self->size;
+  }
+  *entry = (struct me_tracker_entry){ .object = object, .digest = digest, .owner = owner };
+  return true;
+}
+
+bool me_tracker_get_root(const struct me_tracker *self, uint64_t owner, uint64_t *root) {
+  for (size_t i = 0; i < self->root_count; ++i) {
+    if (self->roots[i].owner == owner) {
+      *root = self->roots[i].value;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool me_tracker_get_digest(const struct me_tracker *self, uint64_t object, uint64_t *digest) {
+  if (self->size == 0) {
+    return false;
+  }
+
+  struct me_tracker_entry *entry = tracker_find(self->entries, self->capacity, object);
+  if (entry->object == 0) {
+    return false;
+  }
+  *digest = entry->digest;
+  return true;
+}
+
+void me_tracker_destroy(struct me_tracker *self) {
+  free(self->entries);
+  free(self->roots);
+  *self = (struct me_tracker){ .entries = NULL };
+}
@@ -0,0 +1,30 @@
+#ifndef MRUBY_ENGINE_TRACKER_H
+#define MRUBY_ENGINE_TRACKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Remembers a digest of every guest object injected with tracking, so that
+// extraction can tell which ones were written to since. Objects are looked
+// up by address and never dereferenced, so entries left behind by collected
+// objects are harmless. Each injected value has an owner (its instance
+// variable); injecting again for the same owner drops the previous entries.
+//
+// The tables are allocated with the system allocator. Functions returning
+// bool return false if a table cannot grow.
+struct me_tracker {
+  struct me_tracker_entry *entries;
+  size_t size;
+  size_t capacity;
+  struct me_tracker_root *roots;
+  size_t root_count;
+};
+
+bool me_tracker_track(struct me_tracker *self, uint64_t owner, uint64_t root);
+bool me_tracker_put(struct me_tracker *self, uint64_t owner, uint64_t object, uint64_t digest);
+bool me_tracker_get_root(const struct me_tracker *self, uint64_t owner, uint64_t *root);
+bool me_tracker_get_digest(const struct me_tracker *self, uint64_t object, uint64_t *digest);
+void me_tracker_destroy(struct me_tracker *self);
+
+#endif
@@ -1,10 +1,16 @@
 #ifndef MRUBY_ENGINE_VALUE_H
 #define MRUBY_ENGINE_VALUE_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 struct me_mruby_engine;
+struct me_buffer;
+struct me_result_buffer;
+struct me_shared_segment;
+struct me_shared_node;
+struct me_schema;
 
 typedef intptr_t me_host_value_t;
 typedef me_host_value_t me_host_exception_t;
@@ -27,6 +33,13 @@ enum me_value_err_type {
   ME_VALUE_OUT_OF_RANGE,
   ME_VALUE_TOO_DEEP,
   ME_VALUE_GUEST_ERR,
+  ME_VALUE_SEGMENT_FULL,
+  ME_VALUE_PARSE_ERR,
+  ME_VALUE_NO_MEMORY,
+  ME_VALUE_PACK_ERR,
+  ME_VALUE_NOT_TRACKED,
+  ME_VALUE_BAD_PATCH,
+  ME_VALUE_HOST_ERR,
 };
 
 struct me_value_err {
@@ -35,6 +48,18 @@ struct me_value_err {
     struct {
       me_host_exception_t err;
     } guest_err;
+    struct {
+      size_t offset;
+    } parse_err;
+    // The index of the operation that did not apply.
+    struct {
+      size_t op;
+    } patch_err;
+    // The tag of a jump out of host code, caught so that it does not cross
+    // the guest's protect scope, and resumed once the guest is left.
+    struct {
+      int state;
+    } host_err;
   };
 };
 
@@ -43,9 +68,146 @@ me_host_value_t me_value_to_host(
   me_guest_value_t value,
   struct me_value_err *err);
 
+// Records digests of `value` and everything it holds, on behalf of `owner`,
+// replacing what was recorded for it before. Does not allocate in the guest
+// and does not touch the host.
+void me_value_guest_track(
+  struct me_mruby_engine *engine,
+  uint64_t owner,
+  me_guest_value_t value,
+  struct me_value_err *err);
+
+// Freezes `value` and the strings, arrays and hashes it holds, so that
+// scripts cannot change them. `value` must come straight from a conversion,
+// which bounds how deeply it nests. Does not allocate.
+void me_value_guest_freeze_deep(me_guest_value_t value);
+
+// Compares `value` against what was recorded for `owner` and converts only
+// the containers and strings that changed, or were not there then, as
+// [path, value] pairs. The subtree of a changed container is converted as a
+// whole.
+me_host_value_t me_value_to_host_changes(
+  struct me_mruby_engine *engine,
+  uint64_t owner,
+  me_guest_value_t value,
+  struct me_value_err *err);
+
+enum me_value_path_step_type {
+  ME_VALUE_PATH_STRING,
+  ME_VALUE_PATH_SYMBOL,
+  ME_VALUE_PATH_INDEX,
+  ME_VALUE_PATH_WILDCARD,
+};
+
+// A step looks up a string or symbol key in a hash, or an index in an
+// array. A wildcard applies the rest of the path to every element of an
+// array, or every value of a hash, and collects the results in an array.
+struct me_value_path_step {
+  enum me_value_path_step_type type;
+  union {
+    struct {
+      const char *bytes;
+      size_t size;
+    } key;
+    long index;
+  };
+};
+
+struct me_value_path {
+  const struct me_value_path_step *steps;
+  size_t size;
+};
+
+// Converts only the parts of `value` selected by the path. Anything missing
+// along the way selects nil, and nothing but the selected subtrees counts
+// towards the depth limit.
+me_host_value_t me_value_to_host_path(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value,
+  const struct me_value_path_step *steps,
+  size_t size,
+  struct me_value_err *err);
+
+enum me_value_patch_op_type {
+  ME_VALUE_PATCH_SET,
+  ME_VALUE_PATCH_INSERT,
+  ME_VALUE_PATCH_DELETE,
+};
+
+// Every step of the path but the last must lead to an existing array element
+// or hash value; the last one names the place the operation applies to. Set
+// replaces or adds a hash value, or replaces an array element or appends one
+// right after the last. Insert places an element before an array index, or at
+// the end. Delete removes an existing array element or hash key. Paths have
+// at least one step and no wildcards.
+struct me_value_patch_op {
+  enum me_value_patch_op_type type;
+  struct me_value_path path;
+  // Ignored by delete.
+  me_host_value_t value;
+};
+
+// Applies `op` to `root`, `value` being its converted value. Sets `err` to
+// ME_VALUE_BAD_PATCH if the path does not lead to a place the operation
+// applies to. Must run inside a protect scope and does not touch the host.
+void me_value_guest_patch(
+  struct me_mruby_engine *engine,
+  me_guest_value_t root,
+  const struct me_value_patch_op *op,
+  me_guest_value_t value,
+  struct me_value_err *err);
+
+// `schema` may be NULL for a value of unknown shape.
 me_guest_value_t me_value_to_guest(
   struct me_mruby_engine *engine,
+  const struct me_schema *schema,
+  me_host_value_t value,
+  struct me_value_err *err);
+
+// Converts `count` values in a single protect scope, into a guest array.
+me_guest_value_t me_value_to_guest_all(
+  struct me_mruby_engine *engine,
+  const me_host_value_t *values,
+  size_t count,
+  struct me_value_err *err);
+
+void me_value_to_shared(
+  struct me_shared_segment *segment,
+  me_host_value_t value,
+  struct me_shared_node *node,
+  struct me_value_err *err);
+
+
+me_guest_value_t me_value_guest_from_shared(
+  struct me_mruby_engine *engine,
+  const struct me_shared_node *node,
+  struct me_value_err *err);
+
+// Exposes the arrays and hashes of a shared segment through proxies that
+// materialize their elements on first access; see value_lazy.c.
+me_guest_value_t me_value_guest_lazy(
+  struct me_mruby_engine *engine,
+  const struct me_shared_node *node,
+  struct me_value_err *err);
+// The node behind a lazy proxy, or NULL if `value` is not one.
+const struct me_shared_node *me_value_guest_lazy_node(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value);
+me_host_value_t me_value_lazy_to_host(
+  struct me_mruby_engine *engine,
+  const struct me_shared_node *node,
+  int depth,
+  struct me_value_err *err);
+
+// Packed (MessagePack) encoding of host values, see packed.h. Packing writes
+// into `buffer`, replacing its contents.
+void me_value_host_pack(
   me_host_value_t value,
+  struct me_buffer *buffer,
+  struct me_value_err *err);
+me_host_value_t me_value_host_unpack(
+  const char *bytes,
+  size_t size,
   struct me_value_err *err);
 
 me_host_value_t me_value_host_fixnum_new(
@@ -59,12 +221,37 @@ me_host_value_t me_value_host_symbol_new(
   const char *bytes,
   size_t size,
   struct me_value_err *err);
+// Host symbols are passed around as their ID. `bytes` stays valid for as
+// long as the ID, which is forever.
+void me_value_host_symbol_name(
+  me_host_value_t id,
+  const char **bytes,
+  size_t *size);
+me_host_value_t me_value_host_symbol_from_id(me_host_value_t id);
+me_host_value_t me_value_host_symbol_to_id(me_host_value_t symbol);
+me_host_value_t me_value_host_float_new(
+  double value,
+  struct me_value_err *err);
+// `bytes` is a decimal string as understood by BigDecimal(), which the
+// application must have loaded. Host exceptions are reported as
+// ME_VALUE_HOST_ERR.
+me_host_value_t me_value_host_decimal_new(
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err);
+me_host_value_t me_value_host_time_new(
+  int64_t seconds,
+  long microseconds,
+  bool utc,
+  struct me_value_err *err);
 me_host_value_t me_value_host_array_new(
   struct me_value_err *err);
 void me_value_host_array_push(
   me_host_value_t array,
   me_host_value_t element,
   struct me_value_err *err);
+void me_value_host_array_pop(
+  me_host_value_t array);
 me_host_value_t me_value_host_hash_new(
   struct me_value_err *err);
 void me_value_host_hash_assoc(
@@ -73,6 +260,122 @@ void me_value_host_hash_assoc(
   me_host_value_t value,
   struct me_value_err *err);
 
+typedef me_guest_value_t (*me_value_guest_body_t)(
+  struct me_mruby_engine *engine,
+  void *data,
+  struct me_value_err *err);
+
+// The guest constructors below do not check for guest exceptions themselves:
+// they must be called from a `body` run by me_value_guest_protect, which
+// catches any exception once for the whole conversion and reports it in
+// `err`. Allocation failures inside the scope surface as a memory quota
+// error rather than aborting an evaluation. The result is left protected in
+// the arena: callers save the arena index before the scope and restore it
+// once the result is stored.
+me_guest_value_t me_value_guest_protect(
+  struct me_mruby_engine *engine,
+  me_value_guest_body_t body,
+  void *data,
+  struct me_value_err *err);
+
+// Same as me_value_guest_protect, but safe to call without the GVL: a guest
+// error is left pending in `err` until me_value_guest_take_exception is
+// called with the GVL held.
+me_guest_value_t me_value_guest_try(
+  struct me_mruby_engine *engine,
+  me_value_guest_body_t body,
+  void *data,
+  struct me_value_err *err);
+void me_value_guest_take_exception(
+  struct me_mruby_engine *engine,
+  struct me_value_err *err);
+
+// Parses `size` bytes of JSON straight into guest values. Must run inside a
+// protect scope; does not touch the host.
+me_guest_value_t me_value_guest_parse_json(
+  struct me_mruby_engine *engine,
+  const char *json,
+  size_t size,
+  struct me_value_err *err);
+
+// Defines the guest's JSON module, whose parse and generate are the two
+// functions here, charged against the instruction quota by size.
+void me_value_guest_define_json(struct me_mruby_engine *engine);
+
+struct me_json_options {
+  // Significant digits for floats; zero picks the shortest that round-trips.
+  int float_precision;
+  // Decimals are written as strings unless this is set.
+  bool decimal_as_number;
+};
+
+// Writes the decimal `value` into `bytes`, which must hold
+// ME_VALUE_DECIMAL_STRING_MAX bytes, the way Decimal#to_s does, but read
+// straight from its data so that scripts cannot redefine what is written.
+// Exponents too large for the plain form are written in scientific notation.
+// Returns false if `value` is not a decimal.
+bool me_value_guest_decimal_to_s(
+  me_guest_value_t value,
+  char *bytes,
+  size_t *size,
+  struct me_value_err *err);
+
+// Reads the time `value` straight from its data, reporting
+// ME_VALUE_OUT_OF_RANGE as extraction would. Times not in UTC are local.
+// Returns false if `value` is not a time.
+bool me_value_guest_time_get(
+  me_guest_value_t value,
+  int64_t *seconds,
+  long *microseconds,
+  bool *utc,
+  struct me_value_err *err);
+
+// Writes `value` as JSON into `buffer`, replacing its contents. Must run
+// inside a protect scope; does not touch the host.
+void me_value_guest_generate_json(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value,
+  const struct me_json_options *options,
+  struct me_buffer *buffer,
+  struct me_value_err *err);
+
+// Same as the host versions, for guest values. Both must run inside a
+// protect scope and do not touch the host.
+void me_value_guest_pack(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value,
+  struct me_buffer *buffer,
+  struct me_value_err *err);
+me_guest_value_t me_value_guest_unpack(
+  struct me_mruby_engine *engine,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err);
+
+// Replaces the contents of `buffer` with `value`, or clears it on error.
+// Must run inside a protect scope and does not touch the host.
+void me_value_guest_to_result(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value,
+  struct me_result_buffer *buffer,
+  struct me_value_err *err);
+
+struct me_value_guest_pair {
+  int64_t index;
+  me_guest_value_t key;
+  me_guest_value_t value;
+};
+
+// Lists the pairs of a guest hash in insertion order, in a buffer from the
+// system allocator that the caller frees (NULL for an empty hash). Returns
+// false if the buffer cannot be allocated. Does not allocate in the engine's
+// pool and does not touch the host.
+bool me_value_guest_hash_pairs(
+  struct me_mruby_engine *engine,
+  me_guest_value_t hash,
+  struct me_value_guest_pair **pairs,
+  size_t *count);
+
 me_guest_value_t me_value_guest_nil_new(void);
 me_guest_value_t me_value_guest_false_new(void);
 me_guest_value_t me_value_guest_true_new(void);
@@ -80,19 +383,56 @@ me_guest_value_t me_value_guest_fixnum_new(
   struct me_mruby_engine *engine,
   long value,
   struct me_value_err *err);
+me_guest_value_t me_value_guest_float_new(
+  struct me_mruby_engine *engine,
+  double value,
+  struct me_value_err *err);
+// Build the objects through the C constructors of mruby-mpdecimal and
+// mruby-time, so scripts redefining Decimal.new, Time.at or Time#utc have no
+// effect on them.
+me_guest_value_t me_value_guest_decimal_new(
+  struct me_mruby_engine *engine,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err);
+me_guest_value_t me_value_guest_time_new(
+  struct me_mruby_engine *engine,
+  int64_t seconds,
+  long microseconds,
+  bool utc,
+  struct me_value_err *err);
 me_guest_value_t me_value_guest_string_new(
   struct me_mruby_engine *engine,
   const char *bytes,
   size_t size,
   struct me_value_err *err);
+// Points the guest string at the bytes of the frozen host `string` if the
+// injection under way borrows strings, and copies them otherwise. mruby
+// copies a borrowed string's bytes into the pool on its first write.
+me_guest_value_t me_value_guest_string_borrow(
+  struct me_mruby_engine *engine,
+  me_host_value_t string,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err);
 me_guest_value_t me_value_guest_symbol_new(
   struct me_mruby_engine *engine,
   const char *bytes,
   size_t size,
   struct me_value_err *err);
+// Goes through the engine's symbol cache, interning the host symbol's name
+// only the first time it is seen.
+me_guest_value_t me_value_guest_symbol_from_host(
+  struct me_mruby_engine *engine,
+  me_host_value_t id,
+  struct me_value_err *err);
 me_guest_value_t me_value_guest_array_new(
   struct me_mruby_engine *engine,
   struct me_value_err *err);
+me_guest_value_t me_value_guest_array_new_capa(
+  struct me_mruby_engine *engine,
+  size_t capacity,
+  struct me_value_err *err);
 void me_value_guest_array_push(
   struct me_mruby_engine *engine,
   me_guest_value_t array,
@@ -101,6 +441,10 @@ void me_value_guest_array_push(
 me_guest_value_t me_value_guest_hash_new(
   struct me_mruby_engine *engine,
   struct me_value_err *err);
+me_guest_value_t me_value_guest_hash_new_capa(
+  struct me_mruby_engine *engine,
+  size_t capacity,
+  struct me_value_err *err);
 void me_value_guest_hash_assoc(
   struct me_mruby_engine *engine,
   me_guest_value_t hash,
@@ -108,6 +452,27 @@ void me_value_guest_hash_assoc(
   me_guest_value_t value,
   struct me_value_err *err);
 
+// The default nesting limit for injected and extracted values.
 static const int ME_HOST_DATA_DEPTH_MAX = 32;
 
+// The highest nesting limit an engine can be configured with. Plain
+// conversion walks values with an explicit stack; the other walks recurse, so
+// this also caps their use of the C stack. Shared segments, schemas and
+// MRubyEngine.pack work without an engine and are held to this limit alone.
+static const int ME_HOST_DATA_DEPTH_LIMIT = 1024;
+
+// The nesting limit of `engine`.
+int me_value_depth_max(struct me_mruby_engine *engine);
+
+// The precision of the guest's decimal context; decimals with more
+// significant digits are out of range rather than silently rounded.
+static const int ME_VALUE_DECIMAL_DIGITS_MAX = 64;
+
+// Decimals written by me_value_guest_decimal_to_s fit in this many bytes.
+#define ME_VALUE_DECIMAL_STRING_MAX 160
+
+// The guest's Time does its arithmetic on floats, which hold integers exactly
+// only up to 2**53.
+static const int64_t ME_VALUE_TIME_SECONDS_MAX = INT64_C(1) << 53;
+
 #endif
@@ -1,105 +1,526 @@
 #include "mruby_engine_private.h"
+#include "mruby-mpdecimal/include/mruby/decimal.h"
+#include "mruby-mpdecimal/src/mpdecimal.h"
+#include "mruby-time/include/mruby/time.h"
+#include "shared_segment.h"
 #include "value.h"
+#include <inttypes.h>
 #include <mruby.h>
 #include <mruby/array.h>
 #include <mruby/class.h>
+#include <mruby/data.h>
 #include <mruby/dump.h>
 #include <mruby/error.h>
 #include <mruby/hash.h>
+#include <mruby/khash.h>
 #include <mruby/string.h>
 #include <mruby/variable.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-static me_host_value_t me_value_to_host_r(
-    struct me_mruby_engine *self,
-    mrb_value value,
-    int depth,
-    struct me_value_err *err)
+static int me_value_guest_pair_compare(const void *a, const void *b) {
+  int64_t index_a = ((const struct me_value_guest_pair *)a)->index;
+  int64_t index_b = ((const struct me_value_guest_pair *)b)->index;
+  return (index_a > index_b) - (index_a < index_b);
+}
+
+// Walks the table directly rather than through mrb_hash_keys, which would
+// allocate a guest array in the engine's pool. Entries are ordered by their
+// insertion index to preserve the hash's order.
+bool me_value_guest_hash_pairs(
+  struct me_mruby_engine *engine,
+  me_guest_value_t hash,
+  struct me_value_guest_pair **pairs,
+  size_t *count)
 {
-  if (depth > ME_HOST_DATA_DEPTH_MAX) {
-    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+  (void)engine;
+  *pairs = NULL;
+  *count = 0;
+
+  khash_t(ht) *table = RHASH_TBL((mrb_value){ .w = hash });
+  if (table == NULL || kh_size(table) == 0) {
+    return true;
+  }
+
+  *pairs = malloc(kh_size(table) * sizeof(struct me_value_guest_pair));
+  if (*pairs == NULL) {
+    return false;
+  }
+  for (khiter_t k = kh_begin(table); k != kh_end(table); ++k) {
+    if (kh_exist(table, k)) {
+      (*pairs)[(*count)++] = (struct me_value_guest_pair){
+        .index = kh_value(table, k).n,
+        .key = kh_key(table, k).w,
+        .value = kh_value(table, k).v.w,
+      };
+    }
+  }
+  qsort(*pairs, *count, sizeof(struct me_value_guest_pair), me_value_guest_pair_compare);
+  return true;
+}
+
+// Extraction cannot call into the guest, so decimals and times are read
+// straight from the data wrapped by the vendored mruby-mpdecimal and
+// mruby-time gems. These mirror the leading fields of their structures.
+struct me_value_guest_decimal {
+  mpd_context_t *context;
+  mpd_t *decimal;
+};
+
+enum me_value_guest_timezone {
+  ME_VALUE_GUEST_TIMEZONE_NONE,
+  ME_VALUE_GUEST_TIMEZONE_UTC,
+  ME_VALUE_GUEST_TIMEZONE_LOCAL,
+};
+
+struct me_value_guest_time {
+  time_t sec;
+  time_t usec;
+  enum me_value_guest_timezone timezone;
+};
+
+static const char ME_VALUE_GUEST_DECIMAL_TYPE[] = "Mpd";
+static const char ME_VALUE_GUEST_TIME_TYPE[] = "Time";
+
+static bool me_value_guest_data_p(mrb_value value, const char *struct_name) {
+  return mrb_type(value) == MRB_TT_DATA &&
+    DATA_TYPE(value) != NULL &&
+    DATA_PTR(value) != NULL &&
+    strcmp(DATA_TYPE(value)->struct_name, struct_name) == 0;
+}
+
+// Both hold the coefficient written one word of MPD_RDIGITS digits at a time,
+// from the most significant, so up to a word more than the precision.
+#define ME_VALUE_DECIMAL_COEFFICIENT_SIZE (ME_VALUE_DECIMAL_DIGITS_MAX + MPD_RDIGITS + 1)
+
+static int me_value_decimal_coefficient(const mpd_t *value, char *bytes) {
+  int size = snprintf(bytes, ME_VALUE_DECIMAL_COEFFICIENT_SIZE, "%" PRIu64, (uint64_t)value->data[value->len - 1]);
+  for (mpd_ssize_t i = value->len - 2; i >= 0; --i) {
+    size += snprintf(
+      bytes + size,
+      ME_VALUE_DECIMAL_COEFFICIENT_SIZE - size,
+      "%0*" PRIu64,
+      MPD_RDIGITS,
+      (uint64_t)value->data[i]);
+  }
+  return size;
+}
+
+// Writes NaN and infinities, returning false for finite values.
+static bool me_value_decimal_special(const mpd_t *value, char *bytes, size_t *size) {
+  if (value->flags & (MPD_NAN | MPD_SNAN)) {
+    *size = (size_t)snprintf(bytes, 16, "NaN");
+    return true;
+  }
+  if (value->flags & MPD_INF) {
+    *size = (size_t)snprintf(bytes, 16, "%sInfinity", (value->flags & MPD_NEG) ? "-" : "");
+    return true;
+  }
+  return false;
+}
+
+static bool me_value_decimal_in_range(const mpd_t *value, struct me_value_err *err) {
+  if (value->digits > ME_VALUE_DECIMAL_DIGITS_MAX || value->len < 1) {
+    *err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+    return false;
+  }
+  return true;
+}
+
+// Goes over in scientific notation, which BigDecimal reads exactly.
+static me_host_value_t me_value_decimal_to_host(
+  const struct me_value_guest_decimal *decimal,
+  struct me_value_err *err)
+{
+  const mpd_t *value = decimal->decimal;
+  char bytes[ME_VALUE_DECIMAL_STRING_MAX];
+  size_t size;
+  if (me_value_decimal_special(value, bytes, &size)) {
+    return me_value_host_decimal_new(bytes, size, err);
+  }
+  if (!me_value_decimal_in_range(value, err)) {
     return ME_HOST_NIL;
   }
 
-  if (mrb_nil_p(value)) {
+  char coefficient[ME_VALUE_DECIMAL_COEFFICIENT_SIZE];
+  me_value_decimal_coefficient(value, coefficient);
+  size = (size_t)snprintf(
+    bytes,
+    sizeof(bytes),
+    "%s%se%" PRId64,
+    (value->flags & MPD_NEG) ? "-" : "",
+    coefficient,
+    (int64_t)value->exp);
+  return me_value_host_decimal_new(bytes, size, err);
+}
+
+bool me_value_guest_decimal_to_s(
+  me_guest_value_t value,
+  char *bytes,
+  size_t *size,
+  struct me_value_err *err)
+{
+  mrb_value data = { .w = value };
+  if (!me_value_guest_data_p(data, ME_VALUE_GUEST_DECIMAL_TYPE)) {
+    return false;
+  }
+
+  const mpd_t *decimal = ((const struct me_value_guest_decimal *)DATA_PTR(data))->decimal;
+  if (me_value_decimal_special(decimal, bytes, size) || !me_value_decimal_in_range(decimal, err)) {
+    return true;
+  }
+
+  char coefficient[ME_VALUE_DECIMAL_COEFFICIENT_SIZE];
+  int64_t digits = me_value_decimal_coefficient(decimal, coefficient);
+  int64_t exponent = decimal->exp;
+  int64_t point = digits + exponent;
+  int64_t sign = (decimal->flags & MPD_NEG) ? 1 : 0;
+
+  // The same plain notation as mpd_qformat's "f", unless the exponent is so
+  // far from the digits that it does not fit.
+  int64_t plain_size = sign + digits;
+  if (exponent >= 0) {
+    plain_size += exponent;
+  } else if (point > 0) {
+    plain_size += 1;
+  } else {
+    plain_size += 2 - point;
+  }
+  if (plain_size >= ME_VALUE_DECIMAL_STRING_MAX) {
+    *size = (size_t)snprintf(
+      bytes,
+      ME_VALUE_DECIMAL_STRING_MAX,
+      "%s%se%" PRId64,
+      sign ? "-" : "",
+      coefficient,
+      exponent);
+    return true;
+  }
+
+  char *cursor = bytes;
+  if (sign) {
+    *cursor++ = '-';
+  }
+  if (exponent >= 0) {
+    memcpy(cursor, coefficient, (size_t)digits);
+    memset(cursor + digits, '0', (size_t)exponent);
+  } else if (point > 0) {
+    memcpy(cursor, coefficient, (size_t)point);
+    cursor[point] = '.';
+    memcpy(cursor + point + 1, coefficient + point, (size_t)(digits - point));
+  } else {
+    memcpy(cursor, "0.", 2);
+    memset(cursor + 2, '0', (size_t)-point);
+    memcpy(cursor + 2 - point, coefficient, (size_t)digits);
+  }
+  *size = (size_t)plain_size;
+  return true;
+}
+
+static bool me_value_time_in_range(const struct me_value_guest_time *time, struct me_value_err *err) {
+  if (time->usec < 0 || time->usec >= 1000000) {
+    *err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+    return false;
+  }
+  return true;
+}
+
+static me_host_value_t me_value_time_to_host(
+  const struct me_value_guest_time *time,
+  struct me_value_err *err)
+{
+  if (!me_value_time_in_range(time, err)) {
     return ME_HOST_NIL;
   }
+  return me_value_host_time_new(
+    (int64_t)time->sec,
+    (long)time->usec,
+    time->timezone == ME_VALUE_GUEST_TIMEZONE_UTC,
+    err);
+}
+
+bool me_value_guest_time_get(
+  me_guest_value_t value,
+  int64_t *seconds,
+  long *microseconds,
+  bool *utc,
+  struct me_value_err *err)
+{
+  mrb_value data = { .w = value };
+  if (!me_value_guest_data_p(data, ME_VALUE_GUEST_TIME_TYPE)) {
+    return false;
+  }
 
-  enum mrb_vtype type = mrb_type(value);
-  switch (type) {
+  const struct me_value_guest_time *time = DATA_PTR(data);
+  if (me_value_time_in_range(time, err)) {
+    *seconds = (int64_t)time->sec;
+    *microseconds = (long)time->usec;
+    *utc = time->timezone == ME_VALUE_GUEST_TIMEZONE_UTC;
+  }
+  return true;
+}
+
+// Converts anything but arrays and hashes, which are left to the caller.
+static bool me_value_to_host_leaf(
+  struct me_mruby_engine *self,
+  mrb_value value,
+  int depth,
+  me_host_value_t *result,
+  struct me_value_err *err)
+{
+  *result = ME_HOST_NIL;
+  if (mrb_nil_p(value)) {
+    return true;
+  }
+
+  switch (mrb_type(value)) {
+  case MRB_TT_ARRAY:
+  case MRB_TT_HASH:
+    return false;
   case MRB_TT_FALSE:
-    return ME_HOST_FALSE;
+    *result = ME_HOST_FALSE;
+    return true;
   case MRB_TT_TRUE:
-    return ME_HOST_TRUE;
+    *result = ME_HOST_TRUE;
+    return true;
   case MRB_TT_FIXNUM:
-    return me_value_host_fixnum_new(mrb_fixnum(value), err);
+    *result = me_value_host_fixnum_new(mrb_fixnum(value), err);
+    return true;
+  case MRB_TT_FLOAT:
+    *result = me_value_host_float_new(mrb_float(value), err);
+    return true;
   case MRB_TT_STRING:
-    return me_value_host_string_new(RSTRING_PTR(value), RSTRING_LEN(value), err);
+    *result = me_value_host_string_new(RSTRING_PTR(value), RSTRING_LEN(value), err);
+    return true;
   case MRB_TT_SYMBOL:
     {
+      mrb_sym symbol = mrb_symbol(value);
+      uint64_t id;
+      if (me_symbol_cache_get(&self->symbols_to_host, symbol, &id)) {
+        *result = me_value_host_symbol_from_id(id);
+        return true;
+      }
+
       mrb_int len;
-      const char *p = mrb_sym2name_len(self->state, mrb_symbol(value), &len);
+      const char *p = mrb_sym2name_len(self->state, symbol, &len);
+      me_host_value_t host_symbol = me_value_host_symbol_new(p, len, err);
+      if (err->type != ME_VALUE_NO_ERR) {
+        return true;
+      }
 
-      return me_value_host_symbol_new(p, len, err);
+      id = me_value_host_symbol_to_id(host_symbol);
+      me_symbol_cache_put(&self->symbols_to_host, symbol, id);
+      me_symbol_cache_put(&self->symbols_to_guest, id, symbol);
+      *result = host_symbol;
+      return true;
     }
-  case MRB_TT_ARRAY:
+  case MRB_TT_DATA:
+    if (me_value_guest_data_p(value, ME_VALUE_GUEST_DECIMAL_TYPE)) {
+      *result = me_value_decimal_to_host(DATA_PTR(value), err);
+      return true;
+    }
+    if (me_value_guest_data_p(value, ME_VALUE_GUEST_TIME_TYPE)) {
+      *result = me_value_time_to_host(DATA_PTR(value), err);
+      return true;
+    }
+    // Lazy proxies are data objects too.
+    // fallthrough
+  default:
     {
-      me_host_value_t array = me_value_host_array_new(err);
-      if (err->type != ME_VALUE_NO_ERR) {
-        return ME_HOST_NIL;
+      const struct me_shared_node *node = me_value_guest_lazy_node(self, value.w);
+      if (node != NULL) {
+        *result = me_value_lazy_to_host(self, node, depth, err);
+        return true;
       }
 
-      for (mrb_int i = 0, f = RARRAY_LEN(value); i < f; ++i) {
-        me_host_value_t element = me_value_to_host_r(
-          self, mrb_ary_ref(self->state, value, i), depth + 1, err);
-        if (err->type != ME_VALUE_NO_ERR) {
-          return ME_HOST_NIL;
-        }
+      *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+      return true;
+    }
+  }
+}
 
-        me_value_host_array_push(array, element, err);
-        if (err->type != ME_VALUE_NO_ERR) {
-          return ME_HOST_NIL;
-        }
-      }
-      return array;
+// An array or hash being converted. Elements are converted in order and
+// added to `target` as they complete; a hash holds on to its converted key
+// until the value is done.
+struct me_value_to_host_frame {
+  mrb_value source;
+  me_host_value_t target;
+  size_t index;
+  size_t size;
+  struct me_value_guest_pair *pairs;
+  me_host_value_t key;
+  bool key_p;
+};
+
+#define ME_VALUE_TO_HOST_FRAMES_INLINE 32
+
+// Host values only referenced from the heap-allocated part of the stack
+// would be invisible to the host's GC, so every target and pending key is
+// also pushed on `live`, a host array on the C stack.
+struct me_value_to_host_stack {
+  struct me_value_to_host_frame *frames;
+  size_t frame_count;
+  size_t frame_capacity;
+  me_host_value_t live;
+  struct me_value_to_host_frame inline_frames[ME_VALUE_TO_HOST_FRAMES_INLINE];
+};
+
+static bool me_value_to_host_reserve(struct me_value_to_host_stack *stack) {
+  if (stack->frame_count < stack->frame_capacity) {
+    return true;
+  }
+
+  size_t capacity = stack->frame_capacity * 2;
+  struct me_value_to_host_frame *frames = stack->frames == stack->inline_frames ?
+    malloc(capacity * sizeof(struct me_value_to_host_frame)) :
+    realloc(stack->frames, capacity * sizeof(struct me_value_to_host_frame));
+  if (frames == NULL) {
+    return false;
+  }
+  if (stack->frames == stack->inline_frames) {
+    memcpy(frames, stack->inline_frames, sizeof(stack->inline_frames));
+  }
+  stack->frames = frames;
+  stack->frame_capacity = capacity;
+  return true;
+}
+
+static me_host_value_t me_value_to_host_enter(
+  struct me_mruby_engine *self,
+  struct me_value_to_host_stack *stack,
+  mrb_value value,
+  struct me_value_err *err)
+{
+  if (!me_value_to_host_reserve(stack)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+    return ME_HOST_NIL;
+  }
+
+  struct me_value_to_host_frame frame = (struct me_value_to_host_frame){
+    .source = value,
+    .index = 0,
+    .pairs = NULL,
+    .key_p = false,
+  };
+  if (mrb_array_p(value)) {
+    frame.size = RARRAY_LEN(value);
+    frame.target = me_value_host_array_new(err);
+  } else {
+    if (!me_value_guest_hash_pairs(self, value.w, &frame.pairs, &frame.size)) {
+      *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+      return ME_HOST_NIL;
     }
-  case MRB_TT_HASH:
-    {
-      me_host_value_t hash = me_value_host_hash_new(err);
-      if (err->type != ME_VALUE_NO_ERR) {
-        return ME_HOST_NIL;
-      }
+    frame.target = me_value_host_hash_new(err);
+  }
+  if (err->type == ME_VALUE_NO_ERR) {
+    me_value_host_array_push(stack->live, frame.target, err);
+  }
+  if (err->type != ME_VALUE_NO_ERR) {
+    free(frame.pairs);
+    return ME_HOST_NIL;
+  }
+  stack->frames[stack->frame_count++] = frame;
+  return frame.target;
+}
 
-      mrb_value keys = mrb_hash_keys(self->state, value);
-      mrb_int len = RARRAY_LEN(keys);
-      for (mrb_int i = 0; i < len; ++i) {
-        mrb_value k = mrb_ary_ref(self->state, keys, i);
+static void me_value_to_host_place(
+  struct me_value_to_host_stack *stack,
+  struct me_value_to_host_frame *frame,
+  me_host_value_t value,
+  struct me_value_err *err)
+{
+  if (mrb_array_p(frame->source)) {
+    me_value_host_array_push(frame->target, value, err);
+    ++frame->index;
+  } else if (!frame->key_p) {
+    me_value_host_array_push(stack->live, value, err);
+    frame->key = value;
+    frame->key_p = true;
+  } else {
+    me_value_host_hash_assoc(frame->target, frame->key, value, err);
+    me_value_host_array_pop(stack->live);
+    frame->key_p = false;
+    ++frame->index;
+  }
+}
 
-        me_host_value_t key = me_value_to_host_r(
-          self, k, depth + 1, err);
-        if (err->type != ME_VALUE_NO_ERR) {
-          return ME_HOST_NIL;
-        }
+// Walks nested arrays and hashes depth first with an explicit stack instead
+// of recursing, so the depth limit is a setting rather than a bound on the C
+// stack. `depth` is the depth of `value` itself.
+static me_host_value_t me_value_to_host_r(
+  struct me_mruby_engine *self,
+  mrb_value value,
+  int depth,
+  struct me_value_err *err)
+{
+  if (depth > self->data_depth_max) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return ME_HOST_NIL;
+  }
 
-        me_host_value_t element = me_value_to_host_r(
-          self, mrb_hash_get(self->state, value, k), depth + 1, err);
-        if (err->type != ME_VALUE_NO_ERR) {
-          return ME_HOST_NIL;
-        }
+  me_host_value_t result;
+  if (me_value_to_host_leaf(self, value, depth, &result, err)) {
+    return err->type == ME_VALUE_NO_ERR ? result : ME_HOST_NIL;
+  }
 
-        me_value_host_hash_assoc(hash, key, element, err);
-        if (err->type != ME_VALUE_NO_ERR) {
-          return ME_HOST_NIL;
-        }
+  struct me_value_to_host_stack stack;
+  stack.frames = stack.inline_frames;
+  stack.frame_count = 0;
+  stack.frame_capacity = ME_VALUE_TO_HOST_FRAMES_INLINE;
+  stack.live = me_value_host_array_new(err);
+  if (err->type != ME_VALUE_NO_ERR) {
+    return ME_HOST_NIL;
+  }
+
+  result = me_value_to_host_enter(self, &stack, value, err);
+  while (err->type == ME_VALUE_NO_ERR && stack.frame_count > 0) {
+    struct me_value_to_host_frame *frame = &stack.frames[stack.frame_count - 1];
+    if (frame->index == frame->size) {
+      me_host_value_t done = frame->target;
+      free(frame->pairs);
+      --stack.frame_count;
+      me_value_host_array_pop(stack.live);
+      if (stack.frame_count > 0) {
+        me_value_to_host_place(&stack, &stack.frames[stack.frame_count - 1], done, err);
       }
+      continue;
+    }
 
-      return hash;
+    mrb_value child;
+    if (mrb_array_p(frame->source)) {
+      child = mrb_ary_ref(self->state, frame->source, (mrb_int)frame->index);
+    } else {
+      const struct me_value_guest_pair *pair = &frame->pairs[frame->index];
+      child = (mrb_value){ .w = frame->key_p ? pair->value : pair->key };
     }
-  default:
-    {
-      *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
-      return ME_HOST_NIL;
+    int child_depth = depth + (int)stack.frame_count;
+    if (child_depth > self->data_depth_max) {
+      *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+      break;
+    }
+
+    me_host_value_t element;
+    if (me_value_to_host_leaf(self, child, child_depth, &element, err)) {
+      if (err->type == ME_VALUE_NO_ERR) {
+        me_value_to_host_place(&stack, frame, element, err);
+      }
+    } else {
+      me_value_to_host_enter(self, &stack, child, err);
     }
   }
+
+  for (size_t i = 0; i < stack.frame_count; ++i) {
+    free(stack.frames[i].pairs);
+  }
+  if (stack.frames != stack.inline_frames) {
+    free(stack.frames);
+  }
+  if (err->type != ME_VALUE_NO_ERR) {
+    return ME_HOST_NIL;
+  }
+  return result;
 }
 
 me_host_value_t me_value_to_host(
@@ -110,6 +531,277 @@ me_host_value_t me_value_to_host(
   return me_value_to_host_r(self, (mrb_value){ .w = value }, 0, err);
 }
 
+// Points the engine's lookup key at the bytes of a string step. It must be
+// emptied again with me_value_guest_lookup_key_reset once the table has been
+// probed; protect scopes also empty it when they end.
+static mrb_value me_value_guest_lookup_key(
+  struct me_mruby_engine *self,
+  const struct me_value_path_step *step)
+{
+  struct RString *key = mrb_str_ptr(self->lookup_key);
+  key->as.heap.ptr = (char *)step->key.bytes;
+  key->as.heap.len = (mrb_int)step->key.size;
+  return self->lookup_key;
+}
+
+static void me_value_guest_lookup_key_reset(struct me_mruby_engine *self) {
+  struct RString *key = mrb_str_ptr(self->lookup_key);
+  key->as.heap.ptr = (char *)"";
+  key->as.heap.len = 0;
+}
+
+// Lookups must not allocate: symbols are only looked up if already interned,
+// and strings through the engine's lookup key.
+static bool me_value_guest_hash_find(
+  struct me_mruby_engine *self,
+  mrb_value hash,
+  const struct me_value_path_step *step,
+  mrb_value *value)
+{
+  khash_t(ht) *table = RHASH_TBL(hash);
+  if (table == NULL) {
+    return false;
+  }
+
+  khiter_t k;
+  if (step->type == ME_VALUE_PATH_SYMBOL) {
+    mrb_sym symbol = mrb_intern_check(self->state, step->key.bytes, step->key.size);
+    if (symbol == 0) {
+      return false;
+    }
+    k = kh_get(ht, self->state, table, mrb_symbol_value(symbol));
+  } else {
+    k = kh_get(ht, self->state, table, me_value_guest_lookup_key(self, step));
+    me_value_guest_lookup_key_reset(self);
+  }
+  if (k == kh_end(table)) {
+    return false;
+  }
+  *value = kh_value(table, k).v;
+  return true;
+}
+
+static me_host_value_t me_value_to_host_path_r(
+  struct me_mruby_engine *self,
+  mrb_value value,
+  const struct me_value_path_step *steps,
+  size_t size,
+  int depth,
+  struct me_value_err *err);
+
+static me_host_value_t me_value_to_host_wildcard(
+  struct me_mruby_engine *self,
+  mrb_value value,
+  const struct me_value_path_step *steps,
+  size_t size,
+  int depth,
+  struct me_value_err *err)
+{
+  if (!mrb_array_p(value) && !mrb_hash_p(value)) {
+    return ME_HOST_NIL;
+  }
+  if (depth > self->data_depth_max) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return ME_HOST_NIL;
+  }
+
+  me_host_value_t results = me_value_host_array_new(err);
+  if (err->type != ME_VALUE_NO_ERR) {
+    return ME_HOST_NIL;
+  }
+
+  if (mrb_array_p(value)) {
+    for (mrb_int i = 0; i < RARRAY_LEN(value); ++i) {
+      me_host_value_t result = me_value_to_host_path_r(
+        self, mrb_ary_ref(self->state, value, i), steps, size, depth + 1, err);
+      if (err->type != ME_VALUE_NO_ERR) {
+        return ME_HOST_NIL;
+      }
+      me_value_host_array_push(results, result, err);
+      if (err->type != ME_VALUE_NO_ERR) {
+        return ME_HOST_NIL;
+      }
+    }
+    return results;
+  }
+
+  struct me_value_guest_pair *pairs;
+  size_t count;
+  if (!me_value_guest_hash_pairs(self, value.w, &pairs, &count)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+    return ME_HOST_NIL;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    me_host_value_t result = me_value_to_host_path_r(
+      self, (mrb_value){ .w = pairs[i].value }, steps, size, depth + 1, err);
+    if (err->type != ME_VALUE_NO_ERR) {
+      break;
+    }
+    me_value_host_array_push(results, result, err);
+    if (err->type != ME_VALUE_NO_ERR) {
+      break;
+    }
+  }
+  free(pairs);
+  if (err->type != ME_VALUE_NO_ERR) {
+    return ME_HOST_NIL;
+  }
+  return results;
+}
+
+static me_host_value_t me_value_to_host_path_r(
+  struct me_mruby_engine *self,
+  mrb_value value,
+  const struct me_value_path_step *steps,
+  size_t size,
+  int depth,
+  struct me_value_err *err)
+{
+  for (; size > 0; ++steps, --size) {
+    switch (steps->type) {
+    case ME_VALUE_PATH_STRING:
+    case ME_VALUE_PATH_SYMBOL:
+      if (!mrb_hash_p(value) || !me_value_guest_hash_find(self, value, steps, &value)) {
+        return ME_HOST_NIL;
+      }
+      break;
+    case ME_VALUE_PATH_INDEX:
+      if (!mrb_array_p(value)) {
+        return ME_HOST_NIL;
+      }
+      value = mrb_ary_ref(self->state, value, steps->index);
+      break;
+    case ME_VALUE_PATH_WILDCARD:
+      return me_value_to_host_wildcard(self, value, steps + 1, size - 1, depth, err);
+    }
+  }
+
+  return me_value_to_host_r(self, value, depth, err);
+}
+
+me_host_value_t me_value_to_host_path(
+  struct me_mruby_engine *self,
+  me_guest_value_t value,
+  const struct me_value_path_step *steps,
+  size_t size,
+  struct me_value_err *err)
+{
+  return me_value_to_host_path_r(self, (mrb_value){ .w = value }, steps, size, 0, err);
+}
+
+static mrb_value me_value_guest_step_key(
+  struct me_mruby_engine *self,
+  const struct me_value_path_step *step)
+{
+  if (step->type == ME_VALUE_PATH_SYMBOL) {
+    return mrb_symbol_value(mrb_intern(self->state, step->key.bytes, step->key.size));
+  }
+  return mrb_str_new(self->state, step->key.bytes, step->key.size);
+}
+
+// Negative indices count from the end, as in Ruby. Returns false if the
+// index falls outside of [0, size].
+static bool me_value_guest_step_index(mrb_value array, long index, mrb_int *result) {
+  mrb_int size = RARRAY_LEN(array);
+  if (index < 0) {
+    index += size;
+  }
+  if (index < 0 || index > size) {
+    return false;
+  }
+  *result = index;
+  return true;
+}
+
+// Goes through the C API rather than calling methods, which scripts could
+// have redefined. Frozen values raise as they would in a script.
+void me_value_guest_patch(
+  struct me_mruby_engine *self,
+  me_guest_value_t root,
+  const struct me_value_patch_op *op,
+  me_guest_value_t value,
+  struct me_value_err *err)
+{
+  struct mrb_state *mrb = self->state;
+  mrb_value parent = (mrb_value){ .w = root };
+  const struct me_value_path_step *steps = op->path.steps;
+  size_t last = op->path.size - 1;
+
+  for (size_t i = 0; i < last; ++i) {
+    mrb_int index;
+    if (steps[i].type == ME_VALUE_PATH_INDEX) {
+      if (!mrb_array_p(parent) ||
+          !me_value_guest_step_index(parent, steps[i].index, &index) ||
+          index == RARRAY_LEN(parent)) {
+        *err = (struct me_value_err){ .type = ME_VALUE_BAD_PATCH };
+        return;
+      }
+      parent = mrb_ary_ref(mrb, parent, index);
+    } else if (!mrb_hash_p(parent) || !me_value_guest_hash_find(self, parent, &steps[i], &parent)) {
+      *err = (struct me_value_err){ .type = ME_VALUE_BAD_PATCH };
+      return;
+    }
+  }
+
+  // Not every operation below checks by itself.
+  if (!mrb_immediate_p(parent) && MRB_FROZEN_P(mrb_basic_ptr(parent))) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "can't modify frozen value");
+  }
+
+  const struct me_value_path_step *step = &steps[last];
+  if (step->type == ME_VALUE_PATH_INDEX) {
+    mrb_int index;
+    if (!mrb_array_p(parent) || !me_value_guest_step_index(parent, step->index, &index)) {
+      *err = (struct me_value_err){ .type = ME_VALUE_BAD_PATCH };
+      return;
+    }
+
+    mrb_int size = RARRAY_LEN(parent);
+    switch (op->type) {
+    case ME_VALUE_PATCH_SET:
+      mrb_ary_set(mrb, parent, index, (mrb_value){ .w = value });
+      return;
+    case ME_VALUE_PATCH_INSERT:
+      {
+        mrb_value element = (mrb_value){ .w = value };
+        mrb_ary_splice(mrb, parent, index, 0, mrb_ary_new_from_values(mrb, 1, &element));
+        return;
+      }
+    case ME_VALUE_PATCH_DELETE:
+      if (index == size) {
+        *err = (struct me_value_err){ .type = ME_VALUE_BAD_PATCH };
+        return;
+      }
+      mrb_ary_splice(mrb, parent, index, 1, mrb_ary_new(mrb));
+      return;
+    }
+  }
+
+  mrb_value found;
+  if (!mrb_hash_p(parent) || op->type == ME_VALUE_PATCH_INSERT) {
+    *err = (struct me_value_err){ .type = ME_VALUE_BAD_PATCH };
+    return;
+  }
+  if (op->type == ME_VALUE_PATCH_SET) {
+    mrb_hash_set(mrb, parent, me_value_guest_step_key(self, step), (mrb_value){ .w = value });
+    return;
+  }
+  if (!me_value_guest_hash_find(self, parent, step, &found)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_BAD_PATCH };
+    return;
+  }
+  if (step->type == ME_VALUE_PATH_SYMBOL) {
+    mrb_hash_delete_key(mrb, parent, me_value_guest_step_key(self, step));
+    return;
+  }
+  mrb_hash_delete_key(mrb, parent, me_value_guest_lookup_key(self, step));
+  me_value_guest_lookup_key_reset(self);
+}
+
+int me_value_depth_max(struct me_mruby_engine *engine) {
+  return engine->data_depth_max;
+}
+
 me_guest_value_t me_value_guest_nil_new(void) {
   return mrb_nil_value().w;
 }
@@ -121,19 +813,80 @@ me_guest_value_t me_value_guest_true_new(void) {
   return mrb_true_value().w;
 }
 
-static void me_value_guest_check_exception(
+void me_value_guest_take_exception(
   struct me_mruby_engine *engine,
   struct me_value_err *err)
 {
+  if (err->type != ME_VALUE_GUEST_ERR || err->guest_err.err != ME_HOST_NIL) {
+    return;
+  }
+
+  if (engine->alloc_err.type != ME_EVAL_NO_ERR) {
+    engine->state->exc = NULL;
+    engine->quota_error_raised = true;
+    err->guest_err.err = me_eval_err_to_host(&engine->alloc_err);
+    engine->alloc_err = (struct me_eval_err){ .type = ME_EVAL_NO_ERR };
+    return;
+  }
+
   me_host_exception_t guest_err = me_mruby_engine_get_exception(engine);
   if (guest_err == ME_HOST_NIL) {
-    return;
+    guest_err = me_host_internal_error_new("value conversion aborted");
   }
+  err->guest_err.err = guest_err;
+}
 
-  *err = (struct me_value_err){
-    .type = ME_VALUE_GUEST_ERR,
-    .guest_err = { .err = guest_err },
-  };
+me_guest_value_t me_value_guest_try(
+  struct me_mruby_engine *engine,
+  me_value_guest_body_t body,
+  void *data,
+  struct me_value_err *err)
+{
+  struct mrb_state *state = engine->state;
+  struct mrb_jmpbuf *previous = state->jmp;
+  struct mrb_jmpbuf c_jmp;
+  int arena_index = mrb_gc_arena_save(state);
+  volatile me_guest_value_t result = me_value_guest_nil_new();
+
+  engine->alloc_soft_fail = true;
+  engine->alloc_err = (struct me_eval_err){ .type = ME_EVAL_NO_ERR };
+  state->jmp = &c_jmp;
+
+  MRB_TRY(state->jmp) {
+    result = body(engine, data, err);
+  }
+  MRB_CATCH(state->jmp) {
+    result = me_value_guest_nil_new();
+    *err = (struct me_value_err){
+      .type = ME_VALUE_GUEST_ERR,
+      .guest_err = { .err = ME_HOST_NIL },
+    };
+  }
+  MRB_END_EXC(state->jmp);
+
+  state->jmp = previous;
+  engine->alloc_soft_fail = false;
+  me_value_guest_lookup_key_reset(engine);
+
+  // Everything built by `body` was kept alive by the arena; only the result
+  // needs to be from here on.
+  mrb_gc_arena_restore(state, arena_index);
+  if (err->type != ME_VALUE_NO_ERR) {
+    return me_value_guest_nil_new();
+  }
+  mrb_gc_protect(state, (mrb_value){ .w = result });
+  return result;
+}
+
+me_guest_value_t me_value_guest_protect(
+  struct me_mruby_engine *engine,
+  me_value_guest_body_t body,
+  void *data,
+  struct me_value_err *err)
+{
+  me_guest_value_t result = me_value_guest_try(engine, body, data, err);
+  me_value_guest_take_exception(engine, err);
+  return result;
 }
 
 me_guest_value_t me_value_guest_fixnum_new(
@@ -141,20 +894,147 @@ me_guest_value_t me_value_guest_fixnum_new(
   long value,
   struct me_value_err *err)
 {
-  mrb_value v = mrb_fixnum_value(value);
-  me_value_guest_check_exception(engine, err);
-  return v.w;
+  (void)engine;
+  (void)err;
+  return mrb_fixnum_value(value).w;
+}
+
+me_guest_value_t me_value_guest_float_new(
+  struct me_mruby_engine *engine,
+  double value,
+  struct me_value_err *err)
+{
+  (void)err;
+  return mrb_float_value(engine->state, value).w;
 }
 
+me_guest_value_t me_value_guest_decimal_new(
+  struct me_mruby_engine *engine,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err)
+{
+  (void)err;
+  return mrb_decimal_new(engine->state, bytes, size).w;
+}
+
+me_guest_value_t me_value_guest_time_new(
+  struct me_mruby_engine *engine,
+  int64_t seconds,
+  long microseconds,
+  bool utc,
+  struct me_value_err *err)
+{
+  (void)err;
+  return mrb_time_new_at(engine->state, seconds, microseconds, utc).w;
+}
+
+static void me_value_guest_freeze(mrb_value value) {
+  MRB_SET_FROZEN_FLAG(mrb_basic_ptr(value));
+}
+
+// An object already frozen was either injected deduplicated, holding
+// nothing, or reached before through another path, so it is not walked again.
+static void me_value_guest_freeze_r(mrb_value value) {
+  if (mrb_immediate_p(value) || MRB_FROZEN_P(mrb_basic_ptr(value))) {
+    return;
+  }
+
+  switch (mrb_type(value)) {
+  case MRB_TT_STRING:
+    me_value_guest_freeze(value);
+    break;
+  case MRB_TT_ARRAY:
+    me_value_guest_freeze(value);
+    for (mrb_int i = 0, f = RARRAY_LEN(value); i < f; ++i) {
+      me_value_guest_freeze_r(RARRAY_PTR(value)[i]);
+    }
+    break;
+  case MRB_TT_HASH:
+    {
+      me_value_guest_freeze(value);
+      khash_t(ht) *table = RHASH_TBL(value);
+      if (table == NULL) {
+        break;
+      }
+      for (khiter_t k = kh_begin(table); k != kh_end(table); ++k) {
+        if (kh_exist(table, k)) {
+          me_value_guest_freeze_r(kh_key(table, k));
+          me_value_guest_freeze_r(kh_value(table, k).v);
+        }
+      }
+      break;
+    }
+  default:
+    break;
+  }
+}
+
+void me_value_guest_freeze_deep(me_guest_value_t value) {
+  me_value_guest_freeze_r((mrb_value){ .w = value });
+}
+
+// FNV-1a, never zero so that it can key a symbol cache.
+static uint64_t me_value_string_digest(const char *bytes, size_t size) {
+  uint64_t h = UINT64_C(14695981039346656037);
+  for (size_t i = 0; i < size; ++i) {
+    h = (h ^ (uint8_t)bytes[i]) * UINT64_C(1099511628211);
+  }
+  return h == 0 ? 1 : h;
+}
+
+// While an injection deduplicates, strings are looked up by digest and
+// confirmed byte for byte. They are all frozen, since any of them may be
+// shared. On a collision the newer string takes over the slot.
 me_guest_value_t me_value_guest_string_new(
   struct me_mruby_engine *engine,
   const char *bytes,
   size_t size,
   struct me_value_err *err)
 {
-  mrb_value v = mrb_str_new(engine->state, bytes, size);
-  me_value_guest_check_exception(engine, err);
-  return v.w;
+  (void)err;
+  if (engine->injected_strings == NULL) {
+    return mrb_str_new(engine->state, bytes, size).w;
+  }
+
+  uint64_t digest = me_value_string_digest(bytes, size);
+  uint64_t cached;
+  if (me_symbol_cache_get(engine->injected_strings, digest, &cached)) {
+    mrb_value string = (mrb_value){ .w = cached };
+    if ((size_t)RSTRING_LEN(string) == size && memcmp(RSTRING_PTR(string), bytes, size) == 0) {
+      return cached;
+    }
+  }
+
+  struct mrb_state *state = engine->state;
+  if (mrb_nil_p(engine->injected_strings_root)) {
+    mrb_value root = mrb_ary_new(state);
+    mrb_gv_set(state, mrb_intern_lit(state, ME_INJECTED_STRINGS_VARIABLE), root);
+    engine->injected_strings_root = root;
+  }
+  mrb_value string = mrb_str_new(state, bytes, size);
+  me_value_guest_freeze(string);
+  mrb_ary_push(state, engine->injected_strings_root, string);
+  me_symbol_cache_put(engine->injected_strings, digest, string.w);
+  return string.w;
+}
+
+me_guest_value_t me_value_guest_string_borrow(
+  struct me_mruby_engine *engine,
+  me_host_value_t string,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err)
+{
+  if (engine->borrowed_strings == ME_HOST_NIL) {
+    return me_value_guest_string_new(engine, bytes, size, err);
+  }
+
+  me_value_host_hash_assoc(engine->borrowed_strings, string, ME_HOST_TRUE, err);
+  if (err->type != ME_VALUE_NO_ERR) {
+    return me_value_guest_nil_new();
+  }
+  return mrb_str_new_static(engine->state, bytes, size).w;
 }
 
 me_guest_value_t me_value_guest_symbol_new(
@@ -163,18 +1043,43 @@ me_guest_value_t me_value_guest_symbol_new(
   size_t size,
   struct me_value_err *err)
 {
-  mrb_sym v = mrb_intern(engine->state, bytes, size);
-  me_value_guest_check_exception(engine, err);
-  return mrb_symbol_value(v).w;
+  (void)err;
+  return mrb_symbol_value(mrb_intern(engine->state, bytes, size)).w;
+}
+
+me_guest_value_t me_value_guest_symbol_from_host(
+  struct me_mruby_engine *engine,
+  me_host_value_t id,
+  struct me_value_err *err)
+{
+  (void)err;
+  uint64_t symbol;
+  if (!me_symbol_cache_get(&engine->symbols_to_guest, id, &symbol)) {
+    const char *bytes;
+    size_t size;
+    me_value_host_symbol_name(id, &bytes, &size);
+    symbol = mrb_intern(engine->state, bytes, size);
+    me_symbol_cache_put(&engine->symbols_to_guest, id, symbol);
+    me_symbol_cache_put(&engine->symbols_to_host, symbol, id);
+  }
+  return mrb_symbol_value((mrb_sym)symbol).w;
 }
 
 me_guest_value_t me_value_guest_array_new(
   struct me_mruby_engine *engine,
   struct me_value_err *err)
 {
-  mrb_value v = mrb_ary_new(engine->state);
-  me_value_guest_check_exception(engine, err);
-  return v.w;
+  (void)err;
+  return mrb_ary_new(engine->state).w;
+}
+
+me_guest_value_t me_value_guest_array_new_capa(
+  struct me_mruby_engine *engine,
+  size_t capacity,
+  struct me_value_err *err)
+{
+  (void)err;
+  return mrb_ary_new_capa(engine->state, capacity).w;
 }
 
 void me_value_guest_array_push(
@@ -183,17 +1088,25 @@ void me_value_guest_array_push(
   me_guest_value_t element,
   struct me_value_err *err)
 {
+  (void)err;
   mrb_ary_push(engine->state, (mrb_value){ .w = array }, (mrb_value){ .w = element });
-  me_value_guest_check_exception(engine, err);
 }
 
 me_guest_value_t me_value_guest_hash_new(
   struct me_mruby_engine *engine,
   struct me_value_err *err)
 {
-  mrb_value v = mrb_hash_new(engine->state);
-  me_value_guest_check_exception(engine, err);
-  return v.w;
+  (void)err;
+  return mrb_hash_new(engine->state).w;
+}
+
+me_guest_value_t me_value_guest_hash_new_capa(
+  struct me_mruby_engine *engine,
+  size_t capacity,
+  struct me_value_err *err)
+{
+  (void)err;
+  return mrb_hash_new_capa(engine->state, capacity).w;
 }
 
 void me_value_guest_hash_assoc(
@@ -203,10 +1116,91 @@ void me_value_guest_hash_assoc(
   me_guest_value_t value,
   struct me_value_err *err)
 {
+  (void)err;
   mrb_hash_set(
     engine->state,
     (mrb_value){ .w = hash },
     (mrb_value){ .w = key },
     (mrb_value){ .w = value });
-  me_value_guest_check_exception(engine, err);
+}
+
+// Strings are created static, so their bytes stay in the read-only segment
+// and are neither charged to the engine's pool nor freed by its GC. Every
+// object is frozen; mruby would otherwise copy a static string on write,
+// silently detaching it from the segment.
+static mrb_value me_value_guest_from_shared_r(
+  struct me_mruby_engine *engine,
+  const struct me_shared_node *node,
+  struct me_value_err *err)
+{
+  struct mrb_state *state = engine->state;
+
+  switch (node->type) {
+  case ME_SHARED_NIL:
+    return mrb_nil_value();
+  case ME_SHARED_FALSE:
+    return mrb_false_value();
+  case ME_SHARED_TRUE:
+    return mrb_true_value();
+  case ME_SHARED_FIXNUM:
+    return mrb_fixnum_value(node->fixnum);
+  case ME_SHARED_STRING:
+    {
+      mrb_value string = mrb_str_new_static(state, node->string.bytes, node->string.size);
+      me_value_guest_freeze(string);
+      return string;
+    }
+  case ME_SHARED_SYMBOL:
+    return mrb_symbol_value(mrb_intern_static(state, node->string.bytes, node->string.size));
+  case ME_SHARED_ARRAY:
+    {
+      mrb_value array = mrb_ary_new_capa(state, node->children.size);
+      for (size_t i = 0; i < node->children.size; ++i) {
+        mrb_value element = me_value_guest_from_shared_r(engine, &node->children.nodes[i], err);
+        if (err->type != ME_VALUE_NO_ERR) {
+          return mrb_nil_value();
+        }
+        mrb_ary_push(state, array, element);
+      }
+      me_value_guest_freeze(array);
+      return array;
+    }
+  case ME_SHARED_HASH:
+    {
+      mrb_value hash = mrb_hash_new_capa(state, node->children.size);
+      for (size_t i = 0; i < node->children.size; ++i) {
+        const struct me_shared_node *pair = &node->children.nodes[2 * i];
+        mrb_value key = me_value_guest_from_shared_r(engine, &pair[0], err);
+        if (err->type != ME_VALUE_NO_ERR) {
+          return mrb_nil_value();
+        }
+        mrb_value value = me_value_guest_from_shared_r(engine, &pair[1], err);
+        if (err->type != ME_VALUE_NO_ERR) {
+          return mrb_nil_value();
+        }
+        mrb_hash_set(state, hash, key, value);
+      }
+      me_value_guest_freeze(hash);
+      return hash;
+    }
+  default:
+    *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+    return mrb_nil_value();
+  }
+}
+
+static me_guest_value_t me_value_guest_from_shared_body(
+  struct me_mruby_engine *engine,
+  void *data,
+  struct me_value_err *err)
+{
+  return me_value_guest_from_shared_r(engine, data, err).w;
+}
+
+me_guest_value_t me_value_guest_from_shared(
+  struct me_mruby_engine *engine,
+  const struct me_shared_node *node,
+  struct me_value_err *err)
+{
+  return me_value_guest_protect(engine, me_value_guest_from_shared_body, (void *)node, err);
 }
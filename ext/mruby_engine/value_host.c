@@ -1,37 +1,552 @@
 #include "value.h"
+#include "ext.h"
+#include "packed.h"
+#include "schema.h"
+#include "shared_segment.h"
 #include <ruby.h>
 #include <ruby/encoding.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
+struct me_value_to_guest_stack;
+
+static me_guest_value_t me_value_to_guest_r(
+  struct me_mruby_engine *engine,
+  struct me_value_to_guest_stack *stack,
+  VALUE value,
+  int depth,
+  struct me_value_err *err);
+
+static bool me_value_to_guest_scalar(
+  struct me_mruby_engine *engine,
+  VALUE value,
+  me_guest_value_t *result,
+  struct me_value_err *err)
+{
+  switch (rb_type(value)) {
+  case RUBY_T_NIL:
+    *result = me_value_guest_nil_new();
+    return true;
+  case RUBY_T_FALSE:
+    *result = me_value_guest_false_new();
+    return true;
+  case RUBY_T_TRUE:
+    *result = me_value_guest_true_new();
+    return true;
+  case RUBY_T_FIXNUM:
+    *result = me_value_guest_fixnum_new(engine, FIX2LONG(value), err);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Below this size, copying costs less than keeping the host string alive.
+static const long ME_VALUE_BORROW_SIZE_MIN = 4096;
+
+// Only frozen strings with their bytes outside of the object can be
+// borrowed: their bytes can neither change nor move with the object when
+// the GC compacts.
+static me_guest_value_t me_value_to_guest_string(
+  struct me_mruby_engine *engine,
+  VALUE value,
+  struct me_value_err *err)
+{
+  if (OBJ_FROZEN(value) &&
+      RB_FL_TEST_RAW(value, RSTRING_NOEMBED) &&
+      RSTRING_LEN(value) >= ME_VALUE_BORROW_SIZE_MIN) {
+    return me_value_guest_string_borrow(engine, value, RSTRING_PTR(value), RSTRING_LEN(value), err);
+  }
+  return me_value_guest_string_new(engine, RSTRING_PTR(value), RSTRING_LEN(value), err);
+}
+
+// BigDecimal is not loaded by the extension, so a value can only be one if
+// the application has loaded it.
+static bool me_value_host_big_decimal_p(VALUE value) {
+  return rb_const_defined(rb_cObject, me_ext_id_big_decimal) &&
+    RTEST(rb_obj_is_kind_of(value, rb_const_get(rb_cObject, me_ext_id_big_decimal)));
+}
+
+enum me_value_host_data_type {
+  ME_VALUE_HOST_DATA_OTHER,
+  ME_VALUE_HOST_DATA_TIME,
+  ME_VALUE_HOST_DATA_DECIMAL,
+};
+
+// What a time or decimal holds, read out of the host before any of it goes
+// to the guest.
+struct me_value_host_data {
+  VALUE value;
+  enum me_value_host_data_type type;
+  bool in_range;
+  int64_t seconds;
+  long microseconds;
+  bool utc;
+  size_t size;
+  char bytes[ME_VALUE_DECIMAL_STRING_MAX];
+};
+
+static VALUE me_value_read_host_data(VALUE data) {
+  struct me_value_host_data *host_data = (struct me_value_host_data *)data;
+  VALUE value = host_data->value;
+
+  if (rb_obj_is_kind_of(value, rb_cTime)) {
+    struct timespec time = rb_time_timespec(value);
+    host_data->type = ME_VALUE_HOST_DATA_TIME;
+    host_data->in_range =
+      time.tv_sec <= ME_VALUE_TIME_SECONDS_MAX && time.tv_sec >= -ME_VALUE_TIME_SECONDS_MAX;
+    host_data->seconds = time.tv_sec;
+    host_data->microseconds = time.tv_nsec / 1000;
+    host_data->utc = RTEST(rb_funcall(value, me_ext_id_utc_p, 0));
+    return Qnil;
+  }
+
+  if (me_value_host_big_decimal_p(value)) {
+    host_data->type = ME_VALUE_HOST_DATA_DECIMAL;
+    VALUE digits = rb_funcall(value, me_ext_id_n_significant_digits, 0);
+    if (!FIXNUM_P(digits) || FIX2LONG(digits) > ME_VALUE_DECIMAL_DIGITS_MAX) {
+      host_data->in_range = false;
+      return Qnil;
+    }
+    VALUE string = rb_funcall(value, me_ext_id_to_s, 0);
+    StringValue(string);
+    host_data->in_range = RSTRING_LEN(string) <= ME_VALUE_DECIMAL_STRING_MAX;
+    if (host_data->in_range) {
+      host_data->size = RSTRING_LEN(string);
+      memcpy(host_data->bytes, RSTRING_PTR(string), host_data->size);
+    }
+    return Qnil;
+  }
+
+  host_data->type = ME_VALUE_HOST_DATA_OTHER;
+  return Qnil;
+}
+
+// Decimals go over as their string form, which the guest parses exactly as
+// long as it fits its precision. Times lose anything below the microsecond,
+// the resolution of the guest's. Reading them calls into the host, which may
+// raise, so that happens under rb_protect: a host exception must not unwind
+// through the guest's protect scope.
+static me_guest_value_t me_value_to_guest_data(
+  struct me_mruby_engine *engine,
+  VALUE value,
+  struct me_value_err *err)
+{
+  struct me_value_host_data data;
+  data.value = value;
+  int state = 0;
+  rb_protect(me_value_read_host_data, (VALUE)&data, &state);
+  if (state != 0) {
+    *err = (struct me_value_err){ .type = ME_VALUE_HOST_ERR, .host_err.state = state };
+    return me_value_guest_nil_new();
+  }
+
+  switch (data.type) {
+  case ME_VALUE_HOST_DATA_TIME:
+    if (!data.in_range) {
+      *err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+      return me_value_guest_nil_new();
+    }
+    return me_value_guest_time_new(engine, data.seconds, data.microseconds, data.utc, err);
+  case ME_VALUE_HOST_DATA_DECIMAL:
+    if (!data.in_range) {
+      *err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+      return me_value_guest_nil_new();
+    }
+    return me_value_guest_decimal_new(engine, data.bytes, data.size, err);
+  default:
+    *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+    return me_value_guest_nil_new();
+  }
+}
+
+// Converts anything but arrays and hashes, which are left to the caller.
+static bool me_value_to_guest_leaf(
+  struct me_mruby_engine *engine,
+  VALUE value,
+  me_guest_value_t *result,
+  struct me_value_err *err)
+{
+  if (me_value_to_guest_scalar(engine, value, result, err)) {
+    return true;
+  }
+
+  switch (rb_type(value)) {
+  case RUBY_T_ARRAY:
+  case RUBY_T_HASH:
+    return false;
+  case RUBY_T_FLOAT:
+    *result = me_value_guest_float_new(engine, RFLOAT_VALUE(value), err);
+    return true;
+  case RUBY_T_DATA:
+    *result = me_value_to_guest_data(engine, value, err);
+    return true;
+  case RUBY_T_STRING:
+    *result = me_value_to_guest_string(engine, value, err);
+    return true;
+  case RUBY_T_SYMBOL:
+    // Only static symbols have a stable ID; asking for the ID of a dynamic
+    // one would make it immortal.
+    if (STATIC_SYM_P(value)) {
+      *result = me_value_guest_symbol_from_host(engine, SYM2ID(value), err);
+    } else {
+      VALUE symbol_str = rb_sym2str(value);
+      *result = me_value_guest_symbol_new(
+        engine,
+        RSTRING_PTR(symbol_str),
+        RSTRING_LEN(symbol_str),
+        err);
+    }
+    return true;
+  default:
+    *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+    *result = me_value_guest_nil_new();
+    return true;
+  }
+}
+
+// An array or hash being converted. Elements are converted in order and
+// added to `target` as they complete; a hash holds on to its converted key
+// until the value is done. Hashes are walked from a copy of their pairs on
+// the work stack, since st_foreach cannot be suspended.
+struct me_value_to_guest_frame {
+  VALUE source;
+  bool array_p;
+  me_guest_value_t target;
+  long index;
+  long size;
+  size_t pairs;
+  me_guest_value_t key;
+  bool key_p;
+};
+
+#define ME_VALUE_TO_GUEST_FRAMES_INLINE 32
+#define ME_VALUE_TO_GUEST_PAIRS_INLINE 128
+
+// Covers the usual depths and sizes without allocating. The stack lives on
+// the C stack, where the host's GC finds the sources and pairs held inline.
+// Converting times and decimals runs host code, which may collect or compact
+// in the middle of the walk, so past the inline capacity they are held by
+// host arrays referenced from here instead: pairs from `live_pairs`, and
+// frame sources from `live_sources` once the frames have moved to the heap.
+// The stack belongs to the caller of the protect scope, which frees what it
+// grew to once the scope is left, so that a guest exception cannot leak it.
+struct me_value_to_guest_stack {
+  struct me_value_to_guest_frame *frames;
+  size_t frame_count;
+  size_t frame_capacity;
+  VALUE live_sources;
+  size_t pair_count;
+  VALUE live_pairs;
+  struct me_value_to_guest_frame inline_frames[ME_VALUE_TO_GUEST_FRAMES_INLINE];
+  VALUE inline_pairs[ME_VALUE_TO_GUEST_PAIRS_INLINE];
+};
+
+// Grows `*items`, initially the inline buffer `inline_items`, to hold at
+// least `count` items of `size` bytes.
+static bool me_value_stack_reserve(
+  void **items,
+  void *inline_items,
+  size_t *capacity,
+  size_t count,
+  size_t size)
+{
+  if (count <= *capacity) {
+    return true;
+  }
+
+  size_t new_capacity = *capacity * 2;
+  while (new_capacity < count) {
+    new_capacity *= 2;
+  }
+  void *new_items = *items == inline_items ?
+    malloc(new_capacity * size) :
+    realloc(*items, new_capacity * size);
+  if (new_items == NULL) {
+    return false;
+  }
+  if (*items == inline_items) {
+    memcpy(new_items, inline_items, *capacity * size);
+  }
+  *items = new_items;
+  *capacity = new_capacity;
+  return true;
+}
+
+static void me_value_to_guest_stack_init(struct me_value_to_guest_stack *stack) {
+  stack->frames = stack->inline_frames;
+  stack->frame_count = 0;
+  stack->frame_capacity = ME_VALUE_TO_GUEST_FRAMES_INLINE;
+  stack->live_sources = Qnil;
+  stack->pair_count = 0;
+  stack->live_pairs = Qnil;
+}
+
+static void me_value_to_guest_stack_destroy(struct me_value_to_guest_stack *stack) {
+  if (stack->frames != stack->inline_frames) {
+    free(stack->frames);
+  }
+}
+
+static void me_value_to_guest_stack_truncate_pairs(
+  struct me_value_to_guest_stack *stack,
+  size_t count)
+{
+  stack->pair_count = count;
+  if (!NIL_P(stack->live_pairs)) {
+    rb_ary_resize(
+      stack->live_pairs,
+      count > ME_VALUE_TO_GUEST_PAIRS_INLINE ? (long)(count - ME_VALUE_TO_GUEST_PAIRS_INLINE) : 0);
+  }
+}
+
+// Empties the stack for the next walk, keeping what it grew to.
+static void me_value_to_guest_stack_clear(struct me_value_to_guest_stack *stack) {
+  stack->frame_count = 0;
+  if (!NIL_P(stack->live_sources)) {
+    rb_ary_clear(stack->live_sources);
+  }
+  me_value_to_guest_stack_truncate_pairs(stack, 0);
+}
+
+static VALUE me_value_to_guest_stack_pair(struct me_value_to_guest_stack *stack, size_t index) {
+  if (index < ME_VALUE_TO_GUEST_PAIRS_INLINE) {
+    return stack->inline_pairs[index];
+  }
+  return RARRAY_AREF(stack->live_pairs, (long)(index - ME_VALUE_TO_GUEST_PAIRS_INLINE));
+}
+
+static VALUE me_value_to_guest_stack_source(struct me_value_to_guest_stack *stack, size_t index) {
+  if (NIL_P(stack->live_sources)) {
+    return stack->frames[index].source;
+  }
+  return RARRAY_AREF(stack->live_sources, (long)index);
+}
+
+static void me_value_to_guest_stack_push_pair(struct me_value_to_guest_stack *stack, VALUE item) {
+  if (stack->pair_count < ME_VALUE_TO_GUEST_PAIRS_INLINE) {
+    stack->inline_pairs[stack->pair_count++] = item;
+    return;
+  }
+  if (NIL_P(stack->live_pairs)) {
+    stack->live_pairs = rb_ary_new();
+  }
+  rb_ary_push(stack->live_pairs, item);
+  stack->pair_count++;
+}
+
+static int me_value_collect_pair(st_data_t kdata, st_data_t vdata, st_data_t data) {
+  struct me_value_to_guest_stack *stack = (struct me_value_to_guest_stack *)data;
+  me_value_to_guest_stack_push_pair(stack, kdata);
+  me_value_to_guest_stack_push_pair(stack, vdata);
+  return ST_CONTINUE;
+}
+
+static me_guest_value_t me_value_to_guest_enter(
+  struct me_mruby_engine *engine,
+  struct me_value_to_guest_stack *stack,
+  VALUE value,
+  struct me_value_err *err)
+{
+  if (stack->frame_count == stack->frame_capacity && NIL_P(stack->live_sources)) {
+    stack->live_sources = rb_ary_new_capa((long)stack->frame_capacity * 2);
+    for (size_t i = 0; i < stack->frame_count; ++i) {
+      rb_ary_push(stack->live_sources, stack->frames[i].source);
+    }
+  }
+  if (!me_value_stack_reserve(
+        (void **)&stack->frames,
+        stack->inline_frames,
+        &stack->frame_capacity,
+        stack->frame_count + 1,
+        sizeof(struct me_value_to_guest_frame))) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+    return me_value_guest_nil_new();
+  }
+  if (!NIL_P(stack->live_sources)) {
+    rb_ary_push(stack->live_sources, value);
+  }
+
+  struct me_value_to_guest_frame frame = (struct me_value_to_guest_frame){
+    .source = value,
+    .array_p = RB_TYPE_P(value, RUBY_T_ARRAY),
+    .index = 0,
+    .pairs = stack->pair_count,
+    .key_p = false,
+  };
+  if (frame.array_p) {
+    frame.size = RARRAY_LEN(value);
+    frame.target = me_value_guest_array_new_capa(engine, frame.size, err);
+  } else {
+    rb_hash_foreach(value, me_value_collect_pair, (VALUE)stack);
+    frame.size = (long)(stack->pair_count - frame.pairs) / 2;
+    frame.target = me_value_guest_hash_new_capa(engine, frame.size, err);
+  }
+  stack->frames[stack->frame_count++] = frame;
+  return frame.target;
+}
+
+static void me_value_to_guest_place(
+  struct me_mruby_engine *engine,
+  struct me_value_to_guest_frame *frame,
+  me_guest_value_t value,
+  struct me_value_err *err)
+{
+  if (frame->array_p) {
+    me_value_guest_array_push(engine, frame->target, value, err);
+    ++frame->index;
+  } else if (!frame->key_p) {
+    frame->key = value;
+    frame->key_p = true;
+  } else {
+    me_value_guest_hash_assoc(engine, frame->target, frame->key, value, err);
+    frame->key_p = false;
+    ++frame->index;
+  }
+}
+
+// Walks nested arrays and hashes depth first with an explicit stack instead
+// of recursing, so the depth limit is a setting rather than a bound on the C
+// stack. `depth` is the depth of `value` itself. The stack is left empty, so
+// the next walk can reuse it.
 static me_guest_value_t me_value_to_guest_r(
   struct me_mruby_engine *engine,
+  struct me_value_to_guest_stack *stack,
+  VALUE value,
+  int depth,
+  struct me_value_err *err)
+{
+  int depth_max = me_value_depth_max(engine);
+  if (depth > depth_max) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return me_value_guest_nil_new();
+  }
+
+  me_guest_value_t result;
+  if (me_value_to_guest_leaf(engine, value, &result, err)) {
+    return result;
+  }
+
+  result = me_value_to_guest_enter(engine, stack, value, err);
+  while (err->type == ME_VALUE_NO_ERR && stack->frame_count > 0) {
+    struct me_value_to_guest_frame *frame = &stack->frames[stack->frame_count - 1];
+    if (frame->index == frame->size) {
+      me_guest_value_t done = frame->target;
+      me_value_to_guest_stack_truncate_pairs(stack, frame->pairs);
+      if (!NIL_P(stack->live_sources)) {
+        rb_ary_pop(stack->live_sources);
+      }
+      if (--stack->frame_count > 0) {
+        me_value_to_guest_place(engine, &stack->frames[stack->frame_count - 1], done, err);
+      }
+      continue;
+    }
+
+    VALUE child = frame->array_p ?
+      RARRAY_AREF(me_value_to_guest_stack_source(stack, stack->frame_count - 1), frame->index) :
+      me_value_to_guest_stack_pair(stack, frame->pairs + 2 * frame->index + frame->key_p);
+    if (depth + (int)stack->frame_count > depth_max) {
+      *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+      break;
+    }
+
+    me_guest_value_t element;
+    if (me_value_to_guest_leaf(engine, child, &element, err)) {
+      if (err->type == ME_VALUE_NO_ERR) {
+        me_value_to_guest_place(engine, frame, element, err);
+      }
+    } else {
+      me_value_to_guest_enter(engine, stack, child, err);
+    }
+  }
+
+  me_value_to_guest_stack_clear(stack);
+  if (err->type != ME_VALUE_NO_ERR) {
+    return me_value_guest_nil_new();
+  }
+  return result;
+}
+
+static me_guest_value_t me_value_to_guest_schema_r(
+  struct me_mruby_engine *engine,
+  struct me_value_to_guest_stack *stack,
+  const struct me_schema *schema,
+  uint32_t index,
   VALUE value,
   int depth,
   struct me_value_err *err);
 
-struct me_value_assoc_args {
+struct me_value_schema_assoc_args {
   struct me_mruby_engine *engine;
+  struct me_value_to_guest_stack *stack;
+  const struct me_schema *schema;
+  const struct me_schema_node *node;
+  // Payloads usually list their keys in the order of the schema, so the
+  // search for a field starts right after the last one found.
+  uint32_t cursor;
   me_guest_value_t hash;
   int depth;
   struct me_value_err *err;
 };
 
-static int me_value_assoc(st_data_t kdata, st_data_t vdata, st_data_t data) {
-  struct me_value_assoc_args *args = (struct me_value_assoc_args *)data;
+static bool me_value_schema_key_eq(VALUE key, const struct me_schema_field *field) {
+  if ((me_host_value_t)key == field->key) {
+    return true;
+  }
+  return field->symbol_id == 0 &&
+    RB_TYPE_P(key, RUBY_T_STRING) &&
+    RSTRING_LEN(key) == RSTRING_LEN(field->key) &&
+    memcmp(RSTRING_PTR(key), RSTRING_PTR(field->key), RSTRING_LEN(key)) == 0;
+}
 
-  me_guest_value_t key = me_value_to_guest_r(
-    args->engine,
-    kdata,
-    args->depth + 1,
-    args->err);
-  if (args->err->type != ME_VALUE_NO_ERR) {
-    return ST_STOP;
+static const struct me_schema_field *me_value_schema_field(
+  struct me_value_schema_assoc_args *args,
+  VALUE key)
+{
+  uint32_t size = args->node->hash.size;
+  const struct me_schema_field *fields = &args->schema->fields[args->node->hash.fields];
+  for (uint32_t i = 0, j = args->cursor; i < size; ++i, ++j) {
+    if (j == size) {
+      j = 0;
+    }
+    if (me_value_schema_key_eq(key, &fields[j])) {
+      args->cursor = j + 1 == size ? 0 : j + 1;
+      return &fields[j];
+    }
   }
+  return NULL;
+}
+
+static int me_value_schema_assoc(st_data_t kdata, st_data_t vdata, st_data_t data) {
+  struct me_value_schema_assoc_args *args = (struct me_value_schema_assoc_args *)data;
 
-  me_guest_value_t value = me_value_to_guest_r(
-    args->engine,
-    vdata,
-    args->depth + 1,
-    args->err);
+  const struct me_schema_field *field = me_value_schema_field(args, kdata);
+  me_guest_value_t key;
+  me_guest_value_t value;
+  if (field == NULL) {
+    key = me_value_to_guest_r(args->engine, args->stack, kdata, args->depth + 1, args->err);
+    if (args->err->type != ME_VALUE_NO_ERR) {
+      return ST_STOP;
+    }
+    value = me_value_to_guest_r(args->engine, args->stack, vdata, args->depth + 1, args->err);
+  } else {
+    if (field->symbol_id != 0) {
+      key = me_value_guest_symbol_from_host(args->engine, field->symbol_id, args->err);
+    } else {
+      key = me_value_guest_string_new(
+        args->engine,
+        RSTRING_PTR(field->key),
+        RSTRING_LEN(field->key),
+        args->err);
+    }
+    if (args->err->type != ME_VALUE_NO_ERR) {
+      return ST_STOP;
+    }
+    value = me_value_to_guest_schema_r(
+      args->engine, args->stack, args->schema, field->node, vdata, args->depth + 1, args->err);
+  }
   if (args->err->type != ME_VALUE_NO_ERR) {
     return ST_STOP;
   }
@@ -44,52 +559,52 @@ static int me_value_assoc(st_data_t kdata, st_data_t vdata, st_data_t data) {
   return ST_CONTINUE;
 }
 
-static me_guest_value_t me_value_to_guest_r(
+static me_guest_value_t me_value_to_guest_schema_r(
   struct me_mruby_engine *engine,
+  struct me_value_to_guest_stack *stack,
+  const struct me_schema *schema,
+  uint32_t index,
   VALUE value,
   int depth,
   struct me_value_err *err)
 {
-  if (depth > ME_HOST_DATA_DEPTH_MAX) {
-    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
-    return me_value_guest_nil_new();
-  }
-
-  enum ruby_value_type type = rb_type(value);
-  switch (type) {
-  case RUBY_T_NIL:
-    return me_value_guest_nil_new();
-  case RUBY_T_FALSE:
-    return me_value_guest_false_new();
-  case RUBY_T_TRUE:
-    return me_value_guest_true_new();
-  case RUBY_T_FIXNUM:
-    return me_value_guest_fixnum_new(engine, FIX2LONG(value), err);
-  case RUBY_T_STRING:
-    return me_value_guest_string_new(
-      engine,
-      RSTRING_PTR(value),
-      RSTRING_LEN(value),
-      err);
-  case RUBY_T_SYMBOL:
-    {
-      VALUE symbol_str = rb_sym2str(value);
-      return me_value_guest_symbol_new(
-        engine,
-        RSTRING_PTR(symbol_str),
-        RSTRING_LEN(symbol_str),
-        err);
+  const struct me_schema_node *node = &schema->nodes[index];
+  switch (node->type) {
+  case ME_SCHEMA_ANY:
+    break;
+  case ME_SCHEMA_BOOLEAN:
+    if (value == Qtrue) {
+      return me_value_guest_true_new();
     }
-  case RUBY_T_ARRAY:
-    {
-      me_guest_value_t array = me_value_guest_array_new(engine, err);
+    if (value == Qfalse) {
+      return me_value_guest_false_new();
+    }
+    break;
+  case ME_SCHEMA_INTEGER:
+    if (FIXNUM_P(value)) {
+      return me_value_guest_fixnum_new(engine, FIX2LONG(value), err);
+    }
+    break;
+  case ME_SCHEMA_STRING:
+    if (RB_TYPE_P(value, RUBY_T_STRING)) {
+      return me_value_to_guest_string(engine, value, err);
+    }
+    break;
+  case ME_SCHEMA_SYMBOL:
+    if (STATIC_SYM_P(value)) {
+      return me_value_guest_symbol_from_host(engine, SYM2ID(value), err);
+    }
+    break;
+  case ME_SCHEMA_ARRAY:
+    if (depth <= me_value_depth_max(engine) && RB_TYPE_P(value, RUBY_T_ARRAY)) {
+      me_guest_value_t array = me_value_guest_array_new_capa(engine, RARRAY_LEN(value), err);
       if (err->type != ME_VALUE_NO_ERR) {
         return me_value_guest_nil_new();
       }
 
       for (long i = 0, f = RARRAY_LEN(value); i < f; ++i) {
-        me_guest_value_t element = me_value_to_guest_r(
-          engine, RARRAY_AREF(value, i), depth + 1, err);
+        me_guest_value_t element = me_value_to_guest_schema_r(
+          engine, stack, schema, node->array.element, RARRAY_AREF(value, i), depth + 1, err);
         if (err->type != ME_VALUE_NO_ERR) {
           return me_value_guest_nil_new();
         }
@@ -102,38 +617,261 @@ static me_guest_value_t me_value_to_guest_r(
 
       return array;
     }
-  case RUBY_T_HASH:
-    {
-      me_guest_value_t hash = me_value_guest_hash_new(engine, err);
+    break;
+  case ME_SCHEMA_HASH:
+    if (depth <= me_value_depth_max(engine) && RB_TYPE_P(value, RUBY_T_HASH)) {
+      me_guest_value_t hash = me_value_guest_hash_new_capa(engine, RHASH_SIZE(value), err);
       if (err->type != ME_VALUE_NO_ERR) {
-        return ME_HOST_NIL;
+        return me_value_guest_nil_new();
       }
 
-      struct me_value_assoc_args args = (struct me_value_assoc_args){
+      struct me_value_schema_assoc_args args = (struct me_value_schema_assoc_args){
         .engine = engine,
+        .stack = stack,
+        .schema = schema,
+        .node = node,
+        .cursor = 0,
         .hash = hash,
         .depth = depth,
         .err = err,
       };
-      st_foreach(RHASH_TBL(value), me_value_assoc, (st_data_t)&args);
+      st_foreach(RHASH_TBL(value), me_value_schema_assoc, (st_data_t)&args);
       if (err->type != ME_VALUE_NO_ERR) {
         return me_value_guest_nil_new();
       }
 
       return hash;
     }
-  default:
-    *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
-    return me_value_guest_nil_new();
+    break;
+  }
+
+  return me_value_to_guest_r(engine, stack, value, depth, err);
+}
+
+struct me_value_to_guest_args {
+  const struct me_schema *schema;
+  VALUE value;
+  struct me_value_to_guest_stack *stack;
+};
+
+static me_guest_value_t me_value_to_guest_body(
+  struct me_mruby_engine *engine,
+  void *data,
+  struct me_value_err *err)
+{
+  struct me_value_to_guest_args *args = data;
+  if (args->schema == NULL) {
+    return me_value_to_guest_r(engine, args->stack, args->value, 0, err);
   }
+  return me_value_to_guest_schema_r(engine, args->stack, args->schema, 0, args->value, 0, err);
 }
 
 me_guest_value_t me_value_to_guest(
   struct me_mruby_engine *engine,
+  const struct me_schema *schema,
   me_host_value_t value,
   struct me_value_err *err)
 {
-  return me_value_to_guest_r(engine, value, 0, err);
+  // Immediates cannot allocate or raise, so they skip the protect scope.
+  me_guest_value_t scalar;
+  if (me_value_to_guest_scalar(engine, value, &scalar, err)) {
+    return scalar;
+  }
+
+  struct me_value_to_guest_stack stack;
+  me_value_to_guest_stack_init(&stack);
+  struct me_value_to_guest_args args = (struct me_value_to_guest_args){
+    .schema = schema,
+    .value = value,
+    .stack = &stack,
+  };
+  me_guest_value_t result = me_value_guest_protect(engine, me_value_to_guest_body, &args, err);
+  me_value_to_guest_stack_destroy(&stack);
+  return result;
+}
+
+struct me_value_to_guest_all_args {
+  const me_host_value_t *values;
+  size_t count;
+  struct me_value_to_guest_stack *stack;
+};
+
+static me_guest_value_t me_value_to_guest_all_body(
+  struct me_mruby_engine *engine,
+  void *data,
+  struct me_value_err *err)
+{
+  struct me_value_to_guest_all_args *args = data;
+  me_guest_value_t array = me_value_guest_array_new_capa(engine, args->count, err);
+  for (size_t i = 0; i < args->count && err->type == ME_VALUE_NO_ERR; ++i) {
+    me_guest_value_t element = me_value_to_guest_r(engine, args->stack, args->values[i], 0, err);
+    if (err->type == ME_VALUE_NO_ERR) {
+      me_value_guest_array_push(engine, array, element, err);
+    }
+  }
+  return array;
+}
+
+me_guest_value_t me_value_to_guest_all(
+  struct me_mruby_engine *engine,
+  const me_host_value_t *values,
+  size_t count,
+  struct me_value_err *err)
+{
+  struct me_value_to_guest_stack stack;
+  me_value_to_guest_stack_init(&stack);
+  struct me_value_to_guest_all_args args = (struct me_value_to_guest_all_args){
+    .values = values,
+    .count = count,
+    .stack = &stack,
+  };
+  me_guest_value_t result = me_value_guest_protect(engine, me_value_to_guest_all_body, &args, err);
+  me_value_to_guest_stack_destroy(&stack);
+  return result;
+}
+
+static void me_value_to_shared_r(
+  struct me_shared_segment *segment,
+  VALUE value,
+  struct me_shared_node *node,
+  int depth,
+  struct me_value_err *err);
+
+struct me_value_shared_assoc_args {
+  struct me_shared_segment *segment;
+  struct me_shared_node *pair;
+  int depth;
+  struct me_value_err *err;
+};
+
+static int me_value_shared_assoc(st_data_t kdata, st_data_t vdata, st_data_t data) {
+  struct me_value_shared_assoc_args *args = (struct me_value_shared_assoc_args *)data;
+
+  me_value_to_shared_r(args->segment, kdata, &args->pair[0], args->depth + 1, args->err);
+  if (args->err->type != ME_VALUE_NO_ERR) {
+    return ST_STOP;
+  }
+
+  me_value_to_shared_r(args->segment, vdata, &args->pair[1], args->depth + 1, args->err);
+  if (args->err->type != ME_VALUE_NO_ERR) {
+    return ST_STOP;
+  }
+
+  args->pair += 2;
+  return ST_CONTINUE;
+}
+
+static struct me_shared_node *me_value_shared_nodes_new(
+  struct me_shared_segment *segment,
+  size_t count,
+  struct me_value_err *err)
+{
+  struct me_shared_node *nodes = me_shared_segment_nodes_new(segment, count);
+  if (nodes == NULL && count > 0) {
+    *err = (struct me_value_err){ .type = ME_VALUE_SEGMENT_FULL };
+  }
+  return nodes;
+}
+
+static void me_value_to_shared_r(
+  struct me_shared_segment *segment,
+  VALUE value,
+  struct me_shared_node *node,
+  int depth,
+  struct me_value_err *err)
+{
+  if (depth > ME_HOST_DATA_DEPTH_LIMIT) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return;
+  }
+
+  enum ruby_value_type type = rb_type(value);
+  switch (type) {
+  case RUBY_T_NIL:
+    node->type = ME_SHARED_NIL;
+    return;
+  case RUBY_T_FALSE:
+    node->type = ME_SHARED_FALSE;
+    return;
+  case RUBY_T_TRUE:
+    node->type = ME_SHARED_TRUE;
+    return;
+  case RUBY_T_FIXNUM:
+    node->type = ME_SHARED_FIXNUM;
+    node->fixnum = FIX2LONG(value);
+    return;
+  case RUBY_T_STRING:
+  case RUBY_T_SYMBOL:
+    {
+      VALUE str = type == RUBY_T_SYMBOL ? rb_sym2str(value) : value;
+      const char *bytes = me_shared_segment_bytes_new(segment, RSTRING_PTR(str), RSTRING_LEN(str));
+      if (bytes == NULL) {
+        *err = (struct me_value_err){ .type = ME_VALUE_SEGMENT_FULL };
+        return;
+      }
+
+      node->type = type == RUBY_T_SYMBOL ? ME_SHARED_SYMBOL : ME_SHARED_STRING;
+      node->string.bytes = bytes;
+      node->string.size = RSTRING_LEN(str);
+      return;
+    }
+  case RUBY_T_ARRAY:
+    {
+      long size = RARRAY_LEN(value);
+      struct me_shared_node *elements = me_value_shared_nodes_new(segment, size, err);
+      if (err->type != ME_VALUE_NO_ERR) {
+        return;
+      }
+
+      node->type = ME_SHARED_ARRAY;
+      node->children.nodes = elements;
+      node->children.size = size;
+      for (long i = 0; i < size; ++i) {
+        me_value_to_shared_r(segment, RARRAY_AREF(value, i), &elements[i], depth + 1, err);
+        if (err->type != ME_VALUE_NO_ERR) {
+          return;
+        }
+      }
+      return;
+    }
+  case RUBY_T_HASH:
+    {
+      long size = RHASH_SIZE(value);
+      struct me_shared_node *pairs = me_shared_segment_hash_new(segment, size);
+      if (pairs == NULL && size > 0) {
+        *err = (struct me_value_err){ .type = ME_VALUE_SEGMENT_FULL };
+        return;
+      }
+
+      node->type = ME_SHARED_HASH;
+      node->children.nodes = pairs;
+      node->children.size = size;
+
+      struct me_value_shared_assoc_args args = (struct me_value_shared_assoc_args){
+        .segment = segment,
+        .pair = pairs,
+        .depth = depth,
+        .err = err,
+      };
+      st_foreach(RHASH_TBL(value), me_value_shared_assoc, (st_data_t)&args);
+      if (err->type == ME_VALUE_NO_ERR) {
+        me_shared_segment_hash_index(node);
+      }
+      return;
+    }
+  default:
+    *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+    return;
+  }
+}
+
+void me_value_to_shared(
+  struct me_shared_segment *segment,
+  me_host_value_t value,
+  struct me_shared_node *node,
+  struct me_value_err *err)
+{
+  me_value_to_shared_r(segment, value, node, 0, err);
 }
 
 me_host_value_t me_value_host_fixnum_new(long value, struct me_value_err *err) {
@@ -165,6 +903,78 @@ me_host_value_t me_value_host_symbol_new(
   return ID2SYM(rb_intern3(bytes, size, rb_utf8_encoding()));
 }
 
+void me_value_host_symbol_name(
+  me_host_value_t id,
+  const char **bytes,
+  size_t *size)
+{
+  VALUE name = rb_id2str(id);
+  *bytes = RSTRING_PTR(name);
+  *size = RSTRING_LEN(name);
+}
+
+me_host_value_t me_value_host_symbol_from_id(me_host_value_t id) {
+  return ID2SYM(id);
+}
+
+me_host_value_t me_value_host_symbol_to_id(me_host_value_t symbol) {
+  return SYM2ID(symbol);
+}
+
+me_host_value_t me_value_host_float_new(double value, struct me_value_err *err) {
+  (void)err;
+  return DBL2NUM(value);
+}
+
+struct me_value_host_decimal_args {
+  const char *bytes;
+  size_t size;
+};
+
+static VALUE me_value_host_decimal_body(VALUE data) {
+  struct me_value_host_decimal_args *args = (struct me_value_host_decimal_args *)data;
+  if (!rb_const_defined(rb_cObject, me_ext_id_big_decimal)) {
+    rb_raise(me_ext_e_engine_type_error, "can't extract decimals before BigDecimal is loaded");
+  }
+  return rb_funcall(rb_mKernel, me_ext_id_big_decimal, 1, rb_str_new(args->bytes, args->size));
+}
+
+// Called in the middle of walking guest values, whose stack has to be freed
+// before a host exception unwinds any further. BigDecimal is left for the
+// application to load.
+me_host_value_t me_value_host_decimal_new(
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err)
+{
+  struct me_value_host_decimal_args args = (struct me_value_host_decimal_args){
+    .bytes = bytes,
+    .size = size,
+  };
+  int state = 0;
+  VALUE decimal = rb_protect(me_value_host_decimal_body, (VALUE)&args, &state);
+  if (state) {
+    *err = (struct me_value_err){ .type = ME_VALUE_HOST_ERR, .host_err = { .state = state } };
+    return ME_HOST_NIL;
+  }
+  return decimal;
+}
+
+// An offset of INT_MAX asks for local time and INT_MAX - 1 for UTC.
+me_host_value_t me_value_host_time_new(
+  int64_t seconds,
+  long microseconds,
+  bool utc,
+  struct me_value_err *err)
+{
+  (void)err;
+  struct timespec time = (struct timespec){
+    .tv_sec = (time_t)seconds,
+    .tv_nsec = microseconds * 1000,
+  };
+  return rb_time_timespec_new(&time, utc ? INT_MAX - 1 : INT_MAX);
+}
+
 me_host_value_t me_value_host_array_new(struct me_value_err *err) {
   (void)err;
   return rb_ary_new();
@@ -179,6 +989,10 @@ void me_value_host_array_push(
   rb_ary_push(array, element);
 }
 
+void me_value_host_array_pop(me_host_value_t array) {
+  rb_ary_pop(array);
+}
+
 me_host_value_t me_value_host_hash_new(struct me_value_err *err) {
   (void)err;
   return rb_hash_new();
@@ -193,3 +1007,212 @@ void me_value_host_hash_assoc(
   (void)err;
   rb_hash_aset(hash, key, value);
 }
+
+static void me_value_host_pack_r(
+  VALUE value,
+  struct me_buffer *buffer,
+  int depth,
+  struct me_value_err *err);
+
+struct me_value_pack_assoc_args {
+  struct me_buffer *buffer;
+  int depth;
+  struct me_value_err *err;
+};
+
+static int me_value_pack_assoc(st_data_t kdata, st_data_t vdata, st_data_t data) {
+  struct me_value_pack_assoc_args *args = (struct me_value_pack_assoc_args *)data;
+
+  me_value_host_pack_r(kdata, args->buffer, args->depth + 1, args->err);
+  if (args->err->type != ME_VALUE_NO_ERR) {
+    return ST_STOP;
+  }
+
+  me_value_host_pack_r(vdata, args->buffer, args->depth + 1, args->err);
+  if (args->err->type != ME_VALUE_NO_ERR) {
+    return ST_STOP;
+  }
+
+  return ST_CONTINUE;
+}
+
+static void me_value_host_pack_r(
+  VALUE value,
+  struct me_buffer *buffer,
+  int depth,
+  struct me_value_err *err)
+{
+  if (depth > ME_HOST_DATA_DEPTH_LIMIT) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return;
+  }
+
+  bool written;
+  switch (rb_type(value)) {
+  case RUBY_T_NIL:
+    written = me_packed_write_nil(buffer);
+    break;
+  case RUBY_T_FALSE:
+    written = me_packed_write_bool(buffer, false);
+    break;
+  case RUBY_T_TRUE:
+    written = me_packed_write_bool(buffer, true);
+    break;
+  case RUBY_T_FIXNUM:
+    written = me_packed_write_integer(buffer, FIX2LONG(value));
+    break;
+  case RUBY_T_BIGNUM:
+    {
+      int64_t integer;
+      int sign = rb_integer_pack(
+        value, &integer, 1, sizeof(integer), 0,
+        INTEGER_PACK_NATIVE_BYTE_ORDER | INTEGER_PACK_2COMP);
+      if (sign == 2 || sign == -2) {
+        *err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+        return;
+      }
+      written = me_packed_write_integer(buffer, integer);
+      break;
+    }
+  case RUBY_T_FLOAT:
+    written = me_packed_write_float(buffer, RFLOAT_VALUE(value));
+    break;
+  case RUBY_T_STRING:
+    written = me_packed_write_string(buffer, RSTRING_PTR(value), RSTRING_LEN(value));
+    break;
+  case RUBY_T_SYMBOL:
+    {
+      VALUE symbol_str = rb_sym2str(value);
+      written = me_packed_write_symbol(buffer, RSTRING_PTR(symbol_str), RSTRING_LEN(symbol_str));
+      break;
+    }
+  case RUBY_T_ARRAY:
+    if (!me_packed_write_array_header(buffer, RARRAY_LEN(value))) {
+      break;
+    }
+    for (long i = 0, f = RARRAY_LEN(value); i < f; ++i) {
+      me_value_host_pack_r(RARRAY_AREF(value, i), buffer, depth + 1, err);
+      if (err->type != ME_VALUE_NO_ERR) {
+        return;
+      }
+    }
+    return;
+  case RUBY_T_HASH:
+    {
+      if (!me_packed_write_map_header(buffer, RHASH_SIZE(value))) {
+        break;
+      }
+      struct me_value_pack_assoc_args args = (struct me_value_pack_assoc_args){
+        .buffer = buffer,
+        .depth = depth,
+        .err = err,
+      };
+      st_foreach(RHASH_TBL(value), me_value_pack_assoc, (st_data_t)&args);
+      return;
+    }
+  default:
+    *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+    return;
+  }
+
+  if (!written) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+  }
+}
+
+void me_value_host_pack(
+  me_host_value_t value,
+  struct me_buffer *buffer,
+  struct me_value_err *err)
+{
+  buffer->size = 0;
+  me_value_host_pack_r(value, buffer, 0, err);
+}
+
+static VALUE me_value_host_unpack_r(
+  struct me_packed_reader *reader,
+  int depth,
+  struct me_value_err *err)
+{
+  struct me_packed_item item;
+  if (!me_packed_read(reader, &item, err)) {
+    return Qnil;
+  }
+
+  switch (item.type) {
+  case ME_PACKED_NIL:
+    return Qnil;
+  case ME_PACKED_FALSE:
+    return Qfalse;
+  case ME_PACKED_TRUE:
+    return Qtrue;
+  case ME_PACKED_INTEGER:
+    return LL2NUM(item.integer);
+  case ME_PACKED_FLOAT:
+    return DBL2NUM(item.real);
+  case ME_PACKED_STRING:
+    return rb_enc_str_new(item.string.bytes, item.string.size, rb_utf8_encoding());
+  case ME_PACKED_BINARY:
+    return rb_str_new(item.string.bytes, item.string.size);
+  case ME_PACKED_SYMBOL:
+    return ID2SYM(rb_intern3(item.string.bytes, item.string.size, rb_utf8_encoding()));
+  case ME_PACKED_ARRAY:
+  case ME_PACKED_MAP:
+    break;
+  }
+
+  if (depth > ME_HOST_DATA_DEPTH_LIMIT) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return Qnil;
+  }
+
+  if (item.type == ME_PACKED_ARRAY) {
+    VALUE array = rb_ary_new_capa(item.count);
+    for (size_t i = 0; i < item.count; ++i) {
+      VALUE element = me_value_host_unpack_r(reader, depth + 1, err);
+      if (err->type != ME_VALUE_NO_ERR) {
+        return Qnil;
+      }
+      rb_ary_push(array, element);
+    }
+    return array;
+  }
+
+  VALUE hash = rb_hash_new();
+  for (size_t i = 0; i < item.count; ++i) {
+    VALUE key = me_value_host_unpack_r(reader, depth + 1, err);
+    if (err->type != ME_VALUE_NO_ERR) {
+      return Qnil;
+    }
+    VALUE element = me_value_host_unpack_r(reader, depth + 1, err);
+    if (err->type != ME_VALUE_NO_ERR) {
+      return Qnil;
+    }
+    rb_hash_aset(hash, key, element);
+  }
+  return hash;
+}
+
+me_host_value_t me_value_host_unpack(
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err)
+{
+  struct me_packed_reader reader = (struct me_packed_reader){
+    .start = (const uint8_t *)bytes,
+    .cursor = (const uint8_t *)bytes,
+    .end = (const uint8_t *)bytes + size,
+  };
+
+  VALUE value = me_value_host_unpack_r(&reader, 0, err);
+  if (err->type == ME_VALUE_NO_ERR && !me_packed_at_end(&reader)) {
+    *err = (struct me_value_err){
+      .type = ME_VALUE_PACK_ERR,
+      .parse_err = { .offset = (size_t)(reader.cursor - reader.start) },
+    };
+  }
+  if (err->type != ME_VALUE_NO_ERR) {
+    return Qnil;
+  }
+  return value;
+}
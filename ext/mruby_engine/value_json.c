@@ -0,0 +1,840 @@
+#include "buffer.h"
+#include "mruby_engine_private.h"
+#include "value.h"
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/class.h>
+#include <mruby/hash.h>
+#include <mruby/string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// strtod needs a NUL-terminated copy of the number; longer ones are copied to
+// the engine's pool instead of the stack.
+#define ME_JSON_NUMBER_BUFFER_SIZE 64
+
+struct me_json_parser {
+  struct me_mruby_engine *engine;
+  const char *start;
+  const char *cursor;
+  const char *end;
+  struct me_value_err *err;
+};
+
+static mrb_value me_json_syntax_error(struct me_json_parser *parser) {
+  *parser->err = (struct me_value_err){
+    .type = ME_VALUE_PARSE_ERR,
+    .parse_err = { .offset = (size_t)(parser->cursor - parser->start) },
+  };
+  return mrb_nil_value();
+}
+
+static void me_json_skip_whitespace(struct me_json_parser *parser) {
+  while (parser->cursor < parser->end) {
+    switch (*parser->cursor) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+      ++parser->cursor;
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+static bool me_json_consume_literal(struct me_json_parser *parser, const char *literal, size_t size) {
+  if ((size_t)(parser->end - parser->cursor) < size || memcmp(parser->cursor, literal, size) != 0) {
+    return false;
+  }
+  parser->cursor += size;
+  return true;
+}
+
+static int me_json_hex_digit(char c) {
+  if ('0' <= c && c <= '9') {
+    return c - '0';
+  }
+  if ('a' <= c && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if ('A' <= c && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static bool me_json_read_hex4(const char *bytes, uint32_t *code_point) {
+  uint32_t result = 0;
+  for (int i = 0; i < 4; ++i) {
+    int digit = me_json_hex_digit(bytes[i]);
+    if (digit < 0) {
+      return false;
+    }
+    result = (result << 4) | (uint32_t)digit;
+  }
+  *code_point = result;
+  return true;
+}
+
+static char *me_json_write_utf8(char *out, uint32_t code_point) {
+  if (code_point < 0x80) {
+    *out++ = (char)code_point;
+  } else if (code_point < 0x800) {
+    *out++ = (char)(0xc0 | (code_point >> 6));
+    *out++ = (char)(0x80 | (code_point & 0x3f));
+  } else if (code_point < 0x10000) {
+    *out++ = (char)(0xe0 | (code_point >> 12));
+    *out++ = (char)(0x80 | ((code_point >> 6) & 0x3f));
+    *out++ = (char)(0x80 | (code_point & 0x3f));
+  } else {
+    *out++ = (char)(0xf0 | (code_point >> 18));
+    *out++ = (char)(0x80 | ((code_point >> 12) & 0x3f));
+    *out++ = (char)(0x80 | ((code_point >> 6) & 0x3f));
+    *out++ = (char)(0x80 | (code_point & 0x3f));
+  }
+  return out;
+}
+
+// Decodes the escapes of an already validated string body. An escape never
+// decodes to more bytes than it occupies, so `out` needs at most `size` bytes.
+static size_t me_json_unescape(const char *bytes, size_t size, char *out) {
+  const char *cursor = bytes;
+  const char *end = bytes + size;
+  char *start = out;
+
+  while (cursor < end) {
+    if (*cursor != '\\') {
+      *out++ = *cursor++;
+      continue;
+    }
+
+    char escape = cursor[1];
+    cursor += 2;
+    switch (escape) {
+    case 'b': *out++ = '\b'; break;
+    case 'f': *out++ = '\f'; break;
+    case 'n': *out++ = '\n'; break;
+    case 'r': *out++ = '\r'; break;
+    case 't': *out++ = '\t'; break;
+    case 'u':
+      {
+        uint32_t code_point;
+        me_json_read_hex4(cursor, &code_point);
+        cursor += 4;
+        if (0xd800 <= code_point && code_point < 0xdc00) {
+          uint32_t low;
+          me_json_read_hex4(cursor + 2, &low);
+          cursor += 6;
+          code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+        }
+        out = me_json_write_utf8(out, code_point);
+        break;
+      }
+    default:
+      *out++ = escape;
+      break;
+    }
+  }
+
+  return (size_t)(out - start);
+}
+
+// Finds the closing quote of the string starting at the cursor, validating
+// escapes on the way so that me_json_unescape cannot fail.
+static mrb_value me_json_parse_string(struct me_json_parser *parser) {
+  const char *body = ++parser->cursor;
+  bool escaped = false;
+
+  while (parser->cursor < parser->end) {
+    unsigned char c = (unsigned char)*parser->cursor;
+    if (c == '"') {
+      break;
+    }
+    if (c < 0x20) {
+      return me_json_syntax_error(parser);
+    }
+    if (c != '\\') {
+      ++parser->cursor;
+      continue;
+    }
+
+    escaped = true;
+    if (parser->end - parser->cursor < 2) {
+      return me_json_syntax_error(parser);
+    }
+    switch (parser->cursor[1]) {
+    case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+      parser->cursor += 2;
+      break;
+    case 'u':
+      {
+        uint32_t code_point;
+        if (parser->end - parser->cursor < 6 || !me_json_read_hex4(parser->cursor + 2, &code_point)) {
+          return me_json_syntax_error(parser);
+        }
+        if (0xdc00 <= code_point && code_point < 0xe000) {
+          return me_json_syntax_error(parser);
+        }
+        parser->cursor += 6;
+        if (0xd800 <= code_point && code_point < 0xdc00) {
+          uint32_t low;
+          if (parser->end - parser->cursor < 6 ||
+              parser->cursor[0] != '\\' || parser->cursor[1] != 'u' ||
+              !me_json_read_hex4(parser->cursor + 2, &low) ||
+              low < 0xdc00 || 0xe000 <= low) {
+            return me_json_syntax_error(parser);
+          }
+          parser->cursor += 6;
+        }
+        break;
+      }
+    default:
+      return me_json_syntax_error(parser);
+    }
+  }
+
+  if (parser->cursor >= parser->end) {
+    return me_json_syntax_error(parser);
+  }
+
+  size_t size = (size_t)(parser->cursor - body);
+  ++parser->cursor;
+
+  struct mrb_state *state = parser->engine->state;
+  if (!escaped) {
+    return mrb_str_new(state, body, size);
+  }
+
+  mrb_value string = mrb_str_new(state, NULL, size);
+  size_t decoded_size = me_json_unescape(body, size, RSTRING_PTR(string));
+  return mrb_str_resize(state, string, decoded_size);
+}
+
+static mrb_value me_json_parse_number(struct me_json_parser *parser) {
+  const char *start = parser->cursor;
+  bool negative = false;
+  bool integer = true;
+
+  if (parser->cursor < parser->end && *parser->cursor == '-') {
+    negative = true;
+    ++parser->cursor;
+  }
+
+  if (parser->cursor >= parser->end) {
+    return me_json_syntax_error(parser);
+  }
+  if (*parser->cursor == '0') {
+    ++parser->cursor;
+  } else if ('1' <= *parser->cursor && *parser->cursor <= '9') {
+    while (parser->cursor < parser->end && '0' <= *parser->cursor && *parser->cursor <= '9') {
+      ++parser->cursor;
+    }
+  } else {
+    return me_json_syntax_error(parser);
+  }
+
+  if (parser->cursor < parser->end && *parser->cursor == '.') {
+    integer = false;
+    ++parser->cursor;
+    const char *digits = parser->cursor;
+    while (parser->cursor < parser->end && '0' <= *parser->cursor && *parser->cursor <= '9') {
+      ++parser->cursor;
+    }
+    if (parser->cursor == digits) {
+      return me_json_syntax_error(parser);
+    }
+  }
+
+  if (parser->cursor < parser->end && (*parser->cursor == 'e' || *parser->cursor == 'E')) {
+    integer = false;
+    ++parser->cursor;
+    if (parser->cursor < parser->end && (*parser->cursor == '+' || *parser->cursor == '-')) {
+      ++parser->cursor;
+    }
+    const char *digits = parser->cursor;
+    while (parser->cursor < parser->end && '0' <= *parser->cursor && *parser->cursor <= '9') {
+      ++parser->cursor;
+    }
+    if (parser->cursor == digits) {
+      return me_json_syntax_error(parser);
+    }
+  }
+
+  if (integer) {
+    // Accumulate negatively so that the most negative value does not
+    // overflow on its way in.
+    int64_t value = 0;
+    for (const char *digit = start + negative; digit < parser->cursor; ++digit) {
+      int d = *digit - '0';
+      if (value < (INT64_MIN + d) / 10) {
+        *parser->err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+        return mrb_nil_value();
+      }
+      value = value * 10 - d;
+    }
+    if (!negative) {
+      if (value == INT64_MIN) {
+        *parser->err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+        return mrb_nil_value();
+      }
+      value = -value;
+    }
+    if (!FIXABLE(value)) {
+      *parser->err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+      return mrb_nil_value();
+    }
+    return mrb_fixnum_value((mrb_int)value);
+  }
+
+  size_t size = (size_t)(parser->cursor - start);
+  char local[ME_JSON_NUMBER_BUFFER_SIZE];
+  struct mrb_state *state = parser->engine->state;
+  char *buffer = size < sizeof(local) ? local : mrb_malloc(state, size + 1);
+  memcpy(buffer, start, size);
+  buffer[size] = '\0';
+  double value = strtod(buffer, NULL);
+  if (buffer != local) {
+    mrb_free(state, buffer);
+  }
+
+  return mrb_float_value(state, value);
+}
+
+static mrb_value me_json_parse_value(struct me_json_parser *parser, int depth);
+
+static mrb_value me_json_parse_array(struct me_json_parser *parser, int depth) {
+  struct mrb_state *state = parser->engine->state;
+  mrb_value array = mrb_ary_new(state);
+  int arena_index = mrb_gc_arena_save(state);
+
+  ++parser->cursor;
+  me_json_skip_whitespace(parser);
+  if (parser->cursor < parser->end && *parser->cursor == ']') {
+    ++parser->cursor;
+    return array;
+  }
+
+  for (;;) {
+    mrb_value element = me_json_parse_value(parser, depth + 1);
+    if (parser->err->type != ME_VALUE_NO_ERR) {
+      return mrb_nil_value();
+    }
+    mrb_ary_push(state, array, element);
+    mrb_gc_arena_restore(state, arena_index);
+
+    me_json_skip_whitespace(parser);
+    if (parser->cursor >= parser->end) {
+      return me_json_syntax_error(parser);
+    }
+    if (*parser->cursor == ']') {
+      ++parser->cursor;
+      return array;
+    }
+    if (*parser->cursor != ',') {
+      return me_json_syntax_error(parser);
+    }
+    ++parser->cursor;
+  }
+}
+
+static mrb_value me_json_parse_object(struct me_json_parser *parser, int depth) {
+  struct mrb_state *state = parser->engine->state;
+  mrb_value hash = mrb_hash_new(state);
+  int arena_index = mrb_gc_arena_save(state);
+
+  ++parser->cursor;
+  me_json_skip_whitespace(parser);
+  if (parser->cursor < parser->end && *parser->cursor == '}') {
+    ++parser->cursor;
+    return hash;
+  }
+
+  for (;;) {
+    me_json_skip_whitespace(parser);
+    if (parser->cursor >= parser->end || *parser->cursor != '"') {
+      return me_json_syntax_error(parser);
+    }
+    mrb_value key = me_json_parse_string(parser);
+    if (parser->err->type != ME_VALUE_NO_ERR) {
+      return mrb_nil_value();
+    }
+
+    me_json_skip_whitespace(parser);
+    if (parser->cursor >= parser->end || *parser->cursor != ':') {
+      return me_json_syntax_error(parser);
+    }
+    ++parser->cursor;
+
+    mrb_value value = me_json_parse_value(parser, depth + 1);
+    if (parser->err->type != ME_VALUE_NO_ERR) {
+      return mrb_nil_value();
+    }
+    mrb_hash_set(state, hash, key, value);
+    mrb_gc_arena_restore(state, arena_index);
+
+    me_json_skip_whitespace(parser);
+    if (parser->cursor >= parser->end) {
+      return me_json_syntax_error(parser);
+    }
+    if (*parser->cursor == '}') {
+      ++parser->cursor;
+      return hash;
+    }
+    if (*parser->cursor != ',') {
+      return me_json_syntax_error(parser);
+    }
+    ++parser->cursor;
+  }
+}
+
+static mrb_value me_json_parse_value(struct me_json_parser *parser, int depth) {
+  me_json_skip_whitespace(parser);
+  if (parser->cursor >= parser->end) {
+    return me_json_syntax_error(parser);
+  }
+
+  switch (*parser->cursor) {
+  case '{':
+  case '[':
+    if (depth > me_value_depth_max(parser->engine)) {
+      *parser->err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+      return mrb_nil_value();
+    }
+    return *parser->cursor == '{'
+      ? me_json_parse_object(parser, depth)
+      : me_json_parse_array(parser, depth);
+  case '"':
+    return me_json_parse_string(parser);
+  case 't':
+    if (me_json_consume_literal(parser, "true", 4)) {
+      return mrb_true_value();
+    }
+    return me_json_syntax_error(parser);
+  case 'f':
+    if (me_json_consume_literal(parser, "false", 5)) {
+      return mrb_false_value();
+    }
+    return me_json_syntax_error(parser);
+  case 'n':
+    if (me_json_consume_literal(parser, "null", 4)) {
+      return mrb_nil_value();
+    }
+    return me_json_syntax_error(parser);
+  default:
+    return me_json_parse_number(parser);
+  }
+}
+
+me_guest_value_t me_value_guest_parse_json(
+  struct me_mruby_engine *engine,
+  const char *json,
+  size_t size,
+  struct me_value_err *err)
+{
+  struct me_json_parser parser = (struct me_json_parser){
+    .engine = engine,
+    .start = json,
+    .cursor = json,
+    .end = json + size,
+    .err = err,
+  };
+
+  mrb_value value = me_json_parse_value(&parser, 0);
+  if (err->type != ME_VALUE_NO_ERR) {
+    return me_value_guest_nil_new();
+  }
+
+  me_json_skip_whitespace(&parser);
+  if (parser.cursor != parser.end) {
+    me_json_syntax_error(&parser);
+    return me_value_guest_nil_new();
+  }
+
+  return value.w;
+}
+
+// `size_max` bounds the output together with the pairs of the hashes being
+// written, `held`; going over it stops the writer with `over_budget` set.
+struct me_json_writer {
+  struct me_mruby_engine *engine;
+  const struct me_json_options *options;
+  struct me_buffer *buffer;
+  size_t size_max;
+  size_t held;
+  bool over_budget;
+  struct me_value_err *err;
+};
+
+static bool me_json_reserve(struct me_json_writer *writer, size_t size) {
+  if (size > writer->size_max - writer->held - writer->buffer->size) {
+    writer->over_budget = true;
+    *writer->err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+    return false;
+  }
+  return true;
+}
+
+static void me_json_write(struct me_json_writer *writer, const char *bytes, size_t size) {
+  if (!me_json_reserve(writer, size)) {
+    return;
+  }
+  if (!me_buffer_append(writer->buffer, bytes, size)) {
+    *writer->err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+  }
+}
+
+static void me_json_write_char(struct me_json_writer *writer, char c) {
+  me_json_write(writer, &c, 1);
+}
+
+// Bytes are copied as is: like the rest of the conversions, strings are
+// assumed to hold UTF-8.
+static void me_json_write_string(struct me_json_writer *writer, const char *bytes, size_t size) {
+  static const char hex[] = "0123456789abcdef";
+
+  me_json_write_char(writer, '"');
+  const char *run = bytes;
+  for (const char *cursor = bytes, *end = bytes + size; cursor < end; ++cursor) {
+    unsigned char c = (unsigned char)*cursor;
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+
+    me_json_write(writer, run, (size_t)(cursor - run));
+    run = cursor + 1;
+    switch (c) {
+    case '"': me_json_write(writer, "\\\"", 2); break;
+    case '\\': me_json_write(writer, "\\\\", 2); break;
+    case '\b': me_json_write(writer, "\\b", 2); break;
+    case '\f': me_json_write(writer, "\\f", 2); break;
+    case '\n': me_json_write(writer, "\\n", 2); break;
+    case '\r': me_json_write(writer, "\\r", 2); break;
+    case '\t': me_json_write(writer, "\\t", 2); break;
+    default:
+      {
+        char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+        me_json_write(writer, escape, sizeof(escape));
+      }
+    }
+  }
+  me_json_write(writer, run, (size_t)(bytes + size - run));
+  me_json_write_char(writer, '"');
+}
+
+static void me_json_write_fixnum(struct me_json_writer *writer, mrb_int value) {
+  char digits[24];
+  int size = snprintf(digits, sizeof(digits), "%" PRId64, (int64_t)value);
+  me_json_write(writer, digits, (size_t)size);
+}
+
+static void me_json_write_float(struct me_json_writer *writer, mrb_float value) {
+  if (!isfinite(value)) {
+    *writer->err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+    return;
+  }
+
+  char digits[32];
+  int size;
+  if (writer->options->float_precision > 0) {
+    size = snprintf(digits, sizeof(digits), "%.*g", writer->options->float_precision, value);
+  } else {
+    // Widen until the text reads back as the same double.
+    for (int precision = 15; ; ++precision) {
+      size = snprintf(digits, sizeof(digits), "%.*g", precision, value);
+      if (precision == 17 || strtod(digits, NULL) == value) {
+        break;
+      }
+    }
+  }
+
+  // Keep floats recognisable as such once parsed back.
+  if (strpbrk(digits, ".e") == NULL) {
+    memcpy(digits + size, ".0", 3);
+    size += 2;
+  }
+  me_json_write(writer, digits, (size_t)size);
+}
+
+// Returns false if `value` is not a decimal. Its text is read from the data
+// rather than from Decimal#to_s, which would run script code.
+static bool me_json_write_decimal(struct me_json_writer *writer, mrb_value value) {
+  char bytes[ME_VALUE_DECIMAL_STRING_MAX];
+  size_t size;
+  if (!me_value_guest_decimal_to_s(value.w, bytes, &size, writer->err)) {
+    return false;
+  }
+  if (writer->err->type != ME_VALUE_NO_ERR) {
+    return true;
+  }
+
+  const char *digits = bytes[0] == '-' ? bytes + 1 : bytes;
+  if (!writer->options->decimal_as_number) {
+    me_json_write_string(writer, bytes, size);
+  } else if (!('0' <= *digits && *digits <= '9')) {
+    // NaN and infinities have no JSON representation.
+    *writer->err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+  } else {
+    me_json_write(writer, bytes, size);
+  }
+  return true;
+}
+
+static void me_json_write_value(struct me_json_writer *writer, mrb_value value, int depth);
+
+static void me_json_write_key(struct me_json_writer *writer, mrb_value key) {
+  switch (mrb_type(key)) {
+  case MRB_TT_STRING:
+    me_json_write_string(writer, RSTRING_PTR(key), RSTRING_LEN(key));
+    return;
+  case MRB_TT_SYMBOL:
+    {
+      mrb_int size;
+      const char *bytes = mrb_sym2name_len(writer->engine->state, mrb_symbol(key), &size);
+      me_json_write_string(writer, bytes, size);
+      return;
+    }
+  case MRB_TT_FIXNUM:
+    me_json_write_char(writer, '"');
+    me_json_write_fixnum(writer, mrb_fixnum(key));
+    me_json_write_char(writer, '"');
+    return;
+  default:
+    *writer->err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+    return;
+  }
+}
+
+static void me_json_write_hash(struct me_json_writer *writer, mrb_value hash, int depth) {
+  me_json_write_char(writer, '{');
+
+  struct me_value_guest_pair *pairs;
+  size_t count;
+  if (!me_value_guest_hash_pairs(writer->engine, hash.w, &pairs, &count)) {
+    *writer->err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+    return;
+  }
+  size_t pairs_size = count * sizeof(struct me_value_guest_pair);
+  if (!me_json_reserve(writer, pairs_size)) {
+    free(pairs);
+    return;
+  }
+  writer->held += pairs_size;
+
+  for (size_t i = 0; i < count && writer->err->type == ME_VALUE_NO_ERR; ++i) {
+    if (i > 0) {
+      me_json_write_char(writer, ',');
+    }
+    me_json_write_key(writer, (mrb_value){ .w = pairs[i].key });
+    me_json_write_char(writer, ':');
+    me_json_write_value(writer, (mrb_value){ .w = pairs[i].value }, depth + 1);
+  }
+
+  writer->held -= pairs_size;
+  free(pairs);
+  me_json_write_char(writer, '}');
+}
+
+static void me_json_write_value(struct me_json_writer *writer, mrb_value value, int depth) {
+  if (writer->err->type != ME_VALUE_NO_ERR) {
+    return;
+  }
+  if (depth > me_value_depth_max(writer->engine)) {
+    *writer->err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return;
+  }
+
+  if (mrb_nil_p(value)) {
+    me_json_write(writer, "null", 4);
+    return;
+  }
+
+  switch (mrb_type(value)) {
+  case MRB_TT_FALSE:
+    me_json_write(writer, "false", 5);
+    return;
+  case MRB_TT_TRUE:
+    me_json_write(writer, "true", 4);
+    return;
+  case MRB_TT_FIXNUM:
+    me_json_write_fixnum(writer, mrb_fixnum(value));
+    return;
+  case MRB_TT_FLOAT:
+    me_json_write_float(writer, mrb_float(value));
+    return;
+  case MRB_TT_STRING:
+  case MRB_TT_SYMBOL:
+    me_json_write_key(writer, value);
+    return;
+  case MRB_TT_ARRAY:
+    me_json_write_char(writer, '[');
+    for (mrb_int i = 0, f = RARRAY_LEN(value); i < f && writer->err->type == ME_VALUE_NO_ERR; ++i) {
+      if (i > 0) {
+        me_json_write_char(writer, ',');
+      }
+      me_json_write_value(writer, RARRAY_PTR(value)[i], depth + 1);
+    }
+    me_json_write_char(writer, ']');
+    return;
+  case MRB_TT_HASH:
+    me_json_write_hash(writer, value, depth);
+    return;
+  case MRB_TT_DATA:
+    if (me_json_write_decimal(writer, value)) {
+      return;
+    }
+    // fallthrough
+  default:
+    *writer->err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+    return;
+  }
+}
+
+// Returns false, with `err` set, if the output would go over `size_max`.
+static bool me_json_generate(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value,
+  const struct me_json_options *options,
+  struct me_buffer *buffer,
+  size_t size_max,
+  struct me_value_err *err)
+{
+  struct me_json_writer writer = (struct me_json_writer){
+    .engine = engine,
+    .options = options,
+    .buffer = buffer,
+    .size_max = size_max,
+    .held = 0,
+    .over_budget = false,
+    .err = err,
+  };
+
+  buffer->size = 0;
+  me_json_write_value(&writer, (mrb_value){ .w = value }, 0);
+  return !writer.over_budget;
+}
+
+void me_value_guest_generate_json(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value,
+  const struct me_json_options *options,
+  struct me_buffer *buffer,
+  struct me_value_err *err)
+{
+  me_json_generate(engine, value, options, buffer, SIZE_MAX, err);
+}
+
+// JSON.parse and JSON.generate do their work natively, in one step of the
+// VM. They are charged one instruction per this many bytes of JSON so that
+// large documents still count against the instruction quota.
+#define ME_JSON_BYTES_PER_INSTRUCTION 8
+
+// The output buffer is released after JSON.generate if it grew past this, so
+// that one large document does not stay allocated outside of the pool.
+#define ME_JSON_BUFFER_RETAINED_MAX ((size_t)1 << 20)
+
+static void me_json_charge(struct me_mruby_engine *engine, size_t size) {
+  me_mruby_engine_charge_instructions(engine, 1 + size / ME_JSON_BYTES_PER_INSTRUCTION);
+}
+
+static void me_json_raise(mrb_state *mrb, const char *class_name, const char *message)
+  __attribute__((noreturn));
+
+static void me_json_raise(mrb_state *mrb, const char *class_name, const char *message) {
+  struct RClass *json_module = mrb_module_get(mrb, "JSON");
+  mrb_raise(mrb, mrb_class_get_under(mrb, json_module, class_name), message);
+}
+
+static void me_json_raise_err(mrb_state *mrb, const struct me_value_err *err, const char *class_name) {
+  char message[64];
+  switch (err->type) {
+  case ME_VALUE_NO_ERR:
+    return;
+  case ME_VALUE_PARSE_ERR:
+    snprintf(message, sizeof(message), "unexpected token at offset %zu", err->parse_err.offset);
+    me_json_raise(mrb, "ParserError", message);
+  case ME_VALUE_TOO_DEEP:
+    me_json_raise(mrb, "NestingError", "nesting too deep");
+  case ME_VALUE_OUT_OF_RANGE:
+    me_json_raise(mrb, class_name, "number out of range");
+  case ME_VALUE_UNSUPPORTED:
+    me_json_raise(mrb, "GeneratorError", "can only generate nil, booleans, numbers, strings, symbols, arrays and hashes");
+  case ME_VALUE_NO_MEMORY:
+    mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+  default:
+    me_json_raise(mrb, class_name, "JSON conversion failed");
+  }
+}
+
+static mrb_value me_json_s_parse(mrb_state *mrb, mrb_value self) {
+  (void)self;
+  struct me_mruby_engine *engine = mrb->allocf_ud;
+
+  char *json;
+  mrb_int size;
+  mrb_get_args(mrb, "s", &json, &size);
+  me_json_charge(engine, size);
+
+  struct me_value_err err = { .type = ME_VALUE_NO_ERR };
+  mrb_value value = { .w = me_value_guest_parse_json(engine, json, size, &err) };
+  me_json_raise_err(mrb, &err, "ParserError");
+  return value;
+}
+
+static mrb_value me_json_s_generate(mrb_state *mrb, mrb_value self) {
+  (void)self;
+  struct me_mruby_engine *engine = mrb->allocf_ud;
+
+  mrb_value value;
+  mrb_get_args(mrb, "o", &value);
+
+  // The document ends up as a string in the pool, and costs an instruction
+  // per few bytes, so it cannot outgrow either quota. Generation stops as
+  // soon as it would, rather than once the whole document is out.
+  size_t capacity = me_memory_pool_get_capacity(engine->allocator);
+  size_t usage = me_memory_pool_get_usage(engine->allocator);
+  size_t pool_left = capacity > usage ? capacity - usage : 0;
+  uint64_t instructions_left = engine->instruction_quota - engine->instruction_count;
+  size_t size_max = pool_left;
+  if (instructions_left < size_max / ME_JSON_BYTES_PER_INSTRUCTION) {
+    size_max = (size_t)instructions_left * ME_JSON_BYTES_PER_INSTRUCTION;
+  }
+
+  struct me_json_options options = { .float_precision = 0, .decimal_as_number = false };
+  struct me_value_err err = { .type = ME_VALUE_NO_ERR };
+  struct me_buffer *buffer = &engine->output_buffer;
+  bool within_quota = me_json_generate(engine, value.w, &options, buffer, size_max, &err);
+  size_t size = buffer->size;
+  if (!within_quota) {
+    me_buffer_trim(buffer, ME_JSON_BUFFER_RETAINED_MAX);
+    me_json_charge(engine, size);
+    me_mruby_engine_signal_memory_quota_reached(engine, size);
+  }
+  if (err.type != ME_VALUE_NO_ERR) {
+    me_buffer_trim(buffer, ME_JSON_BUFFER_RETAINED_MAX);
+    me_json_raise_err(mrb, &err, "GeneratorError");
+  }
+  me_json_charge(engine, size);
+  mrb_value json = mrb_str_new(mrb, buffer->bytes, size);
+  me_buffer_trim(buffer, ME_JSON_BUFFER_RETAINED_MAX);
+  return json;
+}
+
+void me_value_guest_define_json(struct me_mruby_engine *engine) {
+  mrb_state *mrb = engine->state;
+
+  struct RClass *json_module = mrb_define_module(mrb, "JSON");
+  struct RClass *json_error = mrb_define_class_under(mrb, json_module, "JSONError", mrb->eStandardError_class);
+  struct RClass *parser_error = mrb_define_class_under(mrb, json_module, "ParserError", json_error);
+  mrb_define_class_under(mrb, json_module, "NestingError", parser_error);
+  mrb_define_class_under(mrb, json_module, "GeneratorError", json_error);
+
+  mrb_define_module_function(mrb, json_module, "parse", me_json_s_parse, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, json_module, "generate", me_json_s_generate, MRB_ARGS_REQ(1));
+}
@@ -0,0 +1,342 @@
+#include "mruby_engine_private.h"
+#include "shared_segment.h"
+#include "value.h"
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/hash.h>
+#include <mruby/string.h>
+#include <mruby/variable.h>
+#include <string.h>
+
+// Lazy values expose the arrays and hashes of a shared segment to the guest
+// without materializing them: each proxy points to its node in the segment,
+// and only creates guest values for the children the script reads. Children
+// that need an allocation are memoized in a hidden instance variable, so
+// that reading them again returns the same object.
+
+static const struct mrb_data_type me_lazy_type = { "MRubyEngine::Lazy", NULL };
+
+#define ME_LAZY_MEMO "__memo__"
+
+static const struct me_shared_node *me_lazy_node(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = mrb_data_get_ptr(mrb, self, &me_lazy_type);
+  if (node == NULL) {
+    mrb_raise(mrb, E_TYPE_ERROR, "uninitialized lazy value");
+  }
+  return node;
+}
+
+static mrb_value me_lazy_new(mrb_state *mrb, const struct me_shared_node *node) {
+  struct me_mruby_engine *engine = mrb->allocf_ud;
+  struct RClass *class = node->type == ME_SHARED_ARRAY ? engine->lazy_array_class : engine->lazy_hash_class;
+  return mrb_obj_value(mrb_data_object_alloc(mrb, class, (void *)node, &me_lazy_type));
+}
+
+// Same as materializing a shared segment, one level at a time.
+static mrb_value me_lazy_materialize(mrb_state *mrb, const struct me_shared_node *node) {
+  switch (node->type) {
+  case ME_SHARED_NIL:
+    return mrb_nil_value();
+  case ME_SHARED_FALSE:
+    return mrb_false_value();
+  case ME_SHARED_TRUE:
+    return mrb_true_value();
+  case ME_SHARED_FIXNUM:
+    return mrb_fixnum_value(node->fixnum);
+  case ME_SHARED_SYMBOL:
+    return mrb_symbol_value(mrb_intern_static(mrb, node->string.bytes, node->string.size));
+  case ME_SHARED_STRING:
+    {
+      mrb_value string = mrb_str_new_static(mrb, node->string.bytes, node->string.size);
+      MRB_SET_FROZEN_FLAG(mrb_basic_ptr(string));
+      return string;
+    }
+  default:
+    return me_lazy_new(mrb, node);
+  }
+}
+
+static mrb_value me_lazy_child(
+  mrb_state *mrb,
+  mrb_value self,
+  const struct me_shared_node *node,
+  mrb_int index,
+  mrb_int count)
+{
+  if (node->type != ME_SHARED_STRING && node->type != ME_SHARED_ARRAY && node->type != ME_SHARED_HASH) {
+    return me_lazy_materialize(mrb, node);
+  }
+
+  mrb_sym memo_name = mrb_intern_lit(mrb, ME_LAZY_MEMO);
+  mrb_value memo = mrb_iv_get(mrb, self, memo_name);
+  if (mrb_nil_p(memo)) {
+    memo = mrb_ary_new_capa(mrb, count);
+    mrb_iv_set(mrb, self, memo_name, memo);
+  }
+
+  mrb_value child = mrb_ary_ref(mrb, memo, index);
+  if (mrb_nil_p(child)) {
+    child = me_lazy_materialize(mrb, node);
+    mrb_ary_set(mrb, memo, index, child);
+  }
+  return child;
+}
+
+// Hashes in a segment are searched by the shared key equivalent to `key`.
+// Other guest values cannot be keys of a segment.
+static mrb_int me_lazy_hash_find(mrb_state *mrb, const struct me_shared_node *node, mrb_value key) {
+  struct me_shared_key shared_key;
+  if (mrb_nil_p(key)) {
+    shared_key = (struct me_shared_key){ .type = ME_SHARED_NIL };
+  } else {
+    switch (mrb_type(key)) {
+    case MRB_TT_FALSE:
+      shared_key = (struct me_shared_key){ .type = ME_SHARED_FALSE };
+      break;
+    case MRB_TT_TRUE:
+      shared_key = (struct me_shared_key){ .type = ME_SHARED_TRUE };
+      break;
+    case MRB_TT_FIXNUM:
+      shared_key = (struct me_shared_key){ .type = ME_SHARED_FIXNUM, .fixnum = mrb_fixnum(key) };
+      break;
+    case MRB_TT_STRING:
+      shared_key = (struct me_shared_key){
+        .type = ME_SHARED_STRING,
+        .bytes = RSTRING_PTR(key),
+        .size = (size_t)RSTRING_LEN(key),
+      };
+      break;
+    case MRB_TT_SYMBOL:
+      {
+        mrb_int size;
+        const char *bytes = mrb_sym2name_len(mrb, mrb_symbol(key), &size);
+        shared_key = (struct me_shared_key){ .type = ME_SHARED_SYMBOL, .bytes = bytes, .size = (size_t)size };
+        break;
+      }
+    default:
+      return -1;
+    }
+  }
+  return (mrb_int)me_shared_hash_find(node, &shared_key);
+}
+
+static mrb_value me_lazy_size(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value((mrb_int)me_lazy_node(mrb, self)->children.size);
+}
+
+static mrb_value me_lazy_array_aref(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = me_lazy_node(mrb, self);
+  mrb_int index;
+  mrb_get_args(mrb, "i", &index);
+
+  mrb_int size = (mrb_int)node->children.size;
+  if (index < 0) {
+    index += size;
+  }
+  if (index < 0 || size <= index) {
+    return mrb_nil_value();
+  }
+  return me_lazy_child(mrb, self, &node->children.nodes[index], index, size);
+}
+
+static mrb_value me_lazy_array_each(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = me_lazy_node(mrb, self);
+  mrb_value block;
+  mrb_get_args(mrb, "&", &block);
+  if (mrb_nil_p(block)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+  }
+
+  mrb_int size = (mrb_int)node->children.size;
+  for (mrb_int i = 0; i < size; ++i) {
+    mrb_yield(mrb, block, me_lazy_child(mrb, self, &node->children.nodes[i], i, size));
+  }
+  return self;
+}
+
+static mrb_value me_lazy_array_to_a(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = me_lazy_node(mrb, self);
+  mrb_int size = (mrb_int)node->children.size;
+  mrb_value array = mrb_ary_new_capa(mrb, size);
+  for (mrb_int i = 0; i < size; ++i) {
+    mrb_ary_push(mrb, array, me_lazy_child(mrb, self, &node->children.nodes[i], i, size));
+  }
+  return array;
+}
+
+static mrb_value me_lazy_hash_aref(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = me_lazy_node(mrb, self);
+  mrb_value key;
+  mrb_get_args(mrb, "o", &key);
+
+  mrb_int index = me_lazy_hash_find(mrb, node, key);
+  if (index < 0) {
+    return mrb_nil_value();
+  }
+  mrb_int size = (mrb_int)node->children.size;
+  return me_lazy_child(mrb, self, &node->children.nodes[2 * index + 1], index, size);
+}
+
+static mrb_value me_lazy_hash_key_p(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = me_lazy_node(mrb, self);
+  mrb_value key;
+  mrb_get_args(mrb, "o", &key);
+
+  return mrb_bool_value(me_lazy_hash_find(mrb, node, key) >= 0);
+}
+
+static mrb_value me_lazy_hash_keys(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = me_lazy_node(mrb, self);
+  mrb_value keys = mrb_ary_new_capa(mrb, node->children.size);
+  for (size_t i = 0; i < node->children.size; ++i) {
+    mrb_ary_push(mrb, keys, me_lazy_materialize(mrb, &node->children.nodes[2 * i]));
+  }
+  return keys;
+}
+
+static mrb_value me_lazy_hash_each(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = me_lazy_node(mrb, self);
+  mrb_value block;
+  mrb_get_args(mrb, "&", &block);
+  if (mrb_nil_p(block)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no block given");
+  }
+
+  mrb_int size = (mrb_int)node->children.size;
+  for (mrb_int i = 0; i < size; ++i) {
+    const struct me_shared_node *pair = &node->children.nodes[2 * i];
+    mrb_value key = me_lazy_materialize(mrb, &pair[0]);
+    mrb_value value = me_lazy_child(mrb, self, &pair[1], i, size);
+    mrb_yield(mrb, block, mrb_assoc_new(mrb, key, value));
+  }
+  return self;
+}
+
+static mrb_value me_lazy_hash_to_h(mrb_state *mrb, mrb_value self) {
+  const struct me_shared_node *node = me_lazy_node(mrb, self);
+  mrb_int size = (mrb_int)node->children.size;
+  mrb_value hash = mrb_hash_new_capa(mrb, size);
+  for (mrb_int i = 0; i < size; ++i) {
+    const struct me_shared_node *pair = &node->children.nodes[2 * i];
+    mrb_hash_set(mrb, hash, me_lazy_materialize(mrb, &pair[0]), me_lazy_child(mrb, self, &pair[1], i, size));
+  }
+  return hash;
+}
+
+static struct RClass *me_lazy_define_class(mrb_state *mrb, const char *name) {
+  struct RClass *class = mrb_define_class(mrb, name, mrb->object_class);
+  MRB_SET_INSTANCE_TT(class, MRB_TT_DATA);
+  mrb_undef_class_method(mrb, class, "new");
+  mrb_include_module(mrb, class, mrb_module_get(mrb, "Enumerable"));
+  mrb_define_method(mrb, class, "size", me_lazy_size, MRB_ARGS_NONE());
+  mrb_define_method(mrb, class, "length", me_lazy_size, MRB_ARGS_NONE());
+  return class;
+}
+
+static void me_lazy_define_classes(struct me_mruby_engine *engine) {
+  mrb_state *mrb = engine->state;
+
+  struct RClass *array_class = me_lazy_define_class(mrb, "LazyArray");
+  mrb_define_method(mrb, array_class, "[]", me_lazy_array_aref, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, array_class, "each", me_lazy_array_each, MRB_ARGS_BLOCK());
+  mrb_define_method(mrb, array_class, "to_a", me_lazy_array_to_a, MRB_ARGS_NONE());
+
+  struct RClass *hash_class = me_lazy_define_class(mrb, "LazyHash");
+  mrb_define_method(mrb, hash_class, "[]", me_lazy_hash_aref, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, hash_class, "key?", me_lazy_hash_key_p, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, hash_class, "has_key?", me_lazy_hash_key_p, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, hash_class, "include?", me_lazy_hash_key_p, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, hash_class, "keys", me_lazy_hash_keys, MRB_ARGS_NONE());
+  mrb_define_method(mrb, hash_class, "each", me_lazy_hash_each, MRB_ARGS_BLOCK());
+  mrb_define_method(mrb, hash_class, "to_h", me_lazy_hash_to_h, MRB_ARGS_NONE());
+
+  engine->lazy_array_class = array_class;
+  engine->lazy_hash_class = hash_class;
+}
+
+static me_guest_value_t me_value_guest_lazy_body(
+  struct me_mruby_engine *engine,
+  void *data,
+  struct me_value_err *err)
+{
+  (void)err;
+  const struct me_shared_node *node = data;
+  if (engine->lazy_array_class == NULL) {
+    me_lazy_define_classes(engine);
+  }
+  return me_lazy_materialize(engine->state, node).w;
+}
+
+me_guest_value_t me_value_guest_lazy(
+  struct me_mruby_engine *engine,
+  const struct me_shared_node *node,
+  struct me_value_err *err)
+{
+  return me_value_guest_protect(engine, me_value_guest_lazy_body, (void *)node, err);
+}
+
+const struct me_shared_node *me_value_guest_lazy_node(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value)
+{
+  return mrb_data_check_get_ptr(engine->state, (mrb_value){ .w = value }, &me_lazy_type);
+}
+
+me_host_value_t me_value_lazy_to_host(
+  struct me_mruby_engine *engine,
+  const struct me_shared_node *node,
+  int depth,
+  struct me_value_err *err)
+{
+  if (depth > me_value_depth_max(engine)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return ME_HOST_NIL;
+  }
+
+  switch (node->type) {
+  case ME_SHARED_NIL:
+    return ME_HOST_NIL;
+  case ME_SHARED_FALSE:
+    return ME_HOST_FALSE;
+  case ME_SHARED_TRUE:
+    return ME_HOST_TRUE;
+  case ME_SHARED_FIXNUM:
+    return me_value_host_fixnum_new(node->fixnum, err);
+  case ME_SHARED_STRING:
+    return me_value_host_string_new(node->string.bytes, node->string.size, err);
+  case ME_SHARED_SYMBOL:
+    return me_value_host_symbol_new(node->string.bytes, node->string.size, err);
+  case ME_SHARED_ARRAY:
+    {
+      me_host_value_t array = me_value_host_array_new(err);
+      for (size_t i = 0; i < node->children.size && err->type == ME_VALUE_NO_ERR; ++i) {
+        me_host_value_t element = me_value_lazy_to_host(engine, &node->children.nodes[i], depth + 1, err);
+        if (err->type == ME_VALUE_NO_ERR) {
+          me_value_host_array_push(array, element, err);
+        }
+      }
+      return err->type == ME_VALUE_NO_ERR ? array : ME_HOST_NIL;
+    }
+  case ME_SHARED_HASH:
+    {
+      me_host_value_t hash = me_value_host_hash_new(err);
+      for (size_t i = 0; i < node->children.size && err->type == ME_VALUE_NO_ERR; ++i) {
+        const struct me_shared_node *pair = &node->children.nodes[2 * i];
+        me_host_value_t key = me_value_lazy_to_host(engine, &pair[0], depth + 1, err);
+        if (err->type != ME_VALUE_NO_ERR) {
+          break;
+        }
+        me_host_value_t value = me_value_lazy_to_host(engine, &pair[1], depth + 1, err);
+        if (err->type == ME_VALUE_NO_ERR) {
+          me_value_host_hash_assoc(hash, key, value, err);
+        }
+      }
+      return err->type == ME_VALUE_NO_ERR ? hash : ME_HOST_NIL;
+    }
+  default:
+    *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+    return ME_HOST_NIL;
+  }
+}
@@ -0,0 +1,198 @@
+#include "mruby_engine_private.h"
+#include "packed.h"
+#include "value.h"
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/hash.h>
+#include <mruby/string.h>
+#include <stdlib.h>
+
+static void me_value_guest_pack_r(
+  struct me_mruby_engine *engine,
+  mrb_value value,
+  struct me_buffer *buffer,
+  int depth,
+  struct me_value_err *err)
+{
+  if (depth > me_value_depth_max(engine)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return;
+  }
+
+  bool written;
+  if (mrb_nil_p(value)) {
+    written = me_packed_write_nil(buffer);
+  } else {
+    switch (mrb_type(value)) {
+    case MRB_TT_FALSE:
+      written = me_packed_write_bool(buffer, false);
+      break;
+    case MRB_TT_TRUE:
+      written = me_packed_write_bool(buffer, true);
+      break;
+    case MRB_TT_FIXNUM:
+      written = me_packed_write_integer(buffer, mrb_fixnum(value));
+      break;
+    case MRB_TT_FLOAT:
+      written = me_packed_write_float(buffer, mrb_float(value));
+      break;
+    case MRB_TT_STRING:
+      written = me_packed_write_string(buffer, RSTRING_PTR(value), RSTRING_LEN(value));
+      break;
+    case MRB_TT_SYMBOL:
+      {
+        mrb_int size;
+        const char *bytes = mrb_sym2name_len(engine->state, mrb_symbol(value), &size);
+        written = me_packed_write_symbol(buffer, bytes, size);
+        break;
+      }
+    case MRB_TT_ARRAY:
+      if (!(written = me_packed_write_array_header(buffer, RARRAY_LEN(value)))) {
+        break;
+      }
+      for (mrb_int i = 0, f = RARRAY_LEN(value); i < f; ++i) {
+        me_value_guest_pack_r(engine, RARRAY_PTR(value)[i], buffer, depth + 1, err);
+        if (err->type != ME_VALUE_NO_ERR) {
+          return;
+        }
+      }
+      break;
+    case MRB_TT_HASH:
+      {
+        struct me_value_guest_pair *pairs;
+        size_t count;
+        written = me_value_guest_hash_pairs(engine, value.w, &pairs, &count) &&
+          me_packed_write_map_header(buffer, count);
+        for (size_t i = 0; written && i < count; ++i) {
+          me_value_guest_pack_r(engine, (mrb_value){ .w = pairs[i].key }, buffer, depth + 1, err);
+          if (err->type != ME_VALUE_NO_ERR) {
+            break;
+          }
+          me_value_guest_pack_r(engine, (mrb_value){ .w = pairs[i].value }, buffer, depth + 1, err);
+          if (err->type != ME_VALUE_NO_ERR) {
+            break;
+          }
+        }
+        free(pairs);
+        break;
+      }
+    default:
+      *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+      return;
+    }
+  }
+
+  if (!written && err->type == ME_VALUE_NO_ERR) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+  }
+}
+
+void me_value_guest_pack(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value,
+  struct me_buffer *buffer,
+  struct me_value_err *err)
+{
+  buffer->size = 0;
+  me_value_guest_pack_r(engine, (mrb_value){ .w = value }, buffer, 0, err);
+}
+
+static mrb_value me_value_guest_unpack_r(
+  struct me_mruby_engine *engine,
+  struct me_packed_reader *reader,
+  int depth,
+  struct me_value_err *err)
+{
+  struct mrb_state *state = engine->state;
+  struct me_packed_item item;
+  if (!me_packed_read(reader, &item, err)) {
+    return mrb_nil_value();
+  }
+
+  switch (item.type) {
+  case ME_PACKED_NIL:
+    return mrb_nil_value();
+  case ME_PACKED_FALSE:
+    return mrb_false_value();
+  case ME_PACKED_TRUE:
+    return mrb_true_value();
+  case ME_PACKED_INTEGER:
+    if (!FIXABLE(item.integer)) {
+      *err = (struct me_value_err){ .type = ME_VALUE_OUT_OF_RANGE };
+      return mrb_nil_value();
+    }
+    return mrb_fixnum_value((mrb_int)item.integer);
+  case ME_PACKED_FLOAT:
+    return mrb_float_value(state, item.real);
+  case ME_PACKED_STRING:
+  case ME_PACKED_BINARY:
+    return mrb_str_new(state, item.string.bytes, item.string.size);
+  case ME_PACKED_SYMBOL:
+    return mrb_symbol_value(mrb_intern(state, item.string.bytes, item.string.size));
+  case ME_PACKED_ARRAY:
+  case ME_PACKED_MAP:
+    break;
+  }
+
+  if (depth > me_value_depth_max(engine)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return mrb_nil_value();
+  }
+
+  // Containers are pre-sized from their header, which me_packed_read has
+  // already checked against the remaining input.
+  if (item.type == ME_PACKED_ARRAY) {
+    mrb_value array = mrb_ary_new_capa(state, item.count);
+    int arena_index = mrb_gc_arena_save(state);
+    for (size_t i = 0; i < item.count; ++i) {
+      mrb_value element = me_value_guest_unpack_r(engine, reader, depth + 1, err);
+      if (err->type != ME_VALUE_NO_ERR) {
+        return mrb_nil_value();
+      }
+      mrb_ary_push(state, array, element);
+      mrb_gc_arena_restore(state, arena_index);
+    }
+    return array;
+  }
+
+  mrb_value hash = mrb_hash_new_capa(state, item.count);
+  int arena_index = mrb_gc_arena_save(state);
+  for (size_t i = 0; i < item.count; ++i) {
+    mrb_value key = me_value_guest_unpack_r(engine, reader, depth + 1, err);
+    if (err->type != ME_VALUE_NO_ERR) {
+      return mrb_nil_value();
+    }
+    mrb_value value = me_value_guest_unpack_r(engine, reader, depth + 1, err);
+    if (err->type != ME_VALUE_NO_ERR) {
+      return mrb_nil_value();
+    }
+    mrb_hash_set(state, hash, key, value);
+    mrb_gc_arena_restore(state, arena_index);
+  }
+  return hash;
+}
+
+me_guest_value_t me_value_guest_unpack(
+  struct me_mruby_engine *engine,
+  const char *bytes,
+  size_t size,
+  struct me_value_err *err)
+{
+  struct me_packed_reader reader = (struct me_packed_reader){
+    .start = (const uint8_t *)bytes,
+    .cursor = (const uint8_t *)bytes,
+    .end = (const uint8_t *)bytes + size,
+  };
+
+  mrb_value value = me_value_guest_unpack_r(engine, &reader, 0, err);
+  if (err->type == ME_VALUE_NO_ERR && !me_packed_at_end(&reader)) {
+    *err = (struct me_value_err){
+      .type = ME_VALUE_PACK_ERR,
+      .parse_err = { .offset = (size_t)(reader.cursor - reader.start) },
+    };
+  }
+  if (err->type != ME_VALUE_NO_ERR) {
+    return me_value_guest_nil_new();
+  }
+  return value.w;
+}
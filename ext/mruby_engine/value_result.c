@@ -0,0 +1,189 @@
+#include "mruby_engine_private.h"
+#include "result_buffer.h"
+#include "value.h"
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/hash.h>
+#include <mruby/string.h>
+#include <stdlib.h>
+
+static bool me_value_result_bytes(
+  struct me_result_buffer *buffer,
+  uint32_t index,
+  enum me_result_node_type type,
+  const char *bytes,
+  size_t size)
+{
+  uint32_t offset;
+  if (size > UINT32_MAX || !me_result_buffer_bytes_new(buffer, bytes, size, &offset)) {
+    return false;
+  }
+  buffer->nodes[index] = (struct me_result_node){
+    .type = type,
+    .size = (uint32_t)size,
+    .offset = offset,
+  };
+  return true;
+}
+
+// Children are reserved together, before any of them is written, so that they
+// end up consecutive. Nodes are addressed by index throughout since every
+// reservation may move them.
+static void me_value_guest_to_result_r(
+  struct me_mruby_engine *engine,
+  mrb_value value,
+  struct me_result_buffer *buffer,
+  uint32_t index,
+  int depth,
+  struct me_value_err *err)
+{
+  if (depth > me_value_depth_max(engine)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return;
+  }
+
+  bool written = true;
+  if (mrb_nil_p(value)) {
+    buffer->nodes[index] = (struct me_result_node){ .type = ME_RESULT_NIL };
+  } else {
+    switch (mrb_type(value)) {
+    case MRB_TT_FALSE:
+      buffer->nodes[index] = (struct me_result_node){ .type = ME_RESULT_FALSE };
+      break;
+    case MRB_TT_TRUE:
+      buffer->nodes[index] = (struct me_result_node){ .type = ME_RESULT_TRUE };
+      break;
+    case MRB_TT_FIXNUM:
+      buffer->nodes[index] = (struct me_result_node){
+        .type = ME_RESULT_INTEGER,
+        .integer = mrb_fixnum(value),
+      };
+      break;
+    case MRB_TT_FLOAT:
+      buffer->nodes[index] = (struct me_result_node){
+        .type = ME_RESULT_FLOAT,
+        .real = mrb_float(value),
+      };
+      break;
+    case MRB_TT_STRING:
+      written = me_value_result_bytes(
+        buffer, index, ME_RESULT_STRING, RSTRING_PTR(value), RSTRING_LEN(value));
+      break;
+    case MRB_TT_SYMBOL:
+      {
+        mrb_int size;
+        const char *bytes = mrb_sym2name_len(engine->state, mrb_symbol(value), &size);
+        written = me_value_result_bytes(buffer, index, ME_RESULT_SYMBOL, bytes, size);
+        break;
+      }
+    case MRB_TT_ARRAY:
+      {
+        mrb_int size = RARRAY_LEN(value);
+        uint32_t first;
+        if (!(written = me_result_buffer_nodes_new(buffer, size, &first))) {
+          break;
+        }
+        buffer->nodes[index] = (struct me_result_node){
+          .type = ME_RESULT_ARRAY,
+          .size = (uint32_t)size,
+          .first = first,
+        };
+        for (mrb_int i = 0; i < size; ++i) {
+          me_value_guest_to_result_r(
+            engine, RARRAY_PTR(value)[i], buffer, first + (uint32_t)i, depth + 1, err);
+          if (err->type != ME_VALUE_NO_ERR) {
+            return;
+          }
+        }
+        break;
+      }
+    case MRB_TT_HASH:
+      {
+        struct me_value_guest_pair *pairs;
+        size_t count;
+        uint32_t first;
+        if (!me_value_guest_hash_pairs(engine, value.w, &pairs, &count)) {
+          written = false;
+          break;
+        }
+        if (count > UINT32_MAX / 2 || !me_result_buffer_nodes_new(buffer, 2 * count, &first)) {
+          free(pairs);
+          written = false;
+          break;
+        }
+        buffer->nodes[index] = (struct me_result_node){
+          .type = ME_RESULT_HASH,
+          .size = (uint32_t)count,
+          .first = first,
+        };
+        for (size_t i = 0; i < count; ++i) {
+          uint32_t key = first + 2 * (uint32_t)i;
+          me_value_guest_to_result_r(
+            engine, (mrb_value){ .w = pairs[i].key }, buffer, key, depth + 1, err);
+          if (err->type != ME_VALUE_NO_ERR) {
+            break;
+          }
+          me_value_guest_to_result_r(
+            engine, (mrb_value){ .w = pairs[i].value }, buffer, key + 1, depth + 1, err);
+          if (err->type != ME_VALUE_NO_ERR) {
+            break;
+          }
+        }
+        free(pairs);
+        break;
+      }
+    case MRB_TT_DATA:
+      {
+        char bytes[ME_VALUE_DECIMAL_STRING_MAX];
+        size_t size;
+        int64_t seconds;
+        long microseconds;
+        bool utc;
+        if (me_value_guest_decimal_to_s(value.w, bytes, &size, err)) {
+          if (err->type == ME_VALUE_NO_ERR) {
+            written = me_value_result_bytes(buffer, index, ME_RESULT_DECIMAL, bytes, size);
+          }
+          break;
+        }
+        if (me_value_guest_time_get(value.w, &seconds, &microseconds, &utc, err)) {
+          if (err->type == ME_VALUE_NO_ERR) {
+            buffer->nodes[index] = (struct me_result_node){
+              .type = utc ? ME_RESULT_UTC_TIME : ME_RESULT_TIME,
+              .size = (uint32_t)microseconds,
+              .integer = seconds,
+            };
+          }
+          break;
+        }
+        *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+        return;
+      }
+    default:
+      *err = (struct me_value_err){ .type = ME_VALUE_UNSUPPORTED };
+      return;
+    }
+  }
+
+  if (!written && err->type == ME_VALUE_NO_ERR) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+  }
+}
+
+void me_value_guest_to_result(
+  struct me_mruby_engine *engine,
+  me_guest_value_t value,
+  struct me_result_buffer *buffer,
+  struct me_value_err *err)
+{
+  me_result_buffer_clear(buffer);
+
+  uint32_t root;
+  if (!me_result_buffer_nodes_new(buffer, 1, &root)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+    return;
+  }
+  me_value_guest_to_result_r(engine, (mrb_value){ .w = value }, buffer, root, 0, err);
+  if (err->type != ME_VALUE_NO_ERR) {
+    me_result_buffer_clear(buffer);
+  }
+}
@@ -0,0 +1,221 @@
+#include "mruby_engine_private.h"
+#include "tracker.h"
+#include "value.h"
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/hash.h>
+#include <mruby/khash.h>
+#include <mruby/string.h>
+#include <stdlib.h>
+
+static uint64_t me_value_digest_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+  return h;
+}
+
+// Digests are shallow: a container only covers which values it holds, as
+// nested containers and strings have digests of their own. Hash entries are
+// combined in any order, since rehashing a table reorders it.
+static bool me_value_guest_digest(mrb_value value, uint64_t *digest) {
+  if (mrb_nil_p(value)) {
+    return false;
+  }
+
+  switch (mrb_type(value)) {
+  case MRB_TT_STRING:
+    {
+      uint64_t h = UINT64_C(14695981039346656037);
+      const uint8_t *bytes = (const uint8_t *)RSTRING_PTR(value);
+      for (mrb_int i = 0, f = RSTRING_LEN(value); i < f; ++i) {
+        h = (h ^ bytes[i]) * UINT64_C(1099511628211);
+      }
+      *digest = me_value_digest_mix(h ^ (uint64_t)RSTRING_LEN(value));
+      return true;
+    }
+  case MRB_TT_ARRAY:
+    {
+      uint64_t h = me_value_digest_mix((uint64_t)RARRAY_LEN(value));
+      for (mrb_int i = 0, f = RARRAY_LEN(value); i < f; ++i) {
+        h = me_value_digest_mix(h ^ RARRAY_PTR(value)[i].w);
+      }
+      *digest = h;
+      return true;
+    }
+  case MRB_TT_HASH:
+    {
+      uint64_t h = 0;
+      khash_t(ht) *table = RHASH_TBL(value);
+      if (table != NULL) {
+        for (khiter_t k = kh_begin(table); k != kh_end(table); ++k) {
+          if (kh_exist(table, k)) {
+            h += me_value_digest_mix(kh_key(table, k).w ^ me_value_digest_mix(kh_value(table, k).v.w));
+          }
+        }
+        h ^= me_value_digest_mix(kh_size(table));
+      }
+      *digest = h;
+      return true;
+    }
+  default:
+    return false;
+  }
+}
+
+static bool me_value_guest_track_r(
+  struct me_mruby_engine *engine,
+  uint64_t owner,
+  mrb_value value,
+  int depth)
+{
+  uint64_t digest;
+  if (depth > me_value_depth_max(engine) || !me_value_guest_digest(value, &digest)) {
+    return true;
+  }
+  if (!me_tracker_put(&engine->tracker, owner, (uint64_t)(uintptr_t)mrb_ptr(value), digest)) {
+    return false;
+  }
+
+  if (mrb_array_p(value)) {
+    for (mrb_int i = 0, f = RARRAY_LEN(value); i < f; ++i) {
+      if (!me_value_guest_track_r(engine, owner, RARRAY_PTR(value)[i], depth + 1)) {
+        return false;
+      }
+    }
+  } else if (mrb_hash_p(value)) {
+    khash_t(ht) *table = RHASH_TBL(value);
+    for (khiter_t k = kh_begin(table); table != NULL && k != kh_end(table); ++k) {
+      if (kh_exist(table, k) &&
+          !me_value_guest_track_r(engine, owner, kh_value(table, k).v, depth + 1)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void me_value_guest_track(
+  struct me_mruby_engine *engine,
+  uint64_t owner,
+  me_guest_value_t value,
+  struct me_value_err *err)
+{
+  if (!me_tracker_track(&engine->tracker, owner, value) ||
+      !me_value_guest_track_r(engine, owner, (mrb_value){ .w = value }, 0)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+  }
+}
+
+// Lives on the C stack, so that the host's GC sees `changes` while the
+// reported values are built; only the path is on the heap.
+struct me_value_changes {
+  struct me_mruby_engine *engine;
+  me_host_value_t changes;
+  // Hash keys and array indices leading to the value being compared.
+  mrb_value *path;
+};
+
+static void me_value_changes_report(
+  struct me_value_changes *changes,
+  mrb_value value,
+  int depth,
+  struct me_value_err *err)
+{
+  me_host_value_t path = me_value_host_array_new(err);
+  for (int i = 0; i < depth && err->type == ME_VALUE_NO_ERR; ++i) {
+    me_host_value_t step = me_value_to_host(changes->engine, changes->path[i].w, err);
+    if (err->type == ME_VALUE_NO_ERR) {
+      me_value_host_array_push(path, step, err);
+    }
+  }
+  if (err->type != ME_VALUE_NO_ERR) {
+    return;
+  }
+
+  me_host_value_t host_value = me_value_to_host(changes->engine, value.w, err);
+  if (err->type != ME_VALUE_NO_ERR) {
+    return;
+  }
+
+  me_host_value_t change = me_value_host_array_new(err);
+  me_value_host_array_push(change, path, err);
+  me_value_host_array_push(change, host_value, err);
+  me_value_host_array_push(changes->changes, change, err);
+}
+
+static void me_value_changes_r(
+  struct me_value_changes *changes,
+  mrb_value value,
+  int depth,
+  struct me_value_err *err)
+{
+  // Other values are covered by the digest of their container.
+  uint64_t digest;
+  if (!me_value_guest_digest(value, &digest)) {
+    return;
+  }
+  if (depth > me_value_depth_max(changes->engine)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_TOO_DEEP };
+    return;
+  }
+
+  uint64_t recorded;
+  if (!me_tracker_get_digest(&changes->engine->tracker, (uint64_t)(uintptr_t)mrb_ptr(value), &recorded) ||
+      recorded != digest) {
+    me_value_changes_report(changes, value, depth, err);
+    return;
+  }
+
+  if (mrb_array_p(value)) {
+    for (mrb_int i = 0, f = RARRAY_LEN(value); i < f && err->type == ME_VALUE_NO_ERR; ++i) {
+      changes->path[depth] = mrb_fixnum_value(i);
+      me_value_changes_r(changes, RARRAY_PTR(value)[i], depth + 1, err);
+    }
+  } else if (mrb_hash_p(value)) {
+    struct me_value_guest_pair *pairs;
+    size_t count;
+    if (!me_value_guest_hash_pairs(changes->engine, value.w, &pairs, &count)) {
+      *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+      return;
+    }
+    for (size_t i = 0; i < count && err->type == ME_VALUE_NO_ERR; ++i) {
+      changes->path[depth] = (mrb_value){ .w = pairs[i].key };
+      me_value_changes_r(changes, (mrb_value){ .w = pairs[i].value }, depth + 1, err);
+    }
+    free(pairs);
+  }
+}
+
+me_host_value_t me_value_to_host_changes(
+  struct me_mruby_engine *engine,
+  uint64_t owner,
+  me_guest_value_t value,
+  struct me_value_err *err)
+{
+  uint64_t root;
+  if (!me_tracker_get_root(&engine->tracker, owner, &root)) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NOT_TRACKED };
+    return ME_HOST_NIL;
+  }
+
+  struct me_value_changes changes;
+  changes.engine = engine;
+  changes.path = malloc(((size_t)me_value_depth_max(engine) + 1) * sizeof(mrb_value));
+  if (changes.path == NULL) {
+    *err = (struct me_value_err){ .type = ME_VALUE_NO_MEMORY };
+    return ME_HOST_NIL;
+  }
+  changes.changes = me_value_host_array_new(err);
+
+  if (root != value) {
+    me_value_changes_report(&changes, (mrb_value){ .w = value }, 0, err);
+  } else {
+    me_value_changes_r(&changes, (mrb_value){ .w = value }, 0, err);
+  }
+
+  free(changes.path);
+  return err->type == ME_VALUE_NO_ERR ? changes.changes : ME_HOST_NIL;
+}
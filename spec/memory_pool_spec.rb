@@ -7,5 +7,9 @@ if ENV["MRUBY_ENGINE_NATIVE_TESTS"]
         MemoryPoolTests.trigger_user_error!
       end.to raise_error(MRubyEngine::EngineInternalError, /user memory error/)
     end
+
+    it "grows the last arena block in place" do
+      expect(MemoryPoolTests.arena_realloc_in_place?).to be true
+    end
   end
 end
@@ -1,3 +1,4 @@
+require "bigdecimal"
 require "spec_helper"
 
 RSpec.describe MRubyEngine do
@@ -46,6 +47,220 @@ RSpec.describe MRubyEngine do
         MRubyEngine.new(8, reasonable_instruction_quota, reasonable_time_quota)
       }.to raise_error(ArgumentError, /^memory pool must be between 256KiB and 262144KiB/)
     end
+
+    it "runs scripts with the arena allocator" do
+      engine = MRubyEngine.new(
+        reasonable_memory_quota,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        allocator: :arena,
+        gc_disabled: true,
+      )
+      engine.sandbox_eval("arena.rb", %(@foo = (1..100).map { |i| i.to_s * 10 }))
+      expect(engine.extract("@foo").size).to eq(100)
+    end
+
+    it "enforces the memory quota with the arena allocator" do
+      engine = MRubyEngine.new(
+        1 * MEGABYTE,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        allocator: :arena,
+      )
+      expect do
+        engine.sandbox_eval("alloc_loop.rb", %(a = []; loop { a << ("foo" * 1000) }))
+      end.to raise_error(MRubyEngine::EngineMemoryQuotaError)
+    end
+
+    it "runs scripts with the TLSF allocator" do
+      engine = MRubyEngine.new(
+        reasonable_memory_quota,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        allocator: :tlsf,
+      )
+      engine.sandbox_eval("tlsf.rb", %(@foo = (1..100).map { |i| i.to_s * 10 }.join))
+      expect(engine.extract("@foo").size).to eq(1920)
+    end
+
+    it "enforces the memory quota with the TLSF allocator" do
+      engine = MRubyEngine.new(
+        1 * MEGABYTE,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        allocator: :tlsf,
+      )
+      expect do
+        engine.sandbox_eval("alloc_loop.rb", %(a = []; loop { a << ("foo" * 1000) }))
+      end.to raise_error(MRubyEngine::EngineMemoryQuotaError)
+    end
+
+    it "raises on an unknown allocator" do
+      expect {
+        MRubyEngine.new(
+          reasonable_memory_quota,
+          reasonable_instruction_quota,
+          reasonable_time_quota,
+          allocator: :jemalloc,
+        )
+      }.to raise_error(ArgumentError, "unknown allocator jemalloc")
+    end
+
+    it "collects garbage before raising a memory quota error" do
+      engine = MRubyEngine.new(
+        1 * MEGABYTE,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+      )
+      engine.sandbox_eval("garbage.rb", %(50.times { "x" * 100_000 }; @done = true))
+      expect(engine.extract("@done")).to eq(true)
+    end
+
+    it "runs scripts with a gc watermark" do
+      engine = MRubyEngine.new(
+        1 * MEGABYTE,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        gc_watermark: 0.5,
+      )
+      engine.sandbox_eval("garbage.rb", %(500.times { |i| ("x" * 1000) + i.to_s }; @done = true))
+      expect(engine.extract("@done")).to eq(true)
+    end
+
+    it "does not collect on every allocation while live data stays above the gc watermark" do
+      engine = MRubyEngine.new(
+        4 * MEGABYTE,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        gc_watermark: 0.05,
+      )
+      engine.sandbox_eval("garbage.rb", <<-SOURCE)
+        @kept = "x" * 500_000
+        20_000.times { |i| [i] }
+      SOURCE
+      expect(engine.stat[:gc_runs]).to be < 1_000
+    end
+
+    it "raises if the gc watermark is out of range" do
+      expect {
+        MRubyEngine.new(
+          reasonable_memory_quota,
+          reasonable_instruction_quota,
+          reasonable_time_quota,
+          gc_watermark: 1.5,
+        )
+      }.to raise_error(ArgumentError, "gc watermark must be within (0, 1]")
+    end
+
+    it "runs scripts with the generational gc" do
+      engine = MRubyEngine.new(
+        reasonable_memory_quota,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        gc_mode: :generational,
+        gc_interval_ratio: 150,
+        gc_step_ratio: 300,
+      )
+      engine.sandbox_eval("generational.rb", %(@foo = GC.generational_mode; 10_000.times { |i| i.to_s }))
+      expect(engine.extract("@foo")).to eq(true)
+    end
+
+    it "switches gc modes with the gc disabled" do
+      engine = MRubyEngine.new(
+        reasonable_memory_quota,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        gc_disabled: true,
+        gc_mode: :incremental,
+      )
+      engine.sandbox_eval("incremental.rb", %(@foo = GC.generational_mode))
+      expect(engine.extract("@foo")).to eq(false)
+    end
+
+    it "raises on an unknown gc mode" do
+      expect {
+        MRubyEngine.new(
+          reasonable_memory_quota,
+          reasonable_instruction_quota,
+          reasonable_time_quota,
+          gc_mode: :concurrent,
+        )
+      }.to raise_error(ArgumentError, "unknown gc mode concurrent")
+    end
+
+    it "raises if a gc ratio is not positive" do
+      expect {
+        MRubyEngine.new(
+          reasonable_memory_quota,
+          reasonable_instruction_quota,
+          reasonable_time_quota,
+          gc_step_ratio: 0,
+        )
+      }.to raise_error(ArgumentError, "gc step ratio must be positive")
+    end
+
+    it "converts values nested up to max_depth" do
+      engine = MRubyEngine.new(
+        reasonable_memory_quota,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        max_depth: 500,
+      )
+      deep = 400.times.inject([1]) { |inner, i| i.even? ? [inner] : { "k" => inner } }
+      engine.inject("@deep", deep)
+      expect(engine.extract("@deep")).to eq(deep)
+
+      engine.sandbox_eval("deeper.rb", "@deeper = [@deep] * 2; 100.times { @deeper = [@deeper] }")
+      expect do
+        engine.extract("@deeper")
+      end.to raise_error(MRubyEngine::EngineTypeError, "structure nested too deeply")
+    end
+
+    it "honours max_depth in every conversion" do
+      engine = MRubyEngine.new(
+        reasonable_memory_quota,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        max_depth: 500,
+      )
+      deep = 400.times.inject([1]) { |inner, i| i.even? ? [inner] : { "k" => inner } }
+
+      engine.inject_json("@json", JSON.generate(deep))
+      expect(engine.extract_json("@json")).to eq(JSON.generate(deep))
+
+      engine.inject_packed("@packed", MRubyEngine.pack(deep))
+      expect(MRubyEngine.unpack(engine.extract_packed("@packed"))).to eq(deep)
+      expect(engine.extract_into("@packed", MRubyEngine::ResultBuffer.new).type).to eq(:hash)
+
+      engine.inject_lazy("@lazy", MRubyEngine::SharedSegment.new(deep))
+      expect(engine.extract("@lazy")).to eq(deep)
+
+      schema = MRubyEngine::Schema.new(100.times.inject(:integer) { |inner, _| [inner] })
+      engine.inject("@schema", 100.times.inject(1) { |inner, _| [inner] }, schema: schema)
+      expect(engine.extract("@schema")).to eq(100.times.inject(1) { |inner, _| [inner] })
+
+      engine.inject("@tracked", deep, track: true)
+      engine.sandbox_eval("track.rb", <<-SOURCE)
+        inner = @tracked
+        400.times { inner = inner.is_a?(Array) ? inner[0] : inner["k"] }
+        inner << 2
+      SOURCE
+      changes = engine.extract_changes("@tracked")
+      expect(changes.size).to eq(1)
+      expect(changes[0][0].size).to eq(400)
+      expect(changes[0][1]).to eq([1, 2])
+    end
+
+    it "raises if max_depth is out of range" do
+      expect {
+        MRubyEngine.new(
+          reasonable_memory_quota,
+          reasonable_instruction_quota,
+          reasonable_time_quota,
+          max_depth: 0,
+        )
+      }.to raise_error(ArgumentError, "max depth must be within 1..1024")
+    end
   end
 
   describe "#stat" do
@@ -71,6 +286,29 @@ RSpec.describe MRubyEngine do
       expect(stat[:ctx_switches_iv]).to be nil
     end
 
+    it ":gc_runs and :gc_time are zero on a fresh engine" do
+      stat = reasonable_engine.stat
+      expect(stat[:gc_runs]).to eq(0)
+      expect(stat[:gc_time]).to eq(0)
+    end
+
+    it ":gc_live and :gc_heap_pages are non zero on a fresh engine" do
+      stat = reasonable_engine.stat
+      expect(stat[:gc_live]).to be > 0
+      expect(stat[:gc_heap_pages]).to be > 0
+    end
+
+    it ":gc_runs and :gc_time are non zero after producing garbage" do
+      engine.sandbox_eval("garbage.rb", "10_000.times { |i| i.to_s }")
+      expect(engine.stat[:gc_runs]).to be > 0
+      expect(engine.stat[:gc_time]).to be > 0
+    end
+
+    it ":gc_runs counts every full collection" do
+      engine.sandbox_eval("collect.rb", "3.times { GC.start }")
+      expect(engine.stat[:gc_runs]).to be >= 3
+    end
+
     it ":instructions is non zero after executing some code" do
       engine.sandbox_eval("addition.rb", "1 + 1")
       expect(engine.stat[:instructions]).not_to eq(0)
@@ -219,6 +457,96 @@ RSpec.describe MRubyEngine do
       engine.sandbox_eval("inject.rb", %(assert_equal(["foo", 17], @foo)))
     end
 
+    it "makes a float available inside the engine" do
+      engine.inject("@foo", [1.5, -2e3])
+      engine.sandbox_eval("inject.rb", %(assert_equal([1.5, -2000.0], @foo)))
+    end
+
+    it "makes a decimal available inside the engine" do
+      engine.inject("@foo", BigDecimal("12.34"))
+      engine.sandbox_eval("inject.rb", %(assert_equal(Decimal.new("12.34"), @foo)))
+    end
+
+    it "makes a time available inside the engine" do
+      engine.inject("@foo", Time.at(1_500_000_000, 250_000).utc)
+      engine.sandbox_eval("inject.rb", <<-SOURCE)
+        assert_equal(1_500_000_000, @foo.to_i)
+        assert_equal(250_000, @foo.usec)
+        assert_equal(true, @foo.utc?)
+      SOURCE
+    end
+
+    it "builds decimals and times without calling their constructors" do
+      engine.sandbox_eval("redefine.rb", <<-SOURCE)
+        class Decimal
+          def self.new(*); raise "redefined"; end
+        end
+        class Time
+          def self.at(*); raise "redefined"; end
+          def utc; raise "redefined"; end
+        end
+      SOURCE
+      engine.inject("@foo", [BigDecimal("12.34"), Time.at(1_500_000_000, 250_000).utc])
+      engine.sandbox_eval("inject.rb", <<-SOURCE)
+        assert_equal("12.34", @foo[0].to_s)
+        assert_equal(1_500_000_000, @foo[1].to_i)
+        assert_equal(250_000, @foo[1].usec)
+        assert_equal(true, @foo[1].utc?)
+      SOURCE
+    end
+
+    it "raises on decimals more precise than the engine's" do
+      expect do
+        engine.inject("@foo", BigDecimal("1." + "1" * 64))
+      end.to raise_error(MRubyEngine::EngineTypeError, "can't extract value out of bounds")
+    end
+
+    it "raises on times out of the engine's range" do
+      expect do
+        engine.inject("@foo", Time.at(2**60))
+      end.to raise_error(MRubyEngine::EngineTypeError, "can't extract value out of bounds")
+    end
+
+    it "raises what the host raises while reading a time and stays usable" do
+      time = Time.at(1_500_000_000)
+      def time.utc?
+        raise "host failure"
+      end
+      expect do
+        engine.inject("@foo", [time])
+      end.to raise_error(RuntimeError, "host failure")
+      engine.inject("@foo", [17])
+      engine.sandbox_eval("inject.rb", %(assert_equal([17], @foo)))
+    end
+
+    it "keeps what it converts alive while host code collects" do
+      engine = MRubyEngine.new(
+        reasonable_memory_quota,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        max_depth: 100,
+      )
+      pairs = Hash[(0...300).map { |i| ["key#{i}", "value#{i}"] }]
+      time = Time.at(1_500_000_000).utc
+      time.define_singleton_method(:utc?) do
+        pairs.clear
+        GC.start
+        GC.compact if GC.respond_to?(:compact)
+        true
+      end
+      pairs["time"] = time
+      expected = pairs.dup
+      deep = 50.times.inject([pairs]) { |inner, _| [inner] }
+
+      engine.inject("@deep", deep)
+      engine.sandbox_eval("inject.rb", <<-'SOURCE')
+        inner = @deep
+        50.times { inner = inner[0] }
+        @pairs = inner[0]
+      SOURCE
+      expect(engine.extract("@pairs")).to eq(expected)
+    end
+
     it "raise EngineQuotaAlreadyReached if quota was reached before" do
       engine = MRubyEngine.new(reasonable_memory_quota, 1, reasonable_time_quota)
       expect do
@@ -231,6 +559,127 @@ RSpec.describe MRubyEngine do
       }.to raise_error(MRubyEngine::EngineQuotaAlreadyReached)
     end
 
+    it "injects large arrays and hashes" do
+      line_items = Array.new(5_000) { |i| { "id" => i, "quantity" => 1 } }
+      engine.inject("@line_items", line_items)
+      engine.sandbox_eval("inject.rb", %(@count = @line_items.size; @last = @line_items.last["id"]))
+      expect(engine.extract("@count")).to eq(5_000)
+      expect(engine.extract("@last")).to eq(4_999)
+    end
+
+    it "lets values replaced by later injections be collected" do
+      line_items = Array.new(5_000) { |i| "line item #{i}" }
+      50.times do
+        engine.inject("@line_items", line_items)
+        engine.inject_json("@json", JSON.generate(line_items))
+      end
+      engine.sandbox_eval("inject.rb", %(@count = @line_items.size + @json.size))
+      expect(engine.extract("@count")).to eq(10_000)
+    end
+
+    it "shares equal strings when deduplicating" do
+      engine.inject("@foo", [{ "currency" => "CAD" }, { "currency" => "CAD" }], dedup: true)
+      engine.sandbox_eval("inject.rb", <<-SOURCE)
+        assert_equal(true, @foo[0]["currency"].equal?(@foo[1]["currency"]))
+        assert_equal(true, @foo[0]["currency"].frozen?)
+      SOURCE
+      expect(engine.extract("@foo")).to eq([{ "currency" => "CAD" }, { "currency" => "CAD" }])
+    end
+
+    it "keeps deduplicated strings alive while collecting during the injection" do
+      engine = MRubyEngine.new(
+        4 * MEGABYTE,
+        reasonable_instruction_quota,
+        reasonable_time_quota,
+        gc_watermark: 0.05,
+      )
+      keys = {}.compare_by_identity
+      200.times { |i| keys[+"currency"] = i }
+      line_items = Array.new(2_000) { |i| { "currency" => "CAD", "sku" => "sku-#{i % 50}" } }
+      engine.inject("@foo", [keys, line_items], dedup: true)
+      engine.sandbox_eval("inject.rb", <<-SOURCE)
+        assert_equal({ "currency" => 199 }, @foo[0])
+        assert_equal("sku-49", @foo[1][1_999]["sku"])
+        assert_equal(true, @foo[1][0]["currency"].equal?(@foo[1][1_999]["currency"]))
+      SOURCE
+    end
+
+    it "injects large frozen strings without copying them" do
+      blob = ("a,b,c\n" * 100_000).freeze
+      copied = reasonable_engine
+      copied.inject("@blob", blob)
+      borrowed = reasonable_engine
+      borrowed.inject("@blob", blob, zero_copy: true)
+      expect(borrowed.stat[:memory]).to be <= copied.stat[:memory] - blob.bytesize
+      expect(borrowed.extract("@blob")).to eq(blob)
+    end
+
+    it "copies a borrowed string when the guest writes to it" do
+      blob = ("x" * 10_000).freeze
+      engine.inject("@blob", blob, zero_copy: true)
+      engine.sandbox_eval("inject.rb", %(@blob << "!"; @blob[0] = "y"))
+      expect(engine.extract("@blob")).to eq("y" + "x" * 9_999 + "!")
+      expect(blob).to eq("x" * 10_000)
+    end
+
+    it "copies strings that are not frozen even with zero_copy" do
+      blob = "x" * 10_000
+      engine.inject("@blob", blob, zero_copy: true)
+      blob[0] = "y"
+      expect(engine.extract("@blob")).to eq("x" * 10_000)
+    end
+
+    it "deep-freezes values injected with freeze" do
+      engine.inject("@settings", { "currency" => "CAD", "tags" => ["a"] }, freeze: true)
+      engine.sandbox_eval("inject.rb", <<-SOURCE)
+        assert_equal(true, @settings.frozen?)
+        assert_equal(true, @settings["tags"].frozen?)
+        assert_equal(true, @settings["tags"][0].frozen?)
+        assert_raises(RuntimeError, /frozen/) { @settings["tags"] << "b" }
+        assert_raises(RuntimeError, /frozen/) { @settings["currency"] << "!" }
+      SOURCE
+    end
+
+    it "knows whether a frozen value is still injected" do
+      engine.inject("@settings", { "currency" => "CAD" }, freeze: true, digest: "v1")
+      engine.sandbox_eval("read.rb", %(@currency = @settings["currency"]))
+      expect(engine.injected?("@settings", "v1")).to eq(true)
+      expect(engine.injected?("@settings", "v2")).to eq(false)
+      expect(engine.injected?("@cart", "v1")).to eq(false)
+
+      engine.sandbox_eval("replace.rb", %(@settings = { "currency" => "USD" }))
+      expect(engine.injected?("@settings", "v1")).to eq(false)
+
+      engine.inject("@settings", { "currency" => "CAD" }, freeze: true, digest: "v1")
+      engine.inject("@settings", { "currency" => "EUR" })
+      expect(engine.injected?("@settings", "v1")).to eq(false)
+    end
+
+    it "raises if a digest is given without freeze" do
+      expect do
+        engine.inject("@settings", {}, digest: "v1")
+      end.to raise_error(ArgumentError, "a digest can only be given with freeze")
+    end
+
+    it "uses less memory when deduplicating" do
+      line_items = Array.new(1_000) { { "title" => "A rather long product title" * 4 } }
+      plain = reasonable_engine
+      plain.inject("@line_items", line_items)
+      deduplicated = reasonable_engine
+      deduplicated.inject("@line_items", line_items, dedup: true)
+      expect(deduplicated.stat[:memory]).to be < plain.stat[:memory]
+    end
+
+    it "raises EngineMemoryQuotaError when the value does not fit" do
+      engine = MRubyEngine.new(1 * MEGABYTE, reasonable_instruction_quota, reasonable_time_quota)
+      expect do
+        engine.inject("@foo", ["x" * 100_000] * 20)
+      end.to raise_error(MRubyEngine::EngineMemoryQuotaError)
+      expect do
+        engine.extract("@foo")
+      end.to raise_error(MRubyEngine::EngineQuotaAlreadyReached)
+    end
+
     it "memory quota reached block next instruction inject" do
       mrb_engine = MRubyEngine.new(1 * MEGABYTE, reasonable_instruction_quota, reasonable_time_quota)
       expect do
@@ -243,6 +692,189 @@ RSpec.describe MRubyEngine do
     end
   end
 
+  describe :inject_all do
+    it "raises ArgumentError if not initialized" do
+      expect do
+        MRubyEngine.allocate.inject_all("@boom" => "")
+      end.to raise_error(ArgumentError, "uninitialized value when calling 'inject_all'")
+    end
+
+    it "makes every value available inside the engine" do
+      engine.inject_all("@foo" => 17, "@bar" => ["bar", { baz: 1.5 }])
+      engine.sandbox_eval("inject.rb", %(assert_equal(17, @foo); assert_equal(["bar", { baz: 1.5 }], @bar)))
+    end
+
+    it "shares strings across values when deduplicating" do
+      engine.inject_all({ "@foo" => ["CAD"], "@bar" => ["CAD"] }, dedup: true)
+      engine.sandbox_eval("inject.rb", %(assert_equal(true, @foo[0].equal?(@bar[0]))))
+    end
+
+    it "tracks every value" do
+      engine.inject_all({ "@foo" => { "a" => [1] }, "@bar" => { "b" => [2] } }, track: true)
+      engine.sandbox_eval("inject.rb", %(@bar["b"] << 3))
+      expect(engine.extract_changes("@foo")).to eq([])
+      expect(engine.extract_changes("@bar")).to eq([[["b"], [2, 3]]])
+    end
+
+    it "injects none of the values if one cannot be converted" do
+      expect do
+        engine.inject_all("@foo" => 17, "@bar" => Object.new)
+      end.to raise_error(MRubyEngine::EngineTypeError)
+      engine.sandbox_eval("inject.rb", %(assert_equal(nil, @foo)))
+    end
+
+    it "rejects shared segments" do
+      expect do
+        engine.inject_all("@foo" => MRubyEngine::SharedSegment.new([1]))
+      end.to raise_error(ArgumentError, "shared segments must be injected one at a time")
+    end
+  end
+
+  describe :inject_lazy do
+    let(:catalogue) do
+      {
+        "products" => [
+          { "title" => "Element", "price" => 1000, "tags" => [:new, :sale] },
+          { "title" => "Fuel", "price" => 800, "tags" => [] },
+        ],
+        "currency" => "CAD",
+      }
+    end
+
+    it "exposes arrays and hashes through proxies" do
+      engine.inject_lazy("@catalogue", MRubyEngine::SharedSegment.new(catalogue))
+      engine.sandbox_eval("lazy.rb", <<-'SOURCE')
+        assert_equal("LazyHash", @catalogue.class.name)
+        assert_equal("LazyArray", @catalogue["products"].class.name)
+        assert_equal(2, @catalogue["products"].size)
+        assert_equal("Fuel", @catalogue["products"][-1]["title"])
+        assert_equal(nil, @catalogue["products"][2])
+        assert_equal(nil, @catalogue["missing"])
+        assert_equal(true, @catalogue.key?("currency"))
+        assert_equal(false, @catalogue.key?(:currency))
+        assert_equal(["products", "currency"], @catalogue.keys)
+        assert_equal([1000, 800], @catalogue["products"].map { |product| product["price"] })
+        assert_equal([:new, :sale], @catalogue["products"][0]["tags"].to_a)
+        assert_equal([["currency", "CAD"]], @catalogue.select { |key, _| key == "currency" })
+        assert_equal({ "products" => @catalogue["products"], "currency" => "CAD" }, @catalogue.to_h)
+      SOURCE
+    end
+
+    it "looks up keys of large hashes" do
+      value = Hash[(0...1000).map { |i| ["key#{i}", i] }]
+      value[:key0] = "symbol"
+      value[7] = "fixnum"
+      value[nil] = "nil"
+      engine.inject_lazy("@value", MRubyEngine::SharedSegment.new(value))
+      engine.sandbox_eval("lazy.rb", <<-'SOURCE')
+        1000.times { |i| assert_equal(i, @value["key#{i}"]) }
+        assert_equal("symbol", @value[:key0])
+        assert_equal("fixnum", @value[7])
+        assert_equal("nil", @value[nil])
+        assert_equal(nil, @value["key1000"])
+        assert_equal(false, @value.key?(:key1))
+        assert_equal(false, @value.key?(7.0))
+      SOURCE
+    end
+
+    it "raises on values that are not shared segments" do
+      expect do
+        engine.inject_lazy("@catalogue", catalogue)
+      end.to raise_error(TypeError, "lazy values must be injected from a shared segment")
+      expect(engine.extract("@catalogue")).to be nil
+    end
+
+    it "returns the same object for repeated reads" do
+      engine.inject_lazy("@catalogue", MRubyEngine::SharedSegment.new(catalogue))
+      engine.sandbox_eval("lazy.rb", <<-'SOURCE')
+        assert_equal(true, @catalogue["products"].equal?(@catalogue["products"]))
+        assert_equal(true, @catalogue["currency"].equal?(@catalogue["currency"]))
+        assert_equal(true, @catalogue["currency"].frozen?)
+      SOURCE
+    end
+
+    it "injects the same segment repeatedly" do
+      segment = MRubyEngine::SharedSegment.new(catalogue)
+      engine.inject_lazy("@catalogue", segment)
+      engine.inject_lazy("@again", segment)
+      engine.sandbox_eval("lazy.rb", %(@title = @again["products"][0]["title"]))
+      expect(engine.extract("@title")).to eq("Element")
+    end
+
+    it "materializes only what is read" do
+      segment = MRubyEngine::SharedSegment.new("products" => Array.new(10_000) { |i| { "title" => "x" * 100, "id" => i } })
+      engine.inject_lazy("@catalogue", segment)
+      engine.sandbox_eval("lazy.rb", %(@id = @catalogue["products"][9_999]["id"]))
+      expect(engine.extract("@id")).to eq(9_999)
+      expect(engine.stat[:memory]).to be < reasonable_memory_quota
+    end
+
+    it "extracts proxies as plain values" do
+      engine.inject_lazy("@catalogue", MRubyEngine::SharedSegment.new(catalogue))
+      expect(engine.extract("@catalogue")).to eq(catalogue)
+    end
+
+    it "injects scalars as they are" do
+      engine.inject_lazy("@currency", MRubyEngine::SharedSegment.new("CAD"))
+      expect(engine.extract("@currency")).to eq("CAD")
+    end
+  end
+
+  describe :inject_json do
+    it "raises ArgumentError if not initialized" do
+      expect do
+        MRubyEngine.allocate.inject_json("@boom", "{}")
+      end.to raise_error(ArgumentError, "uninitialized value when calling 'inject_json'")
+    end
+
+    it "makes a parsed document available inside the engine" do
+      document = { "id" => 17, "tags" => ["a", "b"], "paid" => true, "note" => nil, "items" => [{ "sku" => "x" }] }
+      engine.inject_json("@foo", JSON.generate(document))
+      expect(engine.extract("@foo")).to eq(document)
+    end
+
+    it "parses floats" do
+      engine.inject_json("@foo", %([1.5, -2e3]))
+      engine.sandbox_eval("inject.rb", %(assert_equal([1.5, -2000.0], @foo)))
+    end
+
+    it "decodes escapes" do
+      engine.inject_json("@foo", '["tab\\t", "\\u00e9\\ud83d\\ude00", "café"]')
+      expect(engine.extract("@foo")).to eq(["tab\t", "é😀", "café"])
+    end
+
+    it "raises JSON::ParserError on invalid documents" do
+      expect do
+        engine.inject_json("@foo", %({"a": 1,}))
+      end.to raise_error(JSON::ParserError, "unexpected token at offset 8")
+      expect do
+        engine.inject_json("@foo", %([1] 2))
+      end.to raise_error(JSON::ParserError, "unexpected token at offset 4")
+    end
+
+    it "raises on documents nested too deeply" do
+      expect do
+        engine.inject_json("@foo", "[" * 40 + "]" * 40)
+      end.to raise_error(MRubyEngine::EngineTypeError, "structure nested too deeply")
+    end
+
+    it "raises on integers that do not fit a fixnum" do
+      expect do
+        engine.inject_json("@foo", "[#{2**64}]")
+      end.to raise_error(MRubyEngine::EngineTypeError)
+    end
+
+    it "raises EngineMemoryQuotaError when the document does not fit" do
+      engine = MRubyEngine.new(1 * MEGABYTE, reasonable_instruction_quota, reasonable_time_quota)
+      expect do
+        engine.inject_json("@foo", JSON.generate(["x" * 100_000] * 20))
+      end.to raise_error(MRubyEngine::EngineMemoryQuotaError)
+      expect do
+        engine.extract("@foo")
+      end.to raise_error(MRubyEngine::EngineQuotaAlreadyReached)
+    end
+  end
+
   describe :extract do
     it "raises ArguementError if not initialized" do
       expect do
@@ -265,11 +897,52 @@ RSpec.describe MRubyEngine do
       expect(engine.extract("@sym")).to eq(:sym)
     end
 
+    it "extracts symbols that were injected or interned by the guest" do
+      engine.inject("@foo", [:injected, :"dynamic #{rand}"])
+      engine.sandbox_eval("hello.rb", "@bar = [@foo, :interned, :interned, :injected]")
+      2.times do
+        expect(engine.extract("@bar")).to eq([engine.extract("@foo"), :interned, :interned, :injected])
+      end
+      expect(engine.extract("@foo").first).to eq(:injected)
+    end
+
     it "extracts a fixnum" do
       engine.sandbox_eval("hello.rb", %(@hello = 42))
       expect(engine.extract("@hello")).to eq(42)
     end
 
+    it "extracts a float" do
+      engine.sandbox_eval("extract.rb", %(@foo = [1.5, -2e3]))
+      expect(engine.extract("@foo")).to eq([1.5, -2000.0])
+    end
+
+    it "extracts a decimal" do
+      engine.sandbox_eval("extract.rb", %(@foo = [Decimal.new("12.34"), -Decimal.new("1e30"), Decimal.new("0.1") * 3]))
+      expect(engine.extract("@foo")).to eq([BigDecimal("12.34"), BigDecimal("-1e30"), BigDecimal("0.3")])
+    end
+
+    it "raises what the host raises while building a decimal and stays usable" do
+      engine.sandbox_eval("extract.rb", %(@foo = [[1, Decimal.new("12.34")], { "a" => 2 }]))
+      allow(Kernel).to receive(:BigDecimal).and_raise(ArgumentError, "host failure")
+      expect { engine.extract("@foo") }.to raise_error(ArgumentError, "host failure")
+      allow(Kernel).to receive(:BigDecimal).and_call_original
+      expect(engine.extract("@foo")).to eq([[1, BigDecimal("12.34")], { "a" => 2 }])
+    end
+
+    it "extracts a time" do
+      engine.sandbox_eval("extract.rb", %(@utc = Time.at(1_500_000_000, 250_000).utc; @local = Time.at(1_500_000_000)))
+      utc = engine.extract("@utc")
+      expect(utc).to eq(Time.at(1_500_000_000, 250_000))
+      expect(utc).to be_utc
+      expect(engine.extract("@local")).not_to be_utc
+    end
+
+    it "round-trips floats, decimals and times" do
+      value = { "price" => BigDecimal("19.99"), "weight" => 0.25, "at" => Time.at(1_500_000_000).utc }
+      engine.inject("@foo", value)
+      expect(engine.extract("@foo")).to eq(value)
+    end
+
     it "extracts a hash" do
       value = {
         "line_items" => [
@@ -295,6 +968,26 @@ RSpec.describe MRubyEngine do
       expect(engine.extract("@cart")).to eq(value)
     end
 
+    it "extracts a hash in insertion order" do
+      engine.sandbox_eval("hash.rb", <<-SOURCE)
+        @my_hash = {}
+        20.times { |i| @my_hash["key_\#{19 - i}"] = i }
+        @my_hash.delete("key_7")
+        @my_hash["key_7"] = 0
+      SOURCE
+      keys = engine.extract("@my_hash").keys
+      expect(keys.first).to eq("key_19")
+      expect(keys.last).to eq("key_7")
+      expect(keys.size).to eq(20)
+    end
+
+    it "extracts a hash without allocating in the engine" do
+      engine.sandbox_eval("hash.rb", %(@my_hash = {}; 1000.times { |i| @my_hash[i] = i }))
+      memory = engine.stat[:memory]
+      expect(engine.extract("@my_hash").size).to eq(1000)
+      expect(engine.stat[:memory]).to eq(memory)
+    end
+
     it "extracts a hash with symbolic keys" do
       engine.sandbox_eval("hash.rb", %(@my_hash = {foo: 1}))
       expect(engine.extract("@my_hash")).to eq(foo: 1)
@@ -310,7 +1003,7 @@ RSpec.describe MRubyEngine do
       expect do
         engine.extract("@foo")
       end.to raise_error(MRubyEngine::EngineTypeError, squish(<<-MESSAGE))
-        can only extract strings, fixnums, symbols, arrays or hashes
+        can only extract strings, fixnums, floats, decimals, times, symbols, arrays or hashes
       MESSAGE
     end
 
@@ -338,6 +1031,444 @@ RSpec.describe MRubyEngine do
     end
   end
 
+  describe :extract_all do
+    it "raises ArgumentError if not initialized" do
+      expect do
+        MRubyEngine.allocate.extract_all(["@boom"])
+      end.to raise_error(ArgumentError, "uninitialized value when calling 'extract_all'")
+    end
+
+    it "extracts every value into a hash" do
+      engine.sandbox_eval("extract.rb", %(@foo = 17; @bar = ["bar", { baz: 1.5 }]))
+      expect(engine.extract_all(["@foo", "@bar", "@missing"])).to eq(
+        "@foo" => 17,
+        "@bar" => ["bar", { baz: 1.5 }],
+        "@missing" => nil,
+      )
+    end
+
+    it "round-trips inject_all" do
+      values = { "@foo" => { "a" => [1, "b"] }, "@bar" => :baz }
+      engine.inject_all(values)
+      expect(engine.extract_all(values.keys)).to eq(values)
+    end
+  end
+
+  describe :extract_paths do
+    before do
+      engine.sandbox_eval("result.rb", <<-'SOURCE')
+        @result = {
+          "cart" => {
+            "line_items" => [
+              { "line_price" => 1000, "messages" => ["on sale"], "properties" => Object.new },
+              { "line_price" => 800, "messages" => [], "properties" => Object.new },
+            ],
+            "attributes" => { "gift" => "yes", "note" => "hello" },
+          },
+          :discounts => [:free_shipping],
+        }
+      SOURCE
+    end
+
+    it "extracts one value per path" do
+      expect(engine.extract_paths("@result", [["cart", "attributes", "note"], [:discounts, 0]])).to eq(
+        ["hello", :free_shipping])
+    end
+
+    it "maps wildcards over arrays and hashes" do
+      paths = [
+        ["cart", "line_items", "*", "line_price"],
+        ["cart", "line_items", "*", "messages"],
+        ["cart", "attributes", "*"],
+      ]
+      expect(engine.extract_paths("@result", paths)).to eq([
+        [1000, 800],
+        [["on sale"], []],
+        ["yes", "hello"],
+      ])
+    end
+
+    it "selects nil for missing parts" do
+      paths = [
+        ["cart", "missing"],
+        ["cart", :attributes],
+        ["cart", "line_items", 5],
+        ["cart", "attributes", "note", "*"],
+        ["discounts"],
+      ]
+      expect(engine.extract_paths("@result", paths)).to eq([nil] * 5)
+    end
+
+    it "looks up keys of large hashes" do
+      engine.sandbox_eval("result.rb", <<-'SOURCE')
+        @value = {}
+        10_000.times { |i| @value["key#{i}"] = i }
+        @value[:key0] = "symbol"
+        @value[[1]] = "array"
+      SOURCE
+      paths = [["key0"], ["key9999"], [:key0], ["key10000"], [:key1]]
+      expect(engine.extract_paths("@value", paths)).to eq([0, 9_999, "symbol", nil, nil])
+    end
+
+    it "extracts the whole value for an empty path" do
+      engine.sandbox_eval("result.rb", "@value = [1, 2]")
+      expect(engine.extract_paths("@value", [[]])).to eq([[1, 2]])
+    end
+
+    it "ignores parts that could not be extracted" do
+      engine.sandbox_eval("nested.rb", <<-'SOURCE')
+        deep = []
+        40.times { deep = [deep] }
+        @nested = { "deep" => deep, "flat" => 1 }
+      SOURCE
+      expect(engine.extract_paths("@nested", [["flat"]])).to eq([1])
+      expect do
+        engine.extract_paths("@nested", [["deep"]])
+      end.to raise_error(MRubyEngine::EngineTypeError, "structure nested too deeply")
+    end
+
+    it "raises on invalid steps" do
+      expect do
+        engine.extract_paths("@result", [["cart", 1.5]])
+      end.to raise_error(ArgumentError, "path steps must be strings, symbols or integers, not 1.5")
+    end
+  end
+
+  describe :patch do
+    it "raises ArgumentError if not initialized" do
+      expect do
+        MRubyEngine.allocate.patch("@boom", [])
+      end.to raise_error(ArgumentError, "uninitialized value when calling 'patch'")
+    end
+
+    it "applies operations to an injected value in place" do
+      cart = { "lines" => [{ "id" => 1, "qty" => 1 }, { "id" => 2, "qty" => 5 }], :note => "x" }
+      engine.inject("@cart", cart)
+      engine.sandbox_eval("keep.rb", %(@lines = @cart["lines"]))
+      engine.patch("@cart", [
+        [:set, ["lines", 0, "qty"], 3],
+        [:insert, ["lines", 1], { "id" => 3, "qty" => 1 }],
+        [:delete, ["lines", -1]],
+        [:set, ["lines", 2], { "id" => 4, "qty" => 2 }],
+        [:delete, [:note]],
+        [:set, ["currency"], "CAD"],
+      ])
+
+      lines = [{ "id" => 1, "qty" => 3 }, { "id" => 3, "qty" => 1 }, { "id" => 4, "qty" => 2 }]
+      expect(engine.extract("@cart")).to eq("lines" => lines, "currency" => "CAD")
+      expect(engine.extract("@lines")).to eq(lines)
+    end
+
+    it "patches string keys of large hashes" do
+      engine.inject("@index", Hash[(0...10_000).map { |i| ["key#{i}", { "qty" => i }] }])
+      engine.patch("@index", [
+        [:set, ["key9999", "qty"], 0],
+        [:delete, ["key0"]],
+        [:delete, ["key1", "qty"]],
+      ])
+      engine.sandbox_eval("patch.rb", <<-'SOURCE')
+        assert_equal(9_999, @index.size)
+        assert_equal(nil, @index["key0"])
+        assert_equal({}, @index["key1"])
+        assert_equal({ "qty" => 0 }, @index["key9999"])
+      SOURCE
+    end
+
+    it "raises on operations that do not apply, keeping the earlier ones" do
+      engine.inject("@cart", { "lines" => [1] })
+      expect do
+        engine.patch("@cart", [[:set, ["lines", 0], 2], [:delete, ["lines", 1]]])
+      end.to raise_error(ArgumentError, "patch operation 1 does not apply to the value")
+      expect do
+        engine.patch("@cart", [[:insert, ["total"], 2]])
+      end.to raise_error(ArgumentError, "patch operation 0 does not apply to the value")
+      expect do
+        engine.patch("@cart", [[:set, ["missing", "qty"], 2]])
+      end.to raise_error(ArgumentError, "patch operation 0 does not apply to the value")
+      expect(engine.extract("@cart")).to eq("lines" => [2])
+    end
+
+    it "raises on frozen values" do
+      engine.inject("@settings", { "tags" => ["a"] }, freeze: true)
+      expect do
+        engine.patch("@settings", [[:delete, ["tags", 0]]])
+      end.to raise_error(MRubyEngine::EngineRuntimeError, /frozen/)
+      expect(engine.extract("@settings")).to eq("tags" => ["a"])
+    end
+
+    it "raises on malformed operations" do
+      expect do
+        engine.patch("@cart", [[:move, ["a"], 1]])
+      end.to raise_error(ArgumentError, "unknown patch operation move")
+      expect do
+        engine.patch("@cart", [[:set, [], 1]])
+      end.to raise_error(ArgumentError, "patch paths cannot be empty")
+      expect do
+        engine.patch("@cart", [[:delete, ["*"]]])
+      end.to raise_error(ArgumentError, "patch paths cannot contain wildcards")
+      expect do
+        engine.patch("@cart", [[:delete, ["a"], 1]])
+      end.to raise_error(ArgumentError, "patch operation 0 must have 2 elements")
+    end
+  end
+
+  describe :extract_changes do
+    let(:cart) do
+      {
+        "line_items" => [
+          { "title" => "Element", "quantity" => 1 },
+          { "title" => "Fuel", "quantity" => 2 },
+        ],
+        "note" => "hello",
+      }
+    end
+
+    before do
+      engine.inject("@cart", cart, track: true)
+    end
+
+    it "reports nothing when nothing changed" do
+      engine.sandbox_eval("cart.rb", %(@cart["line_items"].each { |item| item["quantity"] }))
+      expect(engine.extract_changes("@cart")).to eq([])
+    end
+
+    it "reports the containers that were written to" do
+      engine.sandbox_eval("cart.rb", %(@cart["line_items"][1]["quantity"] = 3))
+      expect(engine.extract_changes("@cart")).to eq([
+        [["line_items", 1], { "title" => "Fuel", "quantity" => 3 }],
+      ])
+    end
+
+    it "reports strings modified in place" do
+      engine.sandbox_eval("cart.rb", %(@cart["note"] << "!"; @cart["line_items"][0]["title"].upcase!))
+      expect(engine.extract_changes("@cart")).to eq([
+        [["line_items", 0, "title"], "ELEMENT"],
+        [["note"], "hello!"],
+      ])
+    end
+
+    it "reports values that replaced the injected ones" do
+      engine.sandbox_eval("cart.rb", %(@cart["line_items"] = @cart["line_items"].reverse))
+      expect(engine.extract_changes("@cart")).to eq([[[], engine.extract("@cart")]])
+
+      engine.sandbox_eval("cart.rb", %(@cart = nil))
+      expect(engine.extract_changes("@cart")).to eq([[[], nil]])
+    end
+
+    it "starts over when injected again" do
+      engine.sandbox_eval("cart.rb", %(@cart["note"] = "bye"))
+      engine.inject("@cart", cart, track: true)
+      expect(engine.extract_changes("@cart")).to eq([])
+    end
+
+    it "raises for values injected without tracking" do
+      engine.inject("@other", cart)
+      expect do
+        engine.extract_changes("@other")
+      end.to raise_error(ArgumentError, "value was not injected with tracking")
+    end
+  end
+
+  describe :extract_json do
+    it "raises ArgumentError if not initialized" do
+      expect do
+        MRubyEngine.allocate.extract_json("@boom")
+      end.to raise_error(ArgumentError, "uninitialized value when calling 'extract_json'")
+    end
+
+    it "generates the same document as JSON.generate" do
+      engine.sandbox_eval("extract.rb", <<-'SOURCE')
+        @foo = { "id" => 17, :tags => ["a", :b], "paid" => true, "note" => nil, 3 => "quote\" and \\ and \n" }
+      SOURCE
+      expect(engine.extract_json("@foo")).to eq(JSON.generate(engine.extract("@foo")))
+    end
+
+    it "generates floats" do
+      engine.sandbox_eval("extract.rb", %(@foo = [0.1, 1.0, 1.0 / 3]))
+      expect(engine.extract_json("@foo")).to eq("[0.1,1.0,0.3333333333333333]")
+      expect(engine.extract_json("@foo", float_precision: 3)).to eq("[0.1,1.0,0.333]")
+    end
+
+    it "generates decimals as strings or numbers" do
+      engine.sandbox_eval("extract.rb", %(@foo = [Decimal.new("1.50")]))
+      expect(engine.extract_json("@foo")).to eq(%(["1.50"]))
+      expect(engine.extract_json("@foo", decimal: :number)).to eq("[1.50]")
+    end
+
+    it "writes decimals without calling Decimal#to_s" do
+      engine.sandbox_eval("extract.rb", <<-SOURCE)
+        @foo = [Decimal.new("-0.05"), Decimal.new("12e3"), -Decimal.new("1e400")]
+        class Decimal
+          def to_s
+            1
+          end
+        end
+      SOURCE
+      expect(engine.extract_json("@foo")).to eq(%(["-0.05","12000","-1e400"]))
+    end
+
+    it "raises on an unknown decimal format" do
+      expect do
+        engine.extract_json("@foo", decimal: :float)
+      end.to raise_error(ArgumentError, "unknown decimal format float")
+    end
+
+    it "raises on values JSON cannot represent" do
+      engine.sandbox_eval("extract.rb", %(@foo = [1.0 / 0]))
+      expect do
+        engine.extract_json("@foo")
+      end.to raise_error(MRubyEngine::EngineTypeError)
+    end
+
+    it "round-trips with inject_json" do
+      json = %({"a":[1,2.5,"x"],"b":{"c":null}})
+      engine.inject_json("@foo", json)
+      expect(engine.extract_json("@foo")).to eq(json)
+    end
+  end
+
+  describe :pack do
+    it "round-trips through unpack" do
+      value = { "id" => 17, tags: ["a", :b], "paid" => true, "note" => nil, "ratio" => 0.5, "big" => 2**40 }
+      expect(MRubyEngine.unpack(MRubyEngine.pack(value))).to eq(value)
+    end
+
+    it "writes MessagePack" do
+      expect(MRubyEngine.pack([1, -1, 200, "ab", nil, true])).to eq("\x96\x01\xff\xcc\xc8\xa2ab\xc0\xc3".b)
+    end
+
+    it "raises on integers that do not fit 64 bits" do
+      expect do
+        MRubyEngine.pack([2**64])
+      end.to raise_error(MRubyEngine::EngineTypeError)
+    end
+
+    it "raises on malformed data" do
+      expect do
+        MRubyEngine.unpack("\x92\x01".b)
+      end.to raise_error(ArgumentError, "malformed packed data at offset 0")
+      expect do
+        MRubyEngine.unpack("\x01\x02".b)
+      end.to raise_error(ArgumentError, "malformed packed data at offset 1")
+    end
+  end
+
+  describe :inject_packed do
+    it "raises ArgumentError if not initialized" do
+      expect do
+        MRubyEngine.allocate.inject_packed("@boom", MRubyEngine.pack(nil))
+      end.to raise_error(ArgumentError, "uninitialized value when calling 'inject_packed'")
+    end
+
+    it "makes an unpacked value available inside the engine" do
+      value = { "id" => 17, tags: ["a", :b], "paid" => true, "note" => nil }
+      engine.inject_packed("@foo", MRubyEngine.pack(value))
+      expect(engine.extract("@foo")).to eq(value)
+    end
+
+    it "unpacks floats" do
+      engine.inject_packed("@foo", MRubyEngine.pack([1.5]))
+      engine.sandbox_eval("inject.rb", %(assert_equal([1.5], @foo)))
+    end
+
+    it "raises on malformed data" do
+      expect do
+        engine.inject_packed("@foo", "\xc1".b)
+      end.to raise_error(ArgumentError, "malformed packed data at offset 0")
+    end
+
+    it "raises EngineMemoryQuotaError when the value does not fit" do
+      engine = MRubyEngine.new(1 * MEGABYTE, reasonable_instruction_quota, reasonable_time_quota)
+      expect do
+        engine.inject_packed("@foo", MRubyEngine.pack(["x" * 100_000] * 20))
+      end.to raise_error(MRubyEngine::EngineMemoryQuotaError)
+    end
+  end
+
+  describe :extract_packed do
+    it "raises ArgumentError if not initialized" do
+      expect do
+        MRubyEngine.allocate.extract_packed("@boom")
+      end.to raise_error(ArgumentError, "uninitialized value when calling 'extract_packed'")
+    end
+
+    it "packs a guest value" do
+      engine.sandbox_eval("extract.rb", %(@foo = { "id" => 17, :tags => ["a", :b], "ratio" => 0.5 }))
+      expect(MRubyEngine.unpack(engine.extract_packed("@foo"))).to eq("id" => 17, tags: ["a", :b], "ratio" => 0.5)
+    end
+
+    it "round-trips with inject_packed" do
+      packed = MRubyEngine.pack([{ "a" => [1, 2] }, "x" * 300, -70_000])
+      engine.inject_packed("@foo", packed)
+      expect(engine.extract_packed("@foo")).to eq(packed)
+    end
+  end
+
+  describe :extract_into do
+    it "raises ArgumentError if not initialized" do
+      expect do
+        MRubyEngine.allocate.extract_into("@boom", MRubyEngine::ResultBuffer.new)
+      end.to raise_error(ArgumentError, "uninitialized value when calling 'extract_into'")
+    end
+
+    it "fills a result buffer that is read node by node" do
+      engine.sandbox_eval("extract.rb", %(@foo = { "id" => 17, :tags => ["a", :b], "ratio" => 0.5, "ok" => nil }))
+      buffer = engine.extract_into("@foo", MRubyEngine::ResultBuffer.new)
+
+      expect(buffer.type).to eq(:hash)
+      expect(buffer.size).to eq(4)
+      expect(buffer.value(buffer.key(0, 0))).to eq("id")
+      expect(buffer.value(buffer.child(0, 0))).to eq(17)
+      expect(buffer.lookup(0, "tags")).to be_nil
+
+      tags = buffer.lookup(0, :tags)
+      expect(buffer.type(tags)).to eq(:array)
+      expect(buffer.type(buffer.child(tags, 1))).to eq(:symbol)
+      expect(buffer.value(buffer.child(tags, 0))).to eq("a")
+      expect(buffer.type(buffer.lookup(0, "ratio"))).to eq(:float)
+      expect(buffer.type(buffer.lookup(0, "ok"))).to eq(:nil)
+      expect(buffer.value).to eq("id" => 17, tags: ["a", :b], "ratio" => 0.5, "ok" => nil)
+    end
+
+    it "holds decimals and times" do
+      engine.sandbox_eval("extract.rb", <<-'SOURCE')
+        @foo = [Decimal.new("12.34"), Time.at(1_500_000_000, 250_000).utc, Time.at(1_500_000_000)]
+      SOURCE
+      buffer = engine.extract_into("@foo", MRubyEngine::ResultBuffer.new)
+
+      expect(buffer.type(buffer.child(0, 0))).to eq(:decimal)
+      expect(buffer.type(buffer.child(0, 1))).to eq(:time)
+      expect(buffer.value(buffer.child(0, 0))).to eq(BigDecimal("12.34"))
+      expect(buffer.value(buffer.child(0, 1))).to eq(Time.at(1_500_000_000, 250_000))
+      expect(buffer.value(buffer.child(0, 1))).to be_utc
+      expect(buffer.value(buffer.child(0, 2))).not_to be_utc
+      expect { buffer.size(buffer.child(0, 1)) }.to raise_error(TypeError, "node 2 has no size")
+    end
+
+    it "reuses the buffer across extractions" do
+      buffer = MRubyEngine::ResultBuffer.new
+      engine.sandbox_eval("first.rb", %(@foo = (1..1_000).map(&:to_s)))
+      engine.extract_into("@foo", buffer)
+      expect(buffer.size).to eq(1_000)
+
+      engine.sandbox_eval("second.rb", %(@foo = [true]))
+      engine.extract_into("@foo", buffer)
+      expect(buffer.value).to eq([true])
+      expect { buffer.child(0, 1) }.to raise_error(IndexError, "index 1 outside of 1 elements")
+      expect { buffer.type(2) }.to raise_error(IndexError, "no node 2 in the result buffer")
+    end
+
+    it "is left empty when the value cannot be extracted" do
+      buffer = MRubyEngine::ResultBuffer.new
+      engine.sandbox_eval("extract.rb", %(@foo = [1]; @bar = [Object.new]))
+      engine.extract_into("@foo", buffer)
+      expect do
+        engine.extract_into("@bar", buffer)
+      end.to raise_error(MRubyEngine::EngineTypeError)
+      expect { buffer.value }.to raise_error(IndexError, "no node 0 in the result buffer")
+    end
+  end
+
   it "handes large integers" do
     value = 1_218_120_389
     engine.inject("@value", value)
@@ -431,6 +1562,60 @@ RSpec.describe MRubyEngine do
         mrb_engine.sandbox_eval("alloc_loop.rb", %(a = []; loop { a << ("foo" * 1000) }))
       }.to raise_error(MRubyEngine::EngineQuotaAlreadyReached)
     end
+
+    it "parses and generates JSON natively" do
+      engine.sandbox_eval("json.rb", <<-SOURCE)
+        value = JSON.parse('{"a": [1, 2.5, "x\\n"], "b": {"c": null, "d": true}}')
+        assert_equal({ "a" => [1, 2.5, "x\n"], "b" => { "c" => nil, "d" => true } }, value)
+        assert_equal(value, JSON.parse(JSON.generate(value)))
+        assert_equal('{"k":[false,"v"]}', JSON.generate({ k: [false, :v] }))
+      SOURCE
+    end
+
+    it "raises JSON errors the script can rescue" do
+      engine.sandbox_eval("json_errors.rb", <<-SOURCE)
+        begin
+          JSON.parse('[1, }')
+          raise "expected a parser error"
+        rescue JSON::ParserError => error
+          assert_equal("unexpected token at offset 4", error.message)
+        end
+        begin
+          JSON.generate(Object.new)
+          raise "expected a generator error"
+        rescue JSON::JSONError => error
+          assert_equal(JSON::GeneratorError, error.class)
+        end
+      SOURCE
+    end
+
+    it "generates decimals without calling Decimal#to_s" do
+      engine.sandbox_eval("json_decimal.rb", <<-SOURCE)
+        class Decimal
+          def to_s
+            1
+          end
+        end
+        assert_equal('["1.50"]', JSON.generate([Decimal.new("1.50")]))
+      SOURCE
+    end
+
+    it "stops generating documents larger than the memory quota" do
+      engine = MRubyEngine.new(reasonable_memory_quota, 100_000_000, reasonable_time_quota)
+      expect do
+        engine.sandbox_eval("json_large.rb", %(JSON.generate(Array.new(100, "x" * 100_000))))
+      end.to raise_error(MRubyEngine::EngineMemoryQuotaError)
+    end
+
+    it "charges JSON work against the instruction quota" do
+      document = JSON.generate(Array.new(10_000) { |i| { "id" => i } })
+      engine = MRubyEngine.new(reasonable_memory_quota, 1000, reasonable_time_quota)
+      engine.inject("@document", document)
+      expect do
+        engine.sandbox_eval("json_quota.rb", "JSON.parse(@document)")
+      end.to raise_error(MRubyEngine::EngineInstructionQuotaError)
+      expect(engine.stat[:instructions]).to eq(1000)
+    end
   end
 
   describe :load_instruction_sequence do
@@ -535,4 +1720,171 @@ RSpec.describe MRubyEngine do
       end.to raise_error(MRubyEngine::EngineSyntaxError, "sample_2.rb:1:1: syntax error")
     end
   end
+
+  describe MRubyEngine::SharedSegment do
+    let(:catalogue) do
+      {
+        "products" => [
+          { "title" => "Element", "price" => 1000, "tags" => [:new, :sale] },
+          { "title" => "Fuel", "price" => 800, "tags" => [] },
+        ],
+        "currency" => "CAD",
+        "published" => true,
+        "archived" => nil,
+      }
+    end
+
+    describe :new do
+      it "raises on unsupported values" do
+        expect do
+          MRubyEngine::SharedSegment.new(Object.new)
+        end.to raise_error(MRubyEngine::EngineTypeError)
+      end
+
+      it "raises when the value does not fit" do
+        expect do
+          MRubyEngine::SharedSegment.new(["x" * 300_000], capacity: 256 * 1024)
+        end.to raise_error(ArgumentError, "value does not fit in the shared segment")
+      end
+    end
+
+    describe :size do
+      it "reports the bytes used by the segment" do
+        segment = MRubyEngine::SharedSegment.new("x" * 10_000)
+        expect(segment.size).to be > 10_000
+      end
+    end
+
+    it "can be injected into many engines" do
+      segment = MRubyEngine::SharedSegment.new(catalogue)
+      3.times do
+        engine = make_test_engine
+        engine.inject("@catalogue", segment)
+        engine.sandbox_eval("shared.rb", %(@title = @catalogue["products"][0]["title"]))
+        expect(engine.extract("@title")).to eq("Element")
+        expect(engine.extract("@catalogue")).to eq(catalogue)
+      end
+    end
+
+    it "injects frozen objects" do
+      engine.inject("@catalogue", MRubyEngine::SharedSegment.new(catalogue))
+      engine.sandbox_eval("shared.rb", <<-SOURCE)
+        assert_equal(true, @catalogue.frozen?)
+        assert_equal(true, @catalogue["products"].frozen?)
+        assert_equal(true, @catalogue["currency"].frozen?)
+        assert_raises(RuntimeError, /frozen/) { @catalogue["currency"] << "!" }
+      SOURCE
+    end
+
+    it "does not charge string contents to the engine" do
+      segment = MRubyEngine::SharedSegment.new(["x" * MEGABYTE] * 8)
+      engine = make_test_engine
+      engine.inject("@catalogue", segment)
+      expect(engine.stat[:memory]).to be < reasonable_memory_quota
+      engine.sandbox_eval("shared.rb", %(@size = @catalogue.map(&:size).reduce(:+)))
+      expect(engine.extract("@size")).to eq(8 * MEGABYTE)
+    end
+
+    it "keeps the segment alive while an engine uses it" do
+      engine.inject("@catalogue", MRubyEngine::SharedSegment.new(catalogue))
+      GC.start
+      engine.sandbox_eval("shared.rb", %(@currency = @catalogue["currency"].dup))
+      expect(engine.extract("@currency")).to eq("CAD")
+    end
+  end
+
+  describe MRubyEngine::Schema do
+    let(:schema) do
+      MRubyEngine::Schema.new(
+        "line_items" => [{ "title" => :string, "quantity" => :integer, "taxable" => :boolean }],
+        "currency" => :string,
+        tags: [:symbol],
+      )
+    end
+
+    let(:cart) do
+      {
+        "line_items" => [
+          { "title" => "Element", "quantity" => 2, "taxable" => true },
+          { "quantity" => 1, "title" => "Fuel", "taxable" => false },
+        ],
+        "currency" => "CAD",
+        tags: [:new, :sale],
+      }
+    end
+
+    describe :new do
+      it "rejects unknown types" do
+        expect do
+          MRubyEngine::Schema.new("title" => :text)
+        end.to raise_error(ArgumentError, "unknown schema type text")
+      end
+
+      it "rejects invalid keys" do
+        expect do
+          MRubyEngine::Schema.new(1 => :string)
+        end.to raise_error(ArgumentError, "schema keys must be strings or symbols, not 1")
+      end
+
+      it "rejects arrays without a single element type" do
+        expect do
+          MRubyEngine::Schema.new([:string, :integer])
+        end.to raise_error(ArgumentError, "array schemas must have exactly one element type")
+      end
+
+      it "keeps the compiled schema when compiling another one fails" do
+        expect do
+          schema.send(:initialize, "currency" => :string, "title" => :text)
+        end.to raise_error(ArgumentError, "unknown schema type text")
+        GC.start
+        engine.inject("@cart", cart, schema: schema)
+        expect(engine.extract("@cart")).to eq(cart)
+      end
+    end
+
+    it "injects values matching the schema" do
+      engine.inject("@cart", cart, schema: schema)
+      expect(engine.extract("@cart")).to eq(cart)
+    end
+
+    it "falls back to generic conversion outside the schema" do
+      cart["line_items"][0]["title"] = nil
+      cart["line_items"][1]["quantity"] = "1"
+      cart["line_items"][1]["sku"] = "FUEL-1"
+      cart["note"] = { "gift" => true }
+      engine.inject("@cart", cart, schema: schema)
+      expect(engine.extract("@cart")).to eq(cart)
+    end
+
+    it "can be reused across engines" do
+      3.times do
+        engine = make_test_engine
+        engine.inject("@cart", cart, schema: schema)
+        engine.sandbox_eval("schema.rb", %(@title = @cart["line_items"][1]["title"]))
+        expect(engine.extract("@title")).to eq("Fuel")
+      end
+    end
+
+    it "keeps its keys alive" do
+      schema = MRubyEngine::Schema.new("title" => :string)
+      GC.start
+      engine.inject("@item", { "title" => "Element" }, schema: schema)
+      expect(engine.extract("@item")).to eq("title" => "Element")
+    end
+
+    it "still enforces the depth limit" do
+      value = []
+      nested = value
+      40.times { nested << (nested = []) }
+      expect do
+        engine.inject("@nested", value, schema: MRubyEngine::Schema.new([:any]))
+      end.to raise_error(MRubyEngine::EngineTypeError, "structure nested too deeply")
+    end
+
+    it "cannot be used with a shared segment" do
+      expect do
+        engine.inject("@cart", MRubyEngine::SharedSegment.new(cart), schema: schema)
+      end.to raise_error(ArgumentError, "a shared segment cannot be injected with a schema, tracking, dedup, zero copy or freeze")
+    end
+  end
 end